@@ -0,0 +1,1536 @@
+#include <cmath>       // pow, round, floor, ceil, trunc, isfinite
+#include <cctype>      // tolower, toupper, isalnum, isdigit
+#include <cstdio>      // snprintf
+#include <cstring>     // strncmp
+#include <charconv>    // from_chars, to_chars
+#include <stdexcept>   // runtime_error
+#include <utility>     // move
+#include "calc.hh"
+#include "schema.hh"   // CellRef
+
+/** bits of a key used by the column */
+static const unsigned int COLUMN_BITS = 14;
+/** last row of a sheet */
+static const unsigned int MAX_ROWS = 1048576;
+/** longest formula accepted, like in Excel */
+static const std::string::size_type MAX_LENGTH = 8192;
+/** deepest nesting of parentheses, calls and operator chains */
+static const unsigned int MAX_DEPTH = 256;
+
+/** binary operators, by op of a BINARY node */
+enum operator_t {
+	ADD,
+	SUBTRACT,
+	MULTIPLY,
+	DIVIDE,
+	POWER,
+	CONCAT,
+	EQUAL,
+	NOT_EQUAL,
+	LESS,
+	LESS_EQUAL,
+	GREATER,
+	GREATER_EQUAL
+};
+
+/** operators of each precedence level, the first one binds the least */
+static const struct {
+	const char* symbol;
+	unsigned int level;
+	operator_t op;
+} operators[] = {
+	// two characters first so <= is not taken for <
+	{"<=", 0, LESS_EQUAL}, {">=", 0, GREATER_EQUAL}, {"<>", 0, NOT_EQUAL},
+	{"=", 0, EQUAL}, {"<", 0, LESS}, {">", 0, GREATER},
+	{"&", 1, CONCAT},
+	{"+", 2, ADD}, {"-", 2, SUBTRACT},
+	{"*", 3, MULTIPLY}, {"/", 3, DIVIDE},
+	{"^", 4, POWER}
+};
+/** level of the unary operators, above every binary one */
+static const unsigned int UNARY_LEVEL = 5;
+
+/** functions, by op of a CALL node, in the order of the table below */
+enum function_t {
+	SUM,
+	MIN,
+	MAX,
+	AVERAGE,
+	ROUND,
+	ROUNDUP,
+	ROUNDDOWN,
+	INT,
+	ABS,
+	IF,
+	IFERROR,
+	AND,
+	OR,
+	NOT,
+	VLOOKUP,
+	INDEX,
+	MATCH
+};
+
+/** name and number of arguments of each function */
+static const struct {
+	const char* name;
+	unsigned int min_args;
+	unsigned int max_args;
+} functions[] = {
+	{"SUM", 1, 255},
+	{"MIN", 1, 255},
+	{"MAX", 1, 255},
+	{"AVERAGE", 1, 255},
+	{"ROUND", 2, 2},
+	{"ROUNDUP", 2, 2},
+	{"ROUNDDOWN", 2, 2},
+	{"INT", 1, 1},
+	{"ABS", 1, 1},
+	{"IF", 2, 3},
+	{"IFERROR", 2, 2},
+	{"AND", 1, 255},
+	{"OR", 1, 255},
+	{"NOT", 1, 1},
+	{"VLOOKUP", 3, 4},
+	{"INDEX", 2, 3},
+	{"MATCH", 2, 3}
+};
+
+/** errors that can be written in a formula */
+static const char* const error_names[] = {
+	"#DIV/0!", "#N/A", "#NAME?", "#NULL!", "#NUM!", "#REF!", "#VALUE!"
+};
+
+/**
+ * @brief Build an error value
+ *
+ * @param name Error like #DIV/0!
+ *
+ * @return the value
+ */
+static Calculator::value_t failure(const char* name)
+{
+	return Calculator::value_t{Calculator::value_t::ERROR_VALUE, 0, name};
+}
+
+/**
+ * @brief Build a number value
+ *
+ * @param number The number, infinite and NaN give #NUM!
+ *
+ * @return the value
+ */
+static Calculator::value_t number(const double number)
+{
+	if (!std::isfinite(number)) {
+		return failure("#NUM!");
+	}
+	// -0 is written as 0
+	return Calculator::value_t{Calculator::value_t::NUMBER, number == 0 ? 0 : number, std::string()};
+}
+
+/**
+ * @brief Build a boolean value
+ *
+ * @param boolean The boolean
+ *
+ * @return the value
+ */
+static Calculator::value_t boolean(const bool boolean)
+{
+	return Calculator::value_t{Calculator::value_t::BOOLEAN, boolean ? 1.0 : 0.0, std::string()};
+}
+
+/**
+ * @brief Convert a value to a number
+ *
+ * Empty is 0, booleans are 1 and 0 and text must hold a number.
+ *
+ * @param value Value to convert
+ *
+ * @return a number or an error
+ */
+static Calculator::value_t toNumber(const Calculator::value_t& value)
+{
+	switch (value.type) {
+	case Calculator::value_t::EMPTY:
+		return number(0);
+	case Calculator::value_t::NUMBER:
+	case Calculator::value_t::BOOLEAN:
+		return number(value.number);
+	case Calculator::value_t::TEXT: {
+		const char* first = value.text.data();
+		const char* last = first + value.text.size();
+		while (first < last && *first == ' ') ++first;
+		while (last > first && last[-1] == ' ') --last;
+		if (first < last && *first == '+') ++first;
+
+		double result;
+		const std::from_chars_result parsed = std::from_chars(first, last, result);
+		if (first == last || parsed.ec != std::errc() || parsed.ptr != last) {
+			return failure("#VALUE!");
+		}
+		return number(result);
+	}
+	default:
+		return value;
+	}
+}
+
+/**
+ * @brief Convert a value to a boolean
+ *
+ * Empty is false, numbers are true unless 0 and text must be
+ * TRUE or FALSE.
+ *
+ * @param value Value to convert
+ *
+ * @return a boolean or an error
+ */
+static Calculator::value_t toBoolean(const Calculator::value_t& value)
+{
+	switch (value.type) {
+	case Calculator::value_t::EMPTY:
+		return boolean(false);
+	case Calculator::value_t::NUMBER:
+	case Calculator::value_t::BOOLEAN:
+		return boolean(value.number != 0);
+	case Calculator::value_t::TEXT: {
+		std::string upper = value.text;
+		for (auto& c : upper) c = std::toupper(static_cast<unsigned char>(c));
+		if (upper == "TRUE" || upper == "FALSE") {
+			return boolean(upper == "TRUE");
+		}
+		return failure("#VALUE!");
+	}
+	default:
+		return value;
+	}
+}
+
+/**
+ * @brief Convert a value to the text used by &
+ *
+ * Numbers have at most 15 significant digits like in the cells.
+ *
+ * @param value Value to convert, not an error
+ *
+ * @return the text
+ */
+static std::string toText(const Calculator::value_t& value)
+{
+	switch (value.type) {
+	case Calculator::value_t::NUMBER: {
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.15g", value.number);
+		return buffer;
+	}
+	case Calculator::value_t::BOOLEAN:
+		return value.number ? "TRUE" : "FALSE";
+	default:
+		return value.text;
+	}
+}
+
+/**
+ * @brief Compare two values like Excel
+ *
+ * Numbers come before text and text before booleans, text is
+ * compared without case. Empty takes the type of the other side.
+ *
+ * @param a First value, not an error
+ * @param b Second value, not an error
+ *
+ * @return negative, zero or positive like strcmp
+ */
+static int compare(const Calculator::value_t& a, const Calculator::value_t& b)
+{
+	typedef Calculator::value_t value_t;
+	static const std::string empty;
+
+	const value_t::type_t type_a = (a.type == value_t::EMPTY ? (b.type == value_t::EMPTY ? value_t::NUMBER : b.type) : a.type);
+	const value_t::type_t type_b = (b.type == value_t::EMPTY ? type_a : b.type);
+
+	if (type_a != type_b) {
+		// NUMBER < TEXT < BOOLEAN, the order of the enum
+		return type_a < type_b ? -1 : 1;
+	}
+
+	if (type_a == value_t::TEXT) {
+		const std::string& text_a = (a.type == value_t::EMPTY ? empty : a.text);
+		const std::string& text_b = (b.type == value_t::EMPTY ? empty : b.text);
+		for (std::string::size_type i = 0; i < text_a.size() && i < text_b.size(); ++i) {
+			const int c_a = std::tolower(static_cast<unsigned char>(text_a[i]));
+			const int c_b = std::tolower(static_cast<unsigned char>(text_b[i]));
+			if (c_a != c_b) {
+				return c_a < c_b ? -1 : 1;
+			}
+		}
+		return text_a.size() == text_b.size() ? 0 : (text_a.size() < text_b.size() ? -1 : 1);
+	}
+
+	const double number_a = (a.type == value_t::EMPTY ? 0 : a.number);
+	const double number_b = (b.type == value_t::EMPTY ? 0 : b.number);
+	return number_a == number_b ? 0 : (number_a < number_b ? -1 : 1);
+}
+
+/**
+ * @brief Check if two values are exactly the same
+ *
+ * @param a First value
+ * @param b Second value
+ *
+ * @return true if type and content are equal
+ */
+static bool same(const Calculator::value_t& a, const Calculator::value_t& b)
+{
+	if (a.type != b.type) {
+		return false;
+	}
+	if (a.type == Calculator::value_t::NUMBER || a.type == Calculator::value_t::BOOLEAN) {
+		return a.number == b.number;
+	}
+	return a.text == b.text;
+}
+
+/**
+ * @brief Round a number like ROUND, ROUNDUP and ROUNDDOWN
+ *
+ * The scaled number is first reduced to 15 significant digits,
+ * so 2.675 rounds up like the 2.675 the user typed even though
+ * the double is slightly below it.
+ *
+ * @param value Number to round
+ * @param digits Digits after the point, negative before it
+ * @param mode 0 rounds half away from zero, 1 away from zero and
+ * -1 towards zero
+ *
+ * @return rounded number
+ */
+static double roundDigits(const double value, double digits, const int mode)
+{
+	digits = std::trunc(digits);
+	if (digits > 15) {
+		return value;
+	}
+	if (digits < -308) {
+		return 0;
+	}
+
+	const double scale = std::pow(10.0, std::fabs(digits));
+	double scaled = (digits >= 0 ? value * scale : value / scale);
+
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%.15g", scaled);
+	std::from_chars(buffer, buffer + std::strlen(buffer), scaled);
+
+	if (mode == 0) {
+		scaled = std::round(scaled);
+	}
+	else if (mode > 0) {
+		scaled = (scaled < 0 ? std::floor(scaled) : std::ceil(scaled));
+	}
+	else {
+		scaled = std::trunc(scaled);
+	}
+
+	return digits >= 0 ? scaled / scale : scaled * scale;
+}
+
+/**
+ * @brief Skip white space in a formula
+ *
+ * @param c Current character, moved after the spaces
+ */
+static void skipSpaces(const char*& c)
+{
+	while (*c == ' ' || *c == '\n' || *c == '\r' || *c == '\t') {
+		++c;
+	}
+}
+
+/**
+ * @brief Check if a character can be part of a name
+ *
+ * @param c Character
+ *
+ * @return true for letters, digits, _, . and $
+ */
+static bool nameChar(const char c)
+{
+	return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$' || c == '\\';
+}
+
+/**
+ * @brief Parse one side of a reference
+ *
+ * Accepts a cell like $A$1 or a column alone like $A.
+ *
+ * @param c Current character, moved after the reference
+ * @param column Receives the zero based column
+ * @param row Receives the row, 0 if there's only a column
+ * @param fixed_column Receives whether the column has a $
+ * @param fixed_row Receives whether the row has a $
+ *
+ * @return false if there's no reference
+ */
+static bool parseReference(const char*& c, unsigned int& column, unsigned int& row, bool& fixed_column, bool& fixed_row)
+{
+	fixed_column = (*c == '$');
+	if (fixed_column) {
+		++c;
+	}
+
+	column = 0;
+	unsigned int letters = 0;
+	while (std::isalpha(static_cast<unsigned char>(*c)) && letters < 3) {
+		column = column * 26 + (std::toupper(static_cast<unsigned char>(*c++)) - 'A' + 1);
+		++letters;
+	}
+	if (letters == 0 || column > CellRef::MAX_COLUMNS) {
+		return false;
+	}
+	column--;
+
+	fixed_row = (*c == '$');
+	if (fixed_row) {
+		++c;
+	}
+
+	row = 0;
+	unsigned int digits = 0;
+	while (std::isdigit(static_cast<unsigned char>(*c)) && digits < 7) {
+		row = row * 10 + (*c++ - '0');
+		++digits;
+	}
+
+	// a $ must be followed by the row
+	return row <= MAX_ROWS && (digits > 0 || !fixed_row);
+}
+
+/**
+ * @brief Move a relative coordinate of a shared formula
+ *
+ * @param value Coordinate, moved by offset
+ * @param offset Distance from the cell the formula was written for
+ * @param first Smallest valid coordinate
+ * @param last Largest valid coordinate
+ *
+ * @return false if it leaves the sheet
+ */
+static bool shift(unsigned int& value, const long long offset, const long long first, const long long last)
+{
+	const long long moved = static_cast<long long>(value) + offset;
+	if (moved < first || moved > last) {
+		return false;
+	}
+	value = static_cast<unsigned int>(moved);
+	return true;
+}
+
+/**
+ * @brief Start with no cells
+ *
+ * @param sheet_names Name of each sheet, references use them
+ * @param recalculate Whether every formula must be recomputed
+ * even if it has a cached value
+ * @param warnings Stream where warnings are written to
+ * @param loader Called once for each sheet a formula refers to,
+ * it must give its cells with setCell and setFormula
+ */
+Calculator::Calculator(const std::vector<std::string>& sheet_names, const bool recalculate, std::ostream& warnings, std::function<void(unsigned int)> loader)
+	: names(sheet_names), sheets(sheet_names.size()), loaded(sheet_names.size(), false), load(std::move(loader)), recalc_all(recalculate), log(warnings)
+{
+}
+
+/**
+ * @brief Key of a cell in cells_t
+ *
+ * Rows are the high bits so cells are sorted by row and then
+ * column, like in the sheet.
+ *
+ * @param column Zero based column
+ * @param row Row
+ *
+ * @return the key
+ */
+unsigned long long Calculator::key(const unsigned int column, const unsigned int row)
+{
+	return (static_cast<unsigned long long>(row) << COLUMN_BITS) | column;
+}
+
+/**
+ * @brief Get the cells of a sheet, reading it if needed
+ *
+ * @param sheet_nr Internal number of the sheet
+ *
+ * @return the cells
+ */
+Calculator::cells_t& Calculator::sheet(const unsigned int sheet_nr)
+{
+	if (!loaded[sheet_nr]) {
+		loaded[sheet_nr] = true;
+		load(sheet_nr);
+	}
+	return sheets[sheet_nr];
+}
+
+/**
+ * @brief Set the cached value of a cell
+ *
+ * @param sheet_nr Internal number of the sheet
+ * @param column Zero based column
+ * @param row Row
+ * @param value Value saved in the workbook
+ */
+void Calculator::setCell(const unsigned int sheet_nr, const unsigned int column, const unsigned int row, const value_t& value)
+{
+	sheets[sheet_nr][key(column, row)].cached = value;
+}
+
+/**
+ * @brief Set the formula of a cell
+ *
+ * The text is only parsed if the formula has to be checked.
+ *
+ * @param sheet_nr Internal number of the sheet
+ * @param column Zero based column
+ * @param row Row
+ * @param text Formula without the =
+ * @param base_column Column the text was written for, relative
+ * references of shared formulas are moved by the distance
+ * @param base_row Row the text was written for
+ * @param cached Whether the workbook has a cached value
+ */
+void Calculator::setFormula(const unsigned int sheet_nr, const unsigned int column, const unsigned int row, const std::string& text, const unsigned int base_column, const unsigned int base_row, const bool cached)
+{
+	cell_t& cell = sheets[sheet_nr][key(column, row)];
+
+	cell.formula.reset(new formula_t());
+	cell.formula->text = text;
+	cell.formula->sheet = sheet_nr;
+	cell.formula->column = column;
+	cell.formula->row = row;
+	cell.formula->base_column = base_column;
+	cell.formula->base_row = base_row;
+	cell.formula->cached = cached;
+	cell.formula->state = NEW;
+	cell.formula->changed = false;
+}
+
+/**
+ * @brief Get the current value of a cell
+ *
+ * @param cell The cell
+ *
+ * @return computed value if it changed, the cached one otherwise
+ */
+const Calculator::value_t& Calculator::current(const cell_t& cell)
+{
+	return (cell.formula && cell.formula->changed) ? cell.formula->value : cell.cached;
+}
+
+/**
+ * @brief Get the current value of a cell
+ *
+ * @param sheet_nr Internal number of the sheet
+ * @param column Zero based column
+ * @param row Row
+ *
+ * @return the value, empty if there's no cell
+ */
+const Calculator::value_t& Calculator::cellValue(const unsigned int sheet_nr, const unsigned int column, const unsigned int row)
+{
+	static const value_t empty{value_t::EMPTY, 0, std::string()};
+
+	const cells_t& cells = sheet(sheet_nr);
+	auto cell = cells.find(key(column, row));
+
+	return cell == cells.end() ? empty : current(cell->second);
+}
+
+/**
+ * @brief Write a warning about a formula
+ *
+ * @param formula The formula
+ * @param code Warning code
+ * @param message Description of the problem
+ */
+void Calculator::warn(const formula_t& formula, const std::string& code, const std::string& message) const
+{
+	log << names[formula.sheet] << "(" << CellRef::ref(formula.column, formula.row) << ") : Formula warning " << code << ":" << message << "\n";
+}
+
+/**
+ * @brief Recompute a formula if its cached value is stale
+ *
+ * Everything the formula depends on is brought up to date first.
+ *
+ * @param sheet_nr Internal number of the sheet
+ * @param column Zero based column
+ * @param row Row
+ * @param text Receives the new value when recomputed
+ *
+ * @return false if the cached value is still right or the cell
+ * has no formula
+ */
+bool Calculator::evaluate(const unsigned int sheet_nr, const unsigned int column, const unsigned int row, std::string& text)
+{
+	cells_t& cells = sheet(sheet_nr);
+	auto cell = cells.find(key(column, row));
+
+	if (cell == cells.end() || !cell->second.formula) {
+		return false;
+	}
+
+	update(cell->second);
+
+	if (!cell->second.formula->changed) {
+		return false;
+	}
+
+	text = Calculator::text(cell->second.formula->value);
+	return true;
+}
+
+/**
+ * @brief Convert a value to the text written in dats
+ *
+ * Numbers are written with the fewest digits that read back as
+ * the same double, booleans like boolean cells.
+ *
+ * @param value The value
+ *
+ * @return the text
+ */
+std::string Calculator::text(const value_t& value)
+{
+	switch (value.type) {
+	case value_t::NUMBER: {
+		char buffer[32];
+		const std::to_chars_result written = std::to_chars(buffer, buffer + sizeof(buffer), value.number);
+		return std::string(buffer, written.ptr);
+	}
+	case value_t::BOOLEAN:
+		return value.number ? "true" : "false";
+	default:
+		return value.text;
+	}
+}
+
+/**
+ * @brief Make sure a formula and everything it depends on is up to date
+ *
+ * Walks the dependency graph depth first with a stack of its
+ * own, chains of formulas can be as long as the sheet. A formula
+ * is only computed when its cached value is missing, every formula
+ * must be recomputed or one of its precedents changed.
+ *
+ * - FRM1: a stale formula could not be parsed, its cached value is kept
+ * - FRM2: circular reference
+ * - FRM3: the formula gives an error
+ *
+ * @param target Cell with the formula
+ */
+void Calculator::update(cell_t& target)
+{
+	if (target.formula->state == DONE) {
+		return;
+	}
+
+	std::vector<std::pair<cell_t*, unsigned int>> stack;
+	stack.emplace_back(&target, 0);
+
+	while (!stack.empty()) {
+		cell_t& cell = *stack.back().first;
+		formula_t& formula = *cell.formula;
+
+		if (formula.state == NEW) {
+			formula.state = VISITING;
+			parse(formula);
+			findPrecedents(formula);
+		}
+
+		// precedents first
+		if (stack.back().second < formula.precedents.size()) {
+			cell_t& next = *formula.precedents[stack.back().second++];
+
+			if (next.formula->state == NEW) {
+				stack.emplace_back(&next, 0);
+			}
+			else if (next.formula->state == VISITING) {
+				warn(*next.formula, "FRM2", "Circular reference, the cached value of " + CellRef::ref(next.formula->column, next.formula->row) + " is used.");
+			}
+			continue;
+		}
+
+		bool stale = recalc_all || !formula.cached;
+		for (auto const precedent : formula.precedents) {
+			stale = stale || precedent->formula->changed;
+		}
+
+		if (stale && !formula.error.empty()) {
+			warn(formula, "FRM1", "Formula '" + formula.text + "' could not be recalculated, " + formula.error + ". The cached value is used.");
+		}
+		else if (stale) {
+			formula.value = evaluate(formula, formula.nodes.size() - 1);
+
+			// a formula pointing to an empty cell gives 0
+			if (formula.value.type == value_t::EMPTY) {
+				formula.value = number(0);
+			}
+			formula.changed = !formula.cached || !same(formula.value, cell.cached);
+
+			if (formula.value.type == value_t::ERROR_VALUE) {
+				warn(formula, "FRM3", "Formula '" + formula.text + "' gives " + formula.value.text + ".");
+			}
+		}
+
+		formula.state = DONE;
+		stack.pop_back();
+	}
+}
+
+/**
+ * @brief Find the formulas a formula depends on
+ *
+ * Only cells with formulas matter, values can't be stale. Areas
+ * only look at the cells that exist, so whole columns are cheap.
+ *
+ * @param formula The formula, already parsed
+ */
+void Calculator::findPrecedents(formula_t& formula)
+{
+	for (auto const& node : formula.nodes) {
+		if (node.kind != node_t::REF && node.kind != node_t::RANGE) {
+			continue;
+		}
+
+		cells_t& cells = sheet(node.sheet);
+		const auto end = cells.upper_bound(key(node.column2, node.row2));
+		for (auto cell = cells.lower_bound(key(node.column1, node.row1)); cell != end; ++cell) {
+			const unsigned int column = cell->first & (CellRef::MAX_COLUMNS - 1);
+			if (column >= node.column1 && column <= node.column2 && cell->second.formula) {
+				formula.precedents.push_back(&cell->second);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Parse the text of a formula
+ *
+ * Errors are kept in the formula and only reported if it must
+ * be recomputed.
+ *
+ * @param formula The formula
+ */
+void Calculator::parse(formula_t& formula)
+{
+	parse_t in{formula, formula.text.c_str(), 0};
+
+	try {
+		if (formula.text.size() > MAX_LENGTH) {
+			throw std::runtime_error("it is too long");
+		}
+
+		parseBinary(in, 0);
+		skipSpaces(in.c);
+
+		if (*in.c) {
+			throw std::runtime_error(std::string("unexpected '") + *in.c + "'");
+		}
+	}
+	catch (const std::runtime_error& e) {
+		formula.error = e.what();
+		formula.nodes.clear();
+	}
+}
+
+/**
+ * @brief Add a node to the formula
+ *
+ * @param formula The formula
+ * @param node Node to add
+ *
+ * @return index of the node
+ */
+unsigned int Calculator::addNode(formula_t& formula, node_t&& node)
+{
+	formula.nodes.push_back(std::move(node));
+	return formula.nodes.size() - 1;
+}
+
+/**
+ * @brief Parse an expression with operators of at least some precedence
+ *
+ * Operators of the same level are left associative.
+ *
+ * @param in Parser state
+ * @param level Lowest precedence level accepted
+ *
+ * @return index of the node
+ */
+unsigned int Calculator::parseBinary(parse_t& in, const unsigned int level)
+{
+	if (level == UNARY_LEVEL) {
+		return parseUnary(in);
+	}
+
+	unsigned int left = parseBinary(in, level + 1);
+	const unsigned int depth = in.depth;
+
+	for (;;) {
+		skipSpaces(in.c);
+
+		const operator_t* op = nullptr;
+		std::string::size_type length = 0;
+		for (auto const& entry : operators) {
+			length = std::strlen(entry.symbol);
+			if (entry.level == level && !std::strncmp(in.c, entry.symbol, length)) {
+				op = &entry.op;
+				break;
+			}
+		}
+		if (op == nullptr) {
+			break;
+		}
+
+		// each operator of a chain nests the left side one level deeper
+		if (++in.depth > MAX_DEPTH) {
+			throw std::runtime_error("it is nested too deep");
+		}
+
+		in.c += length;
+		const unsigned int right = parseBinary(in, level + 1);
+
+		node_t node{};
+		node.kind = node_t::BINARY;
+		node.op = *op;
+		node.args = {left, right};
+		left = addNode(in.formula, std::move(node));
+	}
+
+	in.depth = depth;
+	return left;
+}
+
+/**
+ * @brief Parse unary operators and percent
+ *
+ * Like in Excel the minus binds tighter than ^, -2^2 is 4.
+ *
+ * @param in Parser state
+ *
+ * @return index of the node
+ */
+unsigned int Calculator::parseUnary(parse_t& in)
+{
+	skipSpaces(in.c);
+
+	if (*in.c == '-' || *in.c == '+') {
+		const bool negate = (*in.c++ == '-');
+
+		if (++in.depth > MAX_DEPTH) {
+			throw std::runtime_error("it is nested too deep");
+		}
+		const unsigned int operand = parseUnary(in);
+		in.depth--;
+
+		if (!negate) {
+			return operand;
+		}
+
+		node_t node{};
+		node.kind = node_t::NEGATE;
+		node.args = {operand};
+		return addNode(in.formula, std::move(node));
+	}
+
+	unsigned int operand = parsePrimary(in);
+
+	for (skipSpaces(in.c); *in.c == '%'; skipSpaces(in.c)) {
+		++in.c;
+		node_t node{};
+		node.kind = node_t::PERCENT;
+		node.args = {operand};
+		operand = addNode(in.formula, std::move(node));
+	}
+
+	return operand;
+}
+
+/**
+ * @brief Parse a value, reference, call or parenthesis
+ *
+ * @param in Parser state
+ *
+ * @return index of the node
+ */
+unsigned int Calculator::parsePrimary(parse_t& in)
+{
+	skipSpaces(in.c);
+	node_t node{};
+	node.kind = node_t::CONSTANT;
+
+	// parenthesis
+	if (*in.c == '(') {
+		++in.c;
+		if (++in.depth > MAX_DEPTH) {
+			throw std::runtime_error("it is nested too deep");
+		}
+
+		const unsigned int inner = parseBinary(in, 0);
+		skipSpaces(in.c);
+		if (*in.c++ != ')') {
+			throw std::runtime_error("a ) is missing");
+		}
+
+		in.depth--;
+		return inner;
+	}
+
+	// text, "" is a quote
+	if (*in.c == '"') {
+		node.constant.type = value_t::TEXT;
+		for (++in.c; *in.c != '"' || in.c[1] == '"'; ++in.c) {
+			if (!*in.c) {
+				throw std::runtime_error("a \" is missing");
+			}
+			if (*in.c == '"') {
+				++in.c;
+			}
+			node.constant.text += *in.c;
+		}
+		++in.c;
+		return addNode(in.formula, std::move(node));
+	}
+
+	// error
+	if (*in.c == '#') {
+		for (auto const name : error_names) {
+			if (!std::strncmp(in.c, name, std::strlen(name))) {
+				in.c += std::strlen(name);
+				node.constant = failure(name);
+				return addNode(in.formula, std::move(node));
+			}
+		}
+		throw std::runtime_error("unknown error");
+	}
+
+	// number
+	if (std::isdigit(static_cast<unsigned char>(*in.c)) || *in.c == '.') {
+		const char* end = in.c;
+		while (std::isdigit(static_cast<unsigned char>(*end)) || *end == '.') ++end;
+		if ((*end == 'e' || *end == 'E') && (std::isdigit(static_cast<unsigned char>(end[1])) || ((end[1] == '+' || end[1] == '-') && std::isdigit(static_cast<unsigned char>(end[2]))))) {
+			end += 2;
+			while (std::isdigit(static_cast<unsigned char>(*end))) ++end;
+		}
+
+		double value;
+		const std::from_chars_result parsed = std::from_chars(in.c, end, value);
+		if (parsed.ec != std::errc() || parsed.ptr != end) {
+			throw std::runtime_error("invalid number");
+		}
+
+		in.c = end;
+		node.constant = number(value);
+		return addNode(in.formula, std::move(node));
+	}
+
+	// sheet name between quotes, '' is a quote
+	if (*in.c == '\'') {
+		std::string name;
+		for (++in.c; *in.c != '\'' || in.c[1] == '\''; ++in.c) {
+			if (!*in.c) {
+				throw std::runtime_error("a ' is missing");
+			}
+			if (*in.c == '\'') {
+				++in.c;
+			}
+			name += *in.c;
+		}
+		in.c++;
+
+		if (*in.c++ != '!') {
+			throw std::runtime_error("a ! is missing after the sheet name");
+		}
+
+		return parseArea(in, sheetNumber(name));
+	}
+
+	if (!nameChar(*in.c)) {
+		throw std::runtime_error(*in.c ? std::string("unexpected '") + *in.c + "'" : std::string("it ends too early"));
+	}
+
+	const char* start = in.c;
+	const char* end = in.c;
+	while (nameChar(*end)) ++end;
+	std::string word(start, end);
+	for (auto& c : word) c = std::toupper(static_cast<unsigned char>(c));
+
+	// function call
+	if (*end == '(') {
+		// functions added after 2007 have a prefix
+		if (!word.compare(0, 6, "_XLFN.") || !word.compare(0, 6, "_XLWS.")) {
+			word.erase(0, 6);
+		}
+
+		node.kind = node_t::CALL;
+		node.op = sizeof(functions) / sizeof(functions[0]);
+		for (unsigned int i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i) {
+			if (word == functions[i].name) {
+				node.op = i;
+			}
+		}
+		if (node.op == sizeof(functions) / sizeof(functions[0])) {
+			throw std::runtime_error("function " + word + " is not supported");
+		}
+
+		in.c = end + 1;
+		if (++in.depth > MAX_DEPTH) {
+			throw std::runtime_error("it is nested too deep");
+		}
+
+		skipSpaces(in.c);
+		if (*in.c == ')') {
+			++in.c;
+		}
+		else {
+			for (;;) {
+				skipSpaces(in.c);
+				if (*in.c == ',' || *in.c == ')') {
+					node_t missing{};
+					missing.kind = node_t::MISSING;
+					node.args.push_back(addNode(in.formula, std::move(missing)));
+				}
+				else {
+					node.args.push_back(parseBinary(in, 0));
+					skipSpaces(in.c);
+				}
+
+				if (*in.c == ')') {
+					++in.c;
+					break;
+				}
+				if (*in.c++ != ',') {
+					throw std::runtime_error("a ) is missing");
+				}
+			}
+		}
+		in.depth--;
+
+		if (node.args.size() < functions[node.op].min_args || node.args.size() > functions[node.op].max_args) {
+			throw std::runtime_error(word + " has the wrong number of arguments");
+		}
+		return addNode(in.formula, std::move(node));
+	}
+
+	// sheet name
+	if (*end == '!') {
+		in.c = end + 1;
+		return parseArea(in, sheetNumber(std::string(start, end)));
+	}
+
+	if (word == "TRUE" || word == "FALSE") {
+		in.c = end;
+		node.constant = boolean(word == "TRUE");
+		return addNode(in.formula, std::move(node));
+	}
+
+	return parseArea(in, in.formula.sheet);
+}
+
+/**
+ * @brief Find a sheet by name
+ *
+ * Names are compared without case like in Excel.
+ *
+ * @param name Name of the sheet
+ *
+ * @return internal number of the sheet
+ */
+unsigned int Calculator::sheetNumber(const std::string& name) const
+{
+	const value_t wanted{value_t::TEXT, 0, name};
+
+	for (unsigned int i = 0; i < names.size(); ++i) {
+		if (!compare(value_t{value_t::TEXT, 0, names[i]}, wanted)) {
+			return i;
+		}
+	}
+
+	throw std::runtime_error("sheet '" + name + "' does not exist");
+}
+
+/**
+ * @brief Parse a reference or an area after the sheet
+ *
+ * Accepts cells like A1, areas like A1:C3 and whole columns like
+ * A:C. Relative parts of shared formulas are moved to the cell.
+ *
+ * @param in Parser state
+ * @param sheet_nr Sheet of the reference
+ *
+ * @return index of the node
+ */
+unsigned int Calculator::parseArea(parse_t& in, const unsigned int sheet_nr)
+{
+	const char* start = in.c;
+	node_t node{};
+	node.kind = node_t::REF;
+	node.sheet = sheet_nr;
+
+	bool fixed_column1, fixed_row1, fixed_column2, fixed_row2;
+	if (!parseReference(in.c, node.column1, node.row1, fixed_column1, fixed_row1)) {
+		throw std::runtime_error("unknown name '" + std::string(start, in.c) + "'");
+	}
+
+	node.column2 = node.column1;
+	node.row2 = node.row1;
+	fixed_column2 = fixed_column1;
+	fixed_row2 = fixed_row1;
+
+	if (*in.c == ':') {
+		++in.c;
+		if (!parseReference(in.c, node.column2, node.row2, fixed_column2, fixed_row2)) {
+			throw std::runtime_error("invalid area '" + std::string(start, in.c) + "'");
+		}
+		node.kind = node_t::RANGE;
+	}
+
+	// names like SPEED_BONUS start like a reference
+	if (nameChar(*in.c) || (node.row1 == 0) != (node.row2 == 0) || (node.row1 == 0 && node.kind == node_t::REF)) {
+		while (nameChar(*in.c)) ++in.c;
+		throw std::runtime_error("unknown name '" + std::string(start, in.c) + "'");
+	}
+
+	// whole columns
+	const bool columns = (node.row1 == 0);
+	if (columns) {
+		node.row1 = 1;
+		node.row2 = MAX_ROWS;
+		fixed_row1 = fixed_row2 = true;
+	}
+
+	const long long column_offset = static_cast<long long>(in.formula.column) - in.formula.base_column;
+	const long long row_offset = static_cast<long long>(in.formula.row) - in.formula.base_row;
+
+	if ((!fixed_column1 && !shift(node.column1, column_offset, 0, CellRef::MAX_COLUMNS - 1))
+	 || (!fixed_column2 && !shift(node.column2, column_offset, 0, CellRef::MAX_COLUMNS - 1))
+	 || (!fixed_row1 && !shift(node.row1, row_offset, 1, MAX_ROWS))
+	 || (!fixed_row2 && !shift(node.row2, row_offset, 1, MAX_ROWS))) {
+		node_t error{};
+		error.kind = node_t::CONSTANT;
+		error.constant = failure("#REF!");
+		return addNode(in.formula, std::move(error));
+	}
+
+	if (node.column1 > node.column2) std::swap(node.column1, node.column2);
+	if (node.row1 > node.row2) std::swap(node.row1, node.row2);
+
+	return addNode(in.formula, std::move(node));
+}
+
+/**
+ * @brief Compute a node of a formula
+ *
+ * Errors of operands are passed on, the left one first.
+ *
+ * @param formula The formula
+ * @param index Index of the node
+ *
+ * @return the value
+ */
+Calculator::value_t Calculator::evaluate(const formula_t& formula, const unsigned int index)
+{
+	const node_t& node = formula.nodes[index];
+
+	switch (node.kind) {
+	case node_t::CONSTANT:
+		return node.constant;
+	case node_t::MISSING:
+		return value_t{value_t::EMPTY, 0, std::string()};
+	case node_t::REF:
+		return cellValue(node.sheet, node.column1, node.row1);
+	case node_t::RANGE:
+		// areas are only accepted by functions
+		return failure("#VALUE!");
+	case node_t::CALL:
+		return call(formula, node);
+	case node_t::NEGATE:
+	case node_t::PERCENT: {
+		const value_t operand = toNumber(evaluate(formula, node.args[0]));
+		if (operand.type == value_t::ERROR_VALUE) {
+			return operand;
+		}
+		return number(node.kind == node_t::NEGATE ? -operand.number : operand.number / 100);
+	}
+	default:
+		break;
+	}
+
+	const value_t left = evaluate(formula, node.args[0]);
+	if (left.type == value_t::ERROR_VALUE) {
+		return left;
+	}
+	const value_t right = evaluate(formula, node.args[1]);
+	if (right.type == value_t::ERROR_VALUE) {
+		return right;
+	}
+
+	switch (node.op) {
+	case CONCAT:
+		return value_t{value_t::TEXT, 0, toText(left) + toText(right)};
+	case EQUAL:
+		return boolean(compare(left, right) == 0);
+	case NOT_EQUAL:
+		return boolean(compare(left, right) != 0);
+	case LESS:
+		return boolean(compare(left, right) < 0);
+	case LESS_EQUAL:
+		return boolean(compare(left, right) <= 0);
+	case GREATER:
+		return boolean(compare(left, right) > 0);
+	case GREATER_EQUAL:
+		return boolean(compare(left, right) >= 0);
+	default:
+		break;
+	}
+
+	const value_t a = toNumber(left);
+	if (a.type == value_t::ERROR_VALUE) {
+		return a;
+	}
+	const value_t b = toNumber(right);
+	if (b.type == value_t::ERROR_VALUE) {
+		return b;
+	}
+
+	switch (node.op) {
+	case ADD:
+		return number(a.number + b.number);
+	case SUBTRACT:
+		return number(a.number - b.number);
+	case MULTIPLY:
+		return number(a.number * b.number);
+	case DIVIDE:
+		return b.number == 0 ? failure("#DIV/0!") : number(a.number / b.number);
+	default:
+		return (a.number == 0 && b.number <= 0) ? failure(b.number == 0 ? "#NUM!" : "#DIV/0!") : number(std::pow(a.number, b.number));
+	}
+}
+
+/**
+ * @brief Call a function
+ *
+ * Arguments are only computed when used, so the branch of IF
+ * not taken never gives an error.
+ *
+ * @param formula The formula
+ * @param node CALL node
+ *
+ * @return the value
+ */
+Calculator::value_t Calculator::call(const formula_t& formula, const node_t& node)
+{
+	switch (node.op) {
+	case SUM:
+	case MIN:
+	case MAX:
+	case AVERAGE:
+	case AND:
+	case OR:
+		return aggregate(formula, node);
+
+	case ROUND:
+	case ROUNDUP:
+	case ROUNDDOWN: {
+		const value_t value = toNumber(evaluate(formula, node.args[0]));
+		if (value.type == value_t::ERROR_VALUE) {
+			return value;
+		}
+		const value_t digits = toNumber(evaluate(formula, node.args[1]));
+		if (digits.type == value_t::ERROR_VALUE) {
+			return digits;
+		}
+		return number(roundDigits(value.number, digits.number, node.op == ROUND ? 0 : (node.op == ROUNDUP ? 1 : -1)));
+	}
+
+	case INT:
+	case ABS: {
+		const value_t value = toNumber(evaluate(formula, node.args[0]));
+		if (value.type == value_t::ERROR_VALUE) {
+			return value;
+		}
+		return number(node.op == INT ? std::floor(value.number) : std::fabs(value.number));
+	}
+
+	case IF: {
+		const value_t condition = toBoolean(evaluate(formula, node.args[0]));
+		if (condition.type == value_t::ERROR_VALUE) {
+			return condition;
+		}
+		if (condition.number) {
+			return evaluate(formula, node.args[1]);
+		}
+		return node.args.size() > 2 ? evaluate(formula, node.args[2]) : boolean(false);
+	}
+
+	case IFERROR: {
+		const value_t value = evaluate(formula, node.args[0]);
+		return value.type == value_t::ERROR_VALUE ? evaluate(formula, node.args[1]) : value;
+	}
+
+	case NOT: {
+		const value_t value = toBoolean(evaluate(formula, node.args[0]));
+		return value.type == value_t::ERROR_VALUE ? value : boolean(!value.number);
+	}
+
+	case VLOOKUP: {
+		const value_t wanted = evaluate(formula, node.args[0]);
+		if (wanted.type == value_t::ERROR_VALUE) {
+			return wanted;
+		}
+		const node_t& area = formula.nodes[node.args[1]];
+		if (area.kind != node_t::REF && area.kind != node_t::RANGE) {
+			return failure("#VALUE!");
+		}
+		const value_t column = toNumber(evaluate(formula, node.args[2]));
+		if (column.type == value_t::ERROR_VALUE) {
+			return column;
+		}
+		// sorted unless told otherwise
+		value_t approximate = boolean(true);
+		if (node.args.size() > 3) {
+			approximate = toBoolean(evaluate(formula, node.args[3]));
+			if (approximate.type == value_t::ERROR_VALUE) {
+				return approximate;
+			}
+		}
+		if (column.number < 1) {
+			return failure("#VALUE!");
+		}
+
+		unsigned int position;
+		const value_t found = lookup(area, wanted, approximate.number ? 1 : 0, true, position);
+		if (found.type == value_t::ERROR_VALUE) {
+			return found;
+		}
+		return areaValue(area, position, column.number);
+	}
+
+	case INDEX: {
+		const node_t& area = formula.nodes[node.args[0]];
+		if (area.kind != node_t::REF && area.kind != node_t::RANGE) {
+			return failure("#VALUE!");
+		}
+		const value_t row = toNumber(evaluate(formula, node.args[1]));
+		if (row.type == value_t::ERROR_VALUE) {
+			return row;
+		}
+		value_t column = number(1);
+		if (node.args.size() > 2) {
+			column = toNumber(evaluate(formula, node.args[2]));
+			if (column.type == value_t::ERROR_VALUE) {
+				return column;
+			}
+		}
+		// a single index into a row is the column
+		if (node.args.size() == 2 && area.row1 == area.row2) {
+			return areaValue(area, 1, row.number);
+		}
+		return areaValue(area, row.number, column.number);
+	}
+
+	case MATCH: {
+		const value_t wanted = evaluate(formula, node.args[0]);
+		if (wanted.type == value_t::ERROR_VALUE) {
+			return wanted;
+		}
+		const node_t& area = formula.nodes[node.args[1]];
+		if ((area.kind != node_t::REF && area.kind != node_t::RANGE) || (area.column1 != area.column2 && area.row1 != area.row2)) {
+			return failure("#N/A");
+		}
+		value_t type = number(1);
+		if (node.args.size() > 2) {
+			type = toNumber(evaluate(formula, node.args[2]));
+			if (type.type == value_t::ERROR_VALUE) {
+				return type;
+			}
+		}
+
+		unsigned int position;
+		const value_t found = lookup(area, wanted, type.number > 0 ? 1 : (type.number < 0 ? -1 : 0), area.column1 == area.column2, position);
+		return found.type == value_t::ERROR_VALUE ? found : number(position);
+	}
+
+	default:
+		return failure("#NAME?");
+	}
+}
+
+/**
+ * @brief Call a function over every number of its arguments
+ *
+ * Handles SUM, MIN, MAX, AVERAGE, AND and OR. Like in Excel text
+ * and empty cells inside references are skipped, while values given
+ * directly must convert.
+ *
+ * @param formula The formula
+ * @param node CALL node
+ *
+ * @return the value
+ */
+Calculator::value_t Calculator::aggregate(const formula_t& formula, const node_t& node)
+{
+	const bool logical = (node.op == AND || node.op == OR);
+	double sum = 0;
+	double minimum = 0;
+	double maximum = 0;
+	unsigned int count = 0;
+	bool all = true;
+	bool any = false;
+
+	auto add = [&](const double value) {
+		sum += value;
+		minimum = (count == 0 || value < minimum) ? value : minimum;
+		maximum = (count == 0 || value > maximum) ? value : maximum;
+		all = all && value != 0;
+		any = any || value != 0;
+		count++;
+	};
+
+	for (auto const index : node.args) {
+		const node_t& arg = formula.nodes[index];
+
+		if (arg.kind == node_t::REF || arg.kind == node_t::RANGE) {
+			cells_t& cells = sheet(arg.sheet);
+			const auto end = cells.upper_bound(key(arg.column2, arg.row2));
+			for (auto cell = cells.lower_bound(key(arg.column1, arg.row1)); cell != end; ++cell) {
+				const unsigned int column = cell->first & (CellRef::MAX_COLUMNS - 1);
+				if (column < arg.column1 || column > arg.column2) {
+					continue;
+				}
+
+				const value_t& value = current(cell->second);
+				if (value.type == value_t::ERROR_VALUE) {
+					return value;
+				}
+				// booleans in references only count for AND and OR
+				if (value.type == value_t::NUMBER || (logical && value.type == value_t::BOOLEAN)) {
+					add(value.number);
+				}
+			}
+			continue;
+		}
+
+		const value_t value = evaluate(formula, index);
+		if (value.type == value_t::EMPTY && arg.kind == node_t::MISSING) {
+			continue;
+		}
+		const value_t converted = logical ? toBoolean(value) : toNumber(value);
+		if (converted.type == value_t::ERROR_VALUE) {
+			return converted;
+		}
+		add(converted.number);
+	}
+
+	switch (node.op) {
+	case SUM:
+		return number(sum);
+	case MIN:
+		return number(minimum);
+	case MAX:
+		return number(maximum);
+	case AVERAGE:
+		return count ? number(sum / count) : failure("#DIV/0!");
+	case AND:
+		return count ? boolean(all) : failure("#VALUE!");
+	default:
+		return count ? boolean(any) : failure("#VALUE!");
+	}
+}
+
+/**
+ * @brief Get a cell of an area by its position inside it
+ *
+ * @param area REF or RANGE node
+ * @param row One based row inside the area
+ * @param column One based column inside the area
+ *
+ * @return the value, #REF! outside the area
+ */
+Calculator::value_t Calculator::areaValue(const node_t& area, const double row, const double column)
+{
+	if (row < 1 || column < 1) {
+		return failure("#VALUE!");
+	}
+	if (row - 1 > area.row2 - area.row1 || column - 1 > area.column2 - area.column1) {
+		return failure("#REF!");
+	}
+
+	return cellValue(area.sheet, area.column1 + static_cast<unsigned int>(column) - 1, area.row1 + static_cast<unsigned int>(row) - 1);
+}
+
+/**
+ * @brief Find a value in a row or column of an area
+ *
+ * Approximate matches expect sorted values and stop at the first
+ * one past the wanted value, values of another type are skipped.
+ *
+ * @param area REF or RANGE node
+ * @param wanted Value to look for
+ * @param match 0 for an exact match, 1 for the largest value not
+ * above wanted and -1 for the smallest value not below it
+ * @param by_row Whether to look down the first column, otherwise
+ * along the first row
+ * @param position Receives the one based position found
+ *
+ * @return empty if found, #N/A otherwise
+ */
+Calculator::value_t Calculator::lookup(const node_t& area, const value_t& wanted, const int match, const bool by_row, unsigned int& position)
+{
+	if (wanted.type == value_t::EMPTY) {
+		return failure("#N/A");
+	}
+
+	cells_t& cells = sheet(area.sheet);
+	const unsigned int last_column = (by_row ? area.column1 : area.column2);
+	const auto end = cells.upper_bound(key(last_column, by_row ? area.row2 : area.row1));
+	bool found = false;
+
+	for (auto cell = cells.lower_bound(key(area.column1, area.row1)); cell != end; ++cell) {
+		const unsigned int column = cell->first & (CellRef::MAX_COLUMNS - 1);
+		if (column < area.column1 || column > last_column) {
+			continue;
+		}
+
+		const value_t& value = current(cell->second);
+		if (value.type == value_t::EMPTY || value.type == value_t::ERROR_VALUE) {
+			continue;
+		}
+
+		const unsigned int here = (by_row ? static_cast<unsigned int>(cell->first >> COLUMN_BITS) - area.row1 : column - area.column1) + 1;
+		const int order = compare(value, wanted);
+
+		if (match == 0) {
+			if (order == 0) {
+				position = here;
+				return value_t{value_t::EMPTY, 0, std::string()};
+			}
+			continue;
+		}
+
+		if (value.type != wanted.type) {
+			continue;
+		}
+		if (match > 0 ? order > 0 : order < 0) {
+			break;
+		}
+		position = here;
+		found = true;
+	}
+
+	return found ? value_t{value_t::EMPTY, 0, std::string()} : failure("#N/A");
+}
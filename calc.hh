@@ -0,0 +1,184 @@
+#pragma once
+#include <string>      // string
+#include <vector>      // vector
+#include <map>         // map
+#include <memory>      // unique_ptr
+#include <functional>  // function
+#include <ostream>     // ostream
+
+/**
+ * Evaluator of spreadsheet formulas
+ *
+ * Knows the subset used in balancing sheets: arithmetic and
+ * comparisons, references and ranges across sheets and the
+ * functions SUM, MIN, MAX, AVERAGE, ROUND, IF, VLOOKUP, INDEX,
+ * MATCH and a few more. Cached values are trusted unless missing,
+ * the workbook asks for a full recalculation or a formula they
+ * depend on was recomputed to something else, so only stale
+ * formulas are ever computed.
+ *
+ * Sheets are only read, through the loader, once a formula
+ * refers to them.
+ */
+class Calculator
+{
+public:
+	/** value of a cell or result of a formula */
+	struct value_t {
+		enum type_t {
+			EMPTY,
+			NUMBER,
+			TEXT,
+			BOOLEAN,
+			/** text holds the error, like #DIV/0! */
+			ERROR_VALUE
+		} type;
+		double number;
+		std::string text;
+	};
+
+private:
+	/** part of a parsed formula */
+	struct node_t {
+		enum kind_t {
+			/** value is in constant */
+			CONSTANT,
+			/** argument left empty, like the second one of IF(A1,,1) */
+			MISSING,
+			/** single cell */
+			REF,
+			/** area of cells */
+			RANGE,
+			/** unary minus and percent of args[0] */
+			NEGATE,
+			PERCENT,
+			/** op applied to args[0] and args[1] */
+			BINARY,
+			/** function op called with args */
+			CALL
+		} kind;
+		unsigned int op;
+		value_t constant;
+		/** area of REF and RANGE, columns are zero based */
+		unsigned int sheet;
+		unsigned int column1;
+		unsigned int row1;
+		unsigned int column2;
+		unsigned int row2;
+		/** indexes of the operands in the nodes of the formula */
+		std::vector<unsigned int> args;
+	};
+	/** progress of a formula while looking for stale values */
+	enum state_t {
+		NEW,
+		VISITING,
+		DONE
+	};
+	struct cell_t;
+	/** formula of a cell */
+	struct formula_t {
+		/** text without the = */
+		std::string text;
+		/** position of the cell */
+		unsigned int sheet;
+		unsigned int column;
+		unsigned int row;
+		/** cell the text was written for, shared formulas are moved from there */
+		unsigned int base_column;
+		unsigned int base_row;
+		/** whether the cell had a cached value */
+		bool cached;
+		/** parsed text, the root is the last node */
+		std::vector<node_t> nodes;
+		/** why the text could not be parsed, empty if it was */
+		std::string error;
+		/** formulas found in the references */
+		std::vector<cell_t*> precedents;
+		state_t state;
+		/** whether value was computed and is not the cached one */
+		bool changed;
+		value_t value;
+	};
+	/** a cell with a value */
+	struct cell_t {
+		/** value read from the workbook */
+		value_t cached;
+		/** set if the cell has a formula */
+		std::unique_ptr<formula_t> formula;
+	};
+	/** cells of a sheet by row then column, see key() */
+	typedef std::map<unsigned long long, cell_t> cells_t;
+	/** state of the parser */
+	struct parse_t {
+		formula_t& formula;
+		const char* c;
+		/** depth of parentheses and calls */
+		unsigned int depth;
+	};
+
+	/** name of each sheet */
+	std::vector<std::string> names;
+	/** cells of each sheet */
+	std::vector<cells_t> sheets;
+	/** whether each sheet was already given to the loader */
+	std::vector<bool> loaded;
+	/** reads a sheet calling setCell and setFormula */
+	std::function<void(unsigned int)> load;
+	/** whether every formula must be recomputed */
+	bool recalc_all;
+	/** stream where warnings are written to */
+	std::ostream& log;
+
+	// Key of a cell in cells_t
+	static unsigned long long key(const unsigned int column, const unsigned int row);
+	// Get the cells of a sheet, reading it if needed
+	cells_t& sheet(const unsigned int sheet_nr);
+	// Get the current value of a cell
+	const value_t& cellValue(const unsigned int sheet_nr, const unsigned int column, const unsigned int row);
+	// Get the current value of a cell
+	static const value_t& current(const cell_t& cell);
+	// Write a warning about a formula
+	void warn(const formula_t& formula, const std::string& code, const std::string& message) const;
+
+	// Parse the text of a formula
+	void parse(formula_t& formula);
+	// Parse an expression with operators of at least some precedence
+	unsigned int parseBinary(parse_t& in, const unsigned int level);
+	// Parse unary operators and percent
+	unsigned int parseUnary(parse_t& in);
+	// Parse a value, reference, call or parenthesis
+	unsigned int parsePrimary(parse_t& in);
+	// Find a sheet by name
+	unsigned int sheetNumber(const std::string& name) const;
+	// Parse a reference or an area after the sheet
+	unsigned int parseArea(parse_t& in, const unsigned int sheet_nr);
+	// Add a node to the formula
+	static unsigned int addNode(formula_t& formula, node_t&& node);
+	// Find the formulas a formula depends on
+	void findPrecedents(formula_t& formula);
+	// Make sure a formula and everything it depends on is up to date
+	void update(cell_t& cell);
+
+	// Compute a node of a formula
+	value_t evaluate(const formula_t& formula, const unsigned int index);
+	// Call a function
+	value_t call(const formula_t& formula, const node_t& node);
+	// Call a function over every number of its arguments
+	value_t aggregate(const formula_t& formula, const node_t& node);
+	// Get a cell of an area by its position inside it
+	value_t areaValue(const node_t& area, const double row, const double column);
+	// Find a value in a row or column of an area
+	value_t lookup(const node_t& area, const value_t& wanted, const int match, const bool by_row, unsigned int& position);
+
+public:
+	// Start with no cells
+	Calculator(const std::vector<std::string>& sheet_names, const bool recalculate, std::ostream& warnings, std::function<void(unsigned int)> loader);
+	// Set the cached value of a cell
+	void setCell(const unsigned int sheet_nr, const unsigned int column, const unsigned int row, const value_t& value);
+	// Set the formula of a cell
+	void setFormula(const unsigned int sheet_nr, const unsigned int column, const unsigned int row, const std::string& text, const unsigned int base_column, const unsigned int base_row, const bool cached);
+	// Recompute a formula if its cached value is stale
+	bool evaluate(const unsigned int sheet_nr, const unsigned int column, const unsigned int row, std::string& text);
+	// Convert a value to the text written in dats
+	static std::string text(const value_t& value);
+};
@@ -0,0 +1,366 @@
+#include <sstream>   // ostringstream
+#include <string>    // string
+#include <cstring>   // memchr, memcmp
+#include <cctype>    // tolower
+#include <cerrno>    // errno
+#include <algorithm> // sort
+#include <vector>    // vector
+#include <stdexcept> // runtime_error
+#include <utility>   // pair
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h> // SSE2
+#define CSV_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>    // _BitScanForward
+#endif
+
+#include "csv.hh"
+#include "mapped.hh"   // MappedFile
+
+/**
+ * @brief Index of the lowest set bit
+ *
+ * @param mask Value with at least one bit set
+ *
+ * @return index of the bit, 0 for the least significant
+ */
+static inline unsigned int lowestBit(const unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+/**
+ * @brief Find the end of an unquoted field
+ *
+ * Compares 16 bytes at once where SSE2 is available, which is
+ * where nearly all the time of parsing goes.
+ *
+ * @param pos Start of the search
+ * @param end End of the file
+ * @param separator Field separator
+ *
+ * @return position of the first separator or line break, end if
+ * there is none
+ */
+static const char* fieldEnd(const char* pos, const char* end, const char separator)
+{
+#ifdef CSV_SSE2
+	const __m128i sep = _mm_set1_epi8(separator);
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+
+	while (end - pos >= 16) {
+		const __m128i chunk = _mm_loadu_si128((const __m128i*)pos);
+		const __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, sep), _mm_or_si128(_mm_cmpeq_epi8(chunk, lf), _mm_cmpeq_epi8(chunk, cr)));
+		const unsigned int mask = (unsigned int)_mm_movemask_epi8(hits);
+
+		if (mask) {
+			return pos + lowestBit(mask);
+		}
+		pos += 16;
+	}
+#endif
+
+	while (pos < end && *pos != separator && *pos != '\n' && *pos != '\r') {
+		++pos;
+	}
+
+	return pos;
+}
+
+/**
+ * @brief Open a directory of CSV/TSV files
+ *
+ * Every `.csv` and `.tsv` file is a sheet, they are sorted by
+ * name so dats are always written in the same order. Files are
+ * only read when parsing.
+ *
+ * @param dirname Directory with the files
+ */
+CSV::CSV(const std::string& dirname) : Workbook(dirname), root(dirname), total_size(0)
+{
+	if (!root.empty() && root.back() != '/' && root.back() != '\\') {
+		root += "/";
+	}
+
+	std::vector<std::pair<std::string, unsigned long long>> files;
+
+#ifdef _WIN32
+	HANDLE find;
+	WIN32_FIND_DATAA ent;
+	const std::string find_term = root + "*";
+
+	if ((find = FindFirstFileA(find_term.c_str(), &ent)) != INVALID_HANDLE_VALUE) {
+		do {
+			if (!(ent.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+				files.push_back(std::make_pair(std::string(ent.cFileName), ((unsigned long long)ent.nFileSizeHigh << 32) | ent.nFileSizeLow));
+			}
+		} while (FindNextFileA(find, &ent));
+
+		FindClose(find);
+	}
+	else {
+#else
+	DIR *dir_handle;
+	struct dirent *ent;
+
+	if ((dir_handle = opendir(root.c_str())) != NULL) {
+		while ((ent = readdir(dir_handle)) != NULL) {
+			struct stat info;
+
+			if (stat((root + ent->d_name).c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFREG) {
+				files.push_back(std::make_pair(std::string(ent->d_name), (unsigned long long)info.st_size));
+			}
+		}
+		closedir(dir_handle);
+	}
+	else {
+#endif
+		std::ostringstream err_msg;
+		err_msg << "CSV" << errno << ":Could not open directory: " << dirname;
+		// send to main
+		throw std::runtime_error(err_msg.str());
+	}
+
+	std::sort(files.begin(), files.end());
+
+	for (auto const& file : files) {
+		const std::string::size_type dot = file.first.rfind('.');
+		if (dot == std::string::npos || dot == 0 || file.first.size() - dot != 4) {
+			continue;
+		}
+
+		std::string extension = file.first.substr(dot + 1);
+		for (char& c : extension) {
+			c = std::tolower((unsigned char)c);
+		}
+
+		if (extension == "csv" || extension == "tsv") {
+			addSheet(file.first.substr(0, dot), root + file.first);
+			tab_separated.push_back(extension == "tsv");
+			total_size += file.second;
+		}
+	}
+}
+
+/**
+ * @brief Approximate memory needed to parse the files
+ *
+ * Files are mapped, not copied, so this is the address space
+ * needed if every file stays in the page cache.
+ *
+ * @return approximate amount of bytes
+ */
+const unsigned long long CSV::memoryEstimate() const
+{
+	return total_size;
+}
+
+/**
+ * @brief Parse every file
+ *
+ * Files of sheets not selected are never opened.
+ */
+void CSV::readSheets()
+{
+	for (unsigned int i = 0; i < sheets_v.size(); ++i) {
+		if (!sheetSelected(i)) {
+			continue;
+		}
+
+		const MappedFile file(sheets_v[i].path);
+		if (!file.isOpen()) {
+			std::ostringstream err_msg;
+			err_msg << "CSV" << errno << ":Could not read file: " << sheets_v[i].path;
+			// send to main
+			throw std::runtime_error(err_msg.str());
+		}
+
+		const char* data = file.data();
+		const char* end = data + file.size();
+		parseSheet(i, data, end, separator(data, end, tab_separated[i]));
+	}
+}
+
+/**
+ * @brief Find the field separator of a file
+ *
+ * TSV files always use tabs. CSV files are saved with `,` or, in
+ * locales using comma as decimal separator, with `;`. Whichever
+ * appears most in the header row is taken.
+ *
+ * @param data Start of the file
+ * @param end End of the file
+ * @param tsv Whether the file is a TSV file
+ *
+ * @return the separator
+ */
+char CSV::separator(const char* data, const char* end, const bool tsv)
+{
+	if (tsv) {
+		return '\t';
+	}
+
+	unsigned int commas = 0;
+	unsigned int semicolons = 0;
+	unsigned int tabs = 0;
+
+	for (; data < end && *data != '\n' && *data != '\r'; ++data) {
+		commas += *data == ',';
+		semicolons += *data == ';';
+		tabs += *data == '\t';
+	}
+
+	if (semicolons > commas && semicolons >= tabs) {
+		return ';';
+	}
+	if (tabs > commas) {
+		return '\t';
+	}
+	return ',';
+}
+
+/**
+ * @brief Read one field
+ *
+ * Unquoted fields and quoted fields without escaped quotes are
+ * returned as a view into the file. Fields with `""` are copied
+ * to a buffer that is only valid until the next field is read.
+ * Quotes are only special at the start of a field, an unclosed
+ * quote takes the rest of the file.
+ *
+ * @param pos Start of the field
+ * @param end End of the file
+ * @param separator Field separator
+ * @param value Receives the content of the field
+ *
+ * @return position after the field, at a separator, a line break
+ * or the end of the file
+ */
+const char* CSV::readField(const char* pos, const char* end, const char separator, std::string_view& value)
+{
+	if (pos == end || *pos != '"') {
+		const char* start = pos;
+		pos = fieldEnd(pos, end, separator);
+		value = std::string_view(start, pos - start);
+		return pos;
+	}
+
+	const char* start = ++pos;
+	const char* quote;
+	bool copied = false;
+
+	while ((quote = (const char*)std::memchr(pos, '"', end - pos)) != nullptr && quote + 1 < end && quote[1] == '"') {
+		// escaped quote, keep one of them
+		if (!copied) {
+			field_buffer.clear();
+			copied = true;
+		}
+		field_buffer.append(pos, quote + 1);
+		pos = quote + 2;
+	}
+
+	const char* close = (quote != nullptr ? quote : end);
+	if (copied) {
+		field_buffer.append(pos, close);
+	}
+	pos = (quote != nullptr ? quote + 1 : end);
+
+	// text after the closing quote is kept like spreadsheets do
+	if (pos < end && *pos != separator && *pos != '\n' && *pos != '\r') {
+		if (!copied) {
+			field_buffer.assign(start, close);
+			copied = true;
+		}
+		const char* rest = pos;
+		pos = fieldEnd(pos, end, separator);
+		field_buffer.append(rest, pos);
+	}
+
+	value = (copied ? std::string_view(field_buffer) : std::string_view(start, close - start));
+	return pos;
+}
+
+/**
+ * @brief Create the dats of one sheet
+ *
+ * The first record holds the parameter names, every other record
+ * with a value in the first column is an object. Empty fields are
+ * treated like missing cells and don't produce a line.
+ *
+ * @param sheet_nr Internal number of the sheet
+ * @param pos Start of the file
+ * @param end End of the file
+ * @param separator Field separator
+ */
+void CSV::parseSheet(const unsigned int sheet_nr, const char* pos, const char* end, const char separator)
+{
+	Schema schema;
+	std::string last_filename;
+	unsigned int row = 0;
+
+	// byte order mark written by some editors
+	if (end - pos >= 3 && !std::memcmp(pos, "\xEF\xBB\xBF", 3)) {
+		pos += 3;
+	}
+
+	while (pos < end) {
+		unsigned int column = 0;
+		bool object = false;
+
+		row++;
+		startDat();
+
+		for (;;) {
+			std::string_view value;
+			pos = readField(pos, end, separator, value);
+
+			if (row == 1) {
+				headerCell(schema, column, value);
+			}
+			else {
+				// rows without column A are not objects
+				if (column == 0) {
+					object = !value.empty();
+				}
+				if (object && !value.empty()) {
+					addValue(schema, column, value);
+				}
+			}
+
+			column++;
+			if (pos == end || *pos != separator) {
+				break;
+			}
+			pos++;
+		}
+
+		// records end with \n, \r\n or \r
+		if (pos < end && *pos == '\r') {
+			pos++;
+		}
+		if (pos < end && *pos == '\n') {
+			pos++;
+		}
+
+		if (object) {
+			finishDat(sheet_nr, row, last_filename);
+		}
+	}
+}
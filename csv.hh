@@ -0,0 +1,42 @@
+#pragma once
+#include <string>      // string
+#include <string_view> // string_view
+#include <vector>      // vector
+#include "schema.hh"   // Schema
+#include "workbook.hh" // Workbook
+
+/**
+ * Parser for a directory of CSV/TSV files
+ *
+ * Each file is a sheet named after the file without extension,
+ * so `;` in the file name works as directory separator just like
+ * in sheet names. Files are memory mapped and fields are handed
+ * to the dat pipeline as views into the mapping, only quoted
+ * fields with escaped quotes are copied.
+ */
+class CSV : public Workbook
+{
+	/** directory holding the files */
+	std::string root;
+	/** whether each sheet is a TSV file */
+	std::vector<bool> tab_separated;
+	/** size of all files, in bytes */
+	unsigned long long total_size;
+	/** unescaped content of the current quoted field */
+	std::string field_buffer;
+
+	// Find the field separator of a file
+	static char separator(const char* data, const char* end, const bool tsv);
+	// Read one field
+	const char* readField(const char* pos, const char* end, const char separator, std::string_view& value);
+	// Create the dats of one sheet
+	void parseSheet(const unsigned int sheet_nr, const char* data, const char* end, const char separator);
+	// Parse every file
+	void readSheets() override;
+
+public:
+	// Open a directory of CSV/TSV files
+	CSV(const std::string& dirname);
+	// Approximate memory needed to parse the files
+	const unsigned long long memoryEstimate() const override;
+};
@@ -0,0 +1,219 @@
+#include <string>   // string, to_string
+#include <vector>   // vector
+#include <iostream> // clog, endl
+#ifdef _WIN32
+#include <windows.h> // LoadLibraryA, GetProcAddress, FreeLibrary
+#else
+#include <dlfcn.h>   // dlopen, dlsym, dlclose
+#endif
+
+#include "icu.hh"
+
+/** newest ICU version looked for */
+static const unsigned int NEWEST_MAJOR = 99;
+/** oldest ICU version looked for, the first with a single number */
+static const unsigned int OLDEST_MAJOR = 48;
+
+#ifdef _WIN32
+typedef HMODULE library_t;
+#else
+typedef void* library_t;
+#endif
+
+/**
+ * @brief Name of an ICU library of a version
+ *
+ * @param name Name of the library without version, like "icuuc"
+ * @param major Major version, 0 for the unversioned library
+ *
+ * @return the file name of the library
+ */
+static std::string libraryName(const std::string& name, const unsigned int major)
+{
+#if defined(_WIN32)
+	// Windows ships a single unversioned library
+	return major == 0 ? std::string("icu.dll") : name + std::to_string(major) + ".dll";
+#elif defined(__APPLE__)
+	return "lib" + name + (major == 0 ? std::string() : "." + std::to_string(major)) + ".dylib";
+#else
+	return "lib" + name + ".so" + (major == 0 ? std::string() : "." + std::to_string(major));
+#endif
+}
+
+/**
+ * @brief Load an ICU library of a version
+ *
+ * @param name Name of the library without version, like "icuuc"
+ * @param major Major version, 0 for the unversioned library
+ *
+ * @return the library, null if it was not found
+ */
+static library_t openLibrary(const std::string& name, const unsigned int major)
+{
+#ifdef _WIN32
+#ifdef _DEBUG
+	if (major != 0) {
+		const library_t debug = LoadLibraryA((name + std::to_string(major) + "d.dll").c_str());
+		if (debug != nullptr) {
+			return debug;
+		}
+	}
+#endif
+	return LoadLibraryA(libraryName(name, major).c_str());
+#else
+	return dlopen(libraryName(name, major).c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+/**
+ * @brief Unload a library that is not used
+ *
+ * @param library The library
+ */
+static void closeLibrary(const library_t library)
+{
+#ifdef _WIN32
+	FreeLibrary(library);
+#else
+	dlclose(library);
+#endif
+}
+
+/**
+ * @brief Find a function in a library
+ *
+ * @param library Library to look in
+ * @param name Full name of the function
+ *
+ * @return the function, null if it was not found
+ */
+static void* findSymbol(const library_t library, const std::string& name)
+{
+#ifdef _WIN32
+	return reinterpret_cast<void*>(GetProcAddress(library, name.c_str()));
+#else
+	return dlsym(library, name.c_str());
+#endif
+}
+
+/**
+ * @brief Find a function in the libraries
+ *
+ * Functions are named after the ICU version unless ICU was built
+ * without renaming, both names are tried.
+ *
+ * @param libraries Libraries to look in
+ * @param suffix Version suffix of the names, like "_72"
+ * @param name Name of the function without version
+ * @param function Receives the function
+ *
+ * @return whether it was found
+ */
+template<typename T>
+static bool findFunction(const library_t (&libraries)[2], const std::string& suffix, const char* name, T& function)
+{
+	const std::string names[2] = {name + suffix, name};
+
+	for (auto const library : libraries) {
+		for (auto const& symbol : names) {
+			function = reinterpret_cast<T>(findSymbol(library, symbol));
+			if (function != nullptr) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Load the libraries and find the functions
+ *
+ * The version the headers are from is tried first, then every
+ * other version from the newest, and the version of a library
+ * names its functions. Unversioned libraries, like the one of
+ * Windows, are tried last. Libraries are never unloaded, the
+ * functions stay valid until the program ends.
+ */
+ICU::ICU() : loaded(false)
+{
+#ifdef _WIN32
+	static const char* const I18N = "icuin";
+#else
+	static const char* const I18N = "icui18n";
+#endif
+	static const char* const COMMON = "icuuc";
+
+	// the detector is in i18n, converters in the common library
+	library_t libraries[2] = {nullptr, nullptr};
+	unsigned int found = 0;
+	// the first library that was not found, for the warning
+	std::string missing;
+
+	std::vector<unsigned int> majors(1, U_ICU_VERSION_MAJOR_NUM);
+	for (unsigned int major = NEWEST_MAJOR; major >= OLDEST_MAJOR; --major) {
+		if (major != U_ICU_VERSION_MAJOR_NUM) {
+			majors.push_back(major);
+		}
+	}
+	majors.push_back(0);
+
+	for (auto const major : majors) {
+		libraries[1] = openLibrary(COMMON, major);
+		if (libraries[1] == nullptr) {
+			if (missing.empty()) {
+				missing = libraryName(COMMON, major);
+			}
+			continue;
+		}
+		libraries[0] = openLibrary(I18N, major);
+		if (libraries[0] != nullptr) {
+			found = major;
+			break;
+		}
+		if (missing.empty()) {
+			missing = libraryName(I18N, major);
+		}
+		closeLibrary(libraries[1]);
+		libraries[1] = nullptr;
+	}
+
+	if (libraries[0] == nullptr) {
+		std::clog << missing << " : Encoding warning UE1:ICU could not be loaded, dats that are not in UTF-8 are skipped. Installing ICU will most likely fix this." << std::endl;
+		return;
+	}
+
+	// an unversioned library still names its functions after its version
+	unsigned int version = found;
+	for (auto major = majors.cbegin(); version == 0 && *major != 0; ++major) {
+		if (findSymbol(libraries[1], "ucnv_open_" + std::to_string(*major)) != nullptr) {
+			version = *major;
+		}
+	}
+	const std::string suffix = "_" + std::to_string(version);
+
+	loaded = findFunction(libraries, suffix, "ucsdet_open", detectorOpen)
+		&& findFunction(libraries, suffix, "ucsdet_setText", detectorSetText)
+		&& findFunction(libraries, suffix, "ucsdet_detect", detectorDetect)
+		&& findFunction(libraries, suffix, "ucsdet_getName", matchName)
+		&& findFunction(libraries, suffix, "ucsdet_close", detectorClose)
+		&& findFunction(libraries, suffix, "ucnv_open", converterOpen)
+		&& findFunction(libraries, suffix, "ucnv_toAlgorithmic", converterToAlgorithmic)
+		&& findFunction(libraries, suffix, "ucnv_close", converterClose);
+
+	if (!loaded) {
+		std::clog << libraryName(COMMON, found) << " : Encoding warning UE1:The ICU found misses functions, dats that are not in UTF-8 are skipped. Installing another ICU will most likely fix this." << std::endl;
+	}
+}
+
+/**
+ * @brief Get the functions, loading ICU the first time
+ *
+ * @return the functions, null if ICU could not be loaded
+ */
+const ICU* ICU::get()
+{
+	static const ICU icu;
+
+	return icu.loaded ? &icu : nullptr;
+}
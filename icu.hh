@@ -0,0 +1,37 @@
+#pragma once
+#include <unicode/ucsdet.h> // UCharsetDetector, UCharsetMatch
+#include <unicode/ucnv.h>   // UConverter, UConverterType
+
+/**
+ * The ICU functions converting dats to UTF-8
+ *
+ * ICU is not linked, its libraries are only loaded the first time
+ * a dat in another encoding is found. Exports and imports of UTF-8
+ * dats never load it, nor its large data library. The version the
+ * headers are from is tried first, then the other installed ones
+ * and unversioned libraries like the one shipped with Windows. The
+ * version of the libraries found gives the names of the functions.
+ */
+class ICU
+{
+	/** whether every function was found */
+	bool loaded;
+
+	// Load the libraries and find the functions
+	ICU();
+
+public:
+	UCharsetDetector* (*detectorOpen)(UErrorCode* status);
+	void (*detectorSetText)(UCharsetDetector* detector, const char* text, int32_t length, UErrorCode* status);
+	const UCharsetMatch* (*detectorDetect)(UCharsetDetector* detector, UErrorCode* status);
+	const char* (*matchName)(const UCharsetMatch* match, UErrorCode* status);
+	void (*detectorClose)(UCharsetDetector* detector);
+	UConverter* (*converterOpen)(const char* name, UErrorCode* status);
+	int32_t (*converterToAlgorithmic)(UConverterType type, UConverter* converter, char* target, int32_t capacity, const char* source, int32_t length, UErrorCode* status);
+	void (*converterClose)(UConverter* converter);
+
+	ICU(const ICU&) = delete;
+	ICU& operator=(const ICU&) = delete;
+	// Get the functions, loading ICU the first time
+	static const ICU* get();
+};
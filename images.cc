@@ -0,0 +1,107 @@
+#include <fstream>    // ifstream
+#include <cstring>    // memcmp
+#include <vector>     // vector
+#include <algorithm>  // replace
+#include "images.hh"
+
+/**
+ * @brief Get what is known of a file, reading it the first time
+ *
+ * @param path Normalized path of the file
+ *
+ * @return status and size of the image, valid while the cache is
+ */
+const ImageCache::image_t& ImageCache::get(const std::string& path)
+{
+	entry_t* entry = files.update(path, [](std::unique_ptr<entry_t>& found) {
+		if (!found) {
+			found.reset(new entry_t());
+		}
+		return found.get();
+	});
+
+	// the file is read without holding the shard
+	std::call_once(entry->once, [entry, &path] {
+		entry->image = readHeader(path);
+	});
+
+	return entry->image;
+}
+
+/**
+ * @brief Read the size of a PNG
+ *
+ * Only the signature and the IHDR chunk, which must be the first
+ * one, are read.
+ *
+ * @param path Path of the file
+ *
+ * @return status and size of the image
+ */
+ImageCache::image_t ImageCache::readHeader(const std::string& path)
+{
+	static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	std::ifstream file(path, std::ios::binary);
+	unsigned char header[24];
+
+	if (!file.is_open()) {
+		return image_t{image_t::MISSING, 0, 0};
+	}
+
+	if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || std::memcmp(header, signature, 8) || std::memcmp(header + 12, "IHDR", 4)) {
+		return image_t{image_t::NOT_PNG, 0, 0};
+	}
+
+	// big endian
+	const unsigned int width = ((unsigned int)header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+	const unsigned int height = ((unsigned int)header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+
+	return image_t{image_t::FOUND, width, height};
+}
+
+/**
+ * @brief Remove . and .. parts from a path
+ *
+ * Different references to the same file give the same path so it
+ * is only read once. `..` at the start is kept.
+ *
+ * @param path Relative path, with / or \ as separator
+ *
+ * @return path with / as separator
+ */
+std::string ImageCache::normalize(const std::string& path)
+{
+	std::vector<std::string> parts;
+	std::string::size_type start = 0;
+	std::string clean = path;
+	std::replace(clean.begin(), clean.end(), '\\', '/');
+
+	while (start <= clean.size()) {
+		std::string::size_type end = clean.find('/', start);
+		if (end == std::string::npos) {
+			end = clean.size();
+		}
+
+		const std::string part = clean.substr(start, end - start);
+		if (part == "..") {
+			if (!parts.empty() && parts.back() != "..") {
+				parts.pop_back();
+			}
+			else {
+				parts.push_back(part);
+			}
+		}
+		else if (!part.empty() && part != ".") {
+			parts.push_back(part);
+		}
+
+		start = end + 1;
+	}
+
+	std::string result;
+	for (auto const& part : parts) {
+		result += (result.empty() ? "" : "/") + part;
+	}
+
+	return result;
+}
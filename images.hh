@@ -0,0 +1,45 @@
+#pragma once
+#include <string>        // string
+#include <memory>        // unique_ptr
+#include <mutex>         // once_flag
+#include "threadpool.hh" // ShardedMap
+
+/**
+ * Size of the PNG images referenced by exported objects
+ *
+ * Each distinct file is opened once, by whichever thread asks for
+ * it first, and only its header is read. Threads asking for the
+ * same file wait for that read instead of doing it again.
+ */
+class ImageCache
+{
+public:
+	/** what is known of a file */
+	struct image_t {
+		enum status_t {
+			FOUND,
+			MISSING,
+			NOT_PNG
+		} status;
+		unsigned int width;
+		unsigned int height;
+	};
+
+private:
+	/** a file, read once */
+	struct entry_t {
+		std::once_flag once;
+		image_t image;
+	};
+	/** every file asked for */
+	ShardedMap<std::unique_ptr<entry_t>> files;
+
+	// Read the size of a PNG
+	static image_t readHeader(const std::string& path);
+
+public:
+	// Get what is known of a file, reading it the first time
+	const image_t& get(const std::string& path);
+	// Remove . and .. parts from a path
+	static std::string normalize(const std::string& path);
+};
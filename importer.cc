@@ -1,21 +1,17 @@
 #include <iostream>  // cout, cerr, clog
 #include <sstream>   // ostringstream
-#include <fstream>   // ifstream
 #include <string>    // to_string
 #include <cstring>   // strncmp, strlen, strrchr
+#include <cstdio>    // snprintf
 #include <ctime>     // time, gmtime, strftime
-#include <algorithm> // lower_bound, replace, transform
-#include <unicode/ucsdet.h>
-#include <unicode/ucnv.h>
-
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <sys/types.h>
-#include <dirent.h>
-#endif
+#include <algorithm> // lower_bound, replace, transform, sort
+#include <cstdlib>   // getenv, strtoll
+#include <charconv>  // from_chars, to_chars
+#include <zip.h>     // libzip
 
 #include "importer.hh"
+#include "keys.hh"   // DatKeys
+#include "icu.hh"    // ICU
 
 /**
  * @brief Open an xlsx file
@@ -23,14 +19,30 @@
  * An xlsx file is a normal zip file with multiple xmls inside.
  * This will open the zip for reding the files inside.
  *
+ * When updating, an xlsx previously made by the importer is kept
+ * and only sheets of directories that changed are made again. If
+ * the file has no manifest, like after being saved by another
+ * application, everything is replaced.
+ *
  * @param filename Name of the spreadsheet file
+ * @param update Whether to update an existing file
  */
-Importer::Importer(const std::string& filename)
+Importer::Importer(const std::string& filename, const bool update) : filename(filename), reproducible(false), compact(false), next_file(1), reused(0), detector(nullptr)
 {
 	try {
 		this->sheet = new libzippp::ZipArchive(filename);
-		// open as writeable and replace everything
-		this->sheet->open(libzippp::ZipArchive::Write);
+
+		bool updating = false;
+		if (update && this->sheet->open(libzippp::ZipArchive::ReadOnly)) {
+			updating = this->sheet->hasEntry("datSheet/manifest.xml");
+			if (updating) {
+				loadPrevious();
+			}
+			this->sheet->close();
+		}
+
+		// open as writeable and replace everything, unless updating
+		this->sheet->open(updating ? libzippp::ZipArchive::Write : libzippp::ZipArchive::New);
 		this->sheet->addEntry("_rels");
 		this->sheet->addEntry("docProps");
 		this->sheet->addEntry("xl");
@@ -55,6 +67,307 @@ Importer::~Importer()
 {
 	sheet->close();
 	delete sheet;
+
+	if (detector != nullptr) {
+		ICU::get()->detectorClose(detector);
+	}
+}
+
+/**
+ * @brief Load what's needed to update an existing xlsx
+ *
+ * Reads the manifest with the signature of each sheet and the
+ * shared strings. Strings keep their index so sheets that are not
+ * made again still point to the right strings.
+ */
+void Importer::loadPrevious()
+{
+	pugi::xml_document doc;
+
+	std::string xml_data = sheet->getEntry("datSheet/manifest.xml").readAsText();
+	if (doc.load_string(xml_data.c_str())) {
+		for (const pugi::xml_node node : doc.child("manifest").children("sheet")) {
+			worksheet_t worksheet;
+			worksheet.name = node.attribute("name").value();
+			worksheet.file = node.attribute("file").as_uint();
+			worksheet.signature = node.attribute("signature").value();
+
+			if (worksheet.file > 0) {
+				previous[worksheet.name] = worksheet;
+				if (worksheet.file >= next_file) {
+					next_file = worksheet.file + 1;
+				}
+			}
+		}
+	}
+
+	xml_data = sheet->getEntry("xl/sharedStrings.xml").readAsText();
+	if (doc.load_string(xml_data.c_str())) {
+		for (const pugi::xml_node node : doc.child("sst").children("si")) {
+			shared_index.emplace(node.child_value("t"), shared_strings.size());
+			shared_strings.push_back(node.child_value("t"));
+		}
+	}
+}
+
+/**
+ * @brief Signature of the dats of a directory
+ *
+ * Hashes name, size and modification time of each dat, so a
+ * directory is considered changed when a dat is added, removed
+ * or modified, without reading any dat.
+ *
+ * @param dats Sorted dat files
+ *
+ * @return hexadecimal FNV-1a hash
+ */
+std::string Importer::dirSignature(const std::vector<DatSource::entry_t>& dats)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for (auto const& dat : dats) {
+		const std::string entry = dat.name + '\0' + std::to_string(dat.size) + '\0' + std::to_string(dat.mtime) + '\0';
+
+		for (const char c : entry) {
+			hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+		}
+	}
+
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", hash);
+	return hex;
+}
+
+/**
+ * @brief Make the output reproducible
+ *
+ * The same pakset always produces a byte identical xlsx. Creation
+ * time in the document properties and the time of every zip entry
+ * are taken from SOURCE_DATE_EPOCH, or 1980-01-01 if not set.
+ *
+ * @param enable Whether the output must be reproducible
+ */
+void Importer::setReproducible(const bool enable)
+{
+	reproducible = enable;
+}
+
+/**
+ * @brief Leave out attributes implied by the position
+ *
+ * Rows and cells only get a reference when they don't follow the
+ * previous one, which makes sheets with many small values smaller.
+ *
+ * @param enable Whether to leave them out
+ */
+void Importer::setCompact(const bool enable)
+{
+	compact = enable;
+}
+
+/**
+ * @brief Only import some directories
+ *
+ * Used to import a shard of the pakset, the directories are
+ * imported without their subdirectories.
+ *
+ * @param dirs Directories relative to the root, "" is the root
+ */
+void Importer::setDirs(const std::vector<std::string>& dirs)
+{
+	only_dirs = dirs;
+}
+
+/**
+ * @brief Split a pakset in shards
+ *
+ * Directories keep the order they are imported in, a shard is
+ * either a directory at the top of the pakset with everything
+ * inside it, or directories up to a total size of their dats.
+ * Dats at the root are always a shard of their own when shards
+ * are made by directory.
+ *
+ * @param root_dir Root directory or archive of the pakset
+ * @param max_size Most bytes of dats in a shard, 0 makes a shard
+ * of each directory at the top of the pakset
+ *
+ * @return directories with dats of each shard
+ */
+std::vector<std::vector<std::string>> Importer::shard(const std::string& root_dir, const unsigned long long max_size)
+{
+	std::unique_ptr<DatSource> source = DatSource::open(root_dir);
+	std::vector<std::vector<std::string>> shards;
+	std::string shard_top;
+	unsigned long long shard_size = 0;
+
+	// same order as readDir, without recursion
+	std::vector<std::string> pending(1, "");
+	while (!pending.empty()) {
+		const std::string dir_name = pending.back();
+		pending.pop_back();
+
+		std::vector<std::string> dirs;
+		std::vector<DatSource::entry_t> dats;
+		source->list(dir_name, dirs, dats);
+
+		for (auto dir = dirs.rbegin(); dir != dirs.rend(); ++dir) {
+			pending.push_back(dir_name.empty() ? *dir : dir_name + "/" + *dir);
+		}
+
+		if (dats.empty()) {
+			continue;
+		}
+
+		unsigned long long size = 0;
+		for (auto const& dat : dats) {
+			size += dat.size;
+		}
+
+		bool start = shards.empty();
+		if (max_size == 0) {
+			const std::string top = dir_name.substr(0, dir_name.find('/'));
+			start = start || top != shard_top || dir_name.empty();
+			shard_top = top;
+		}
+		else {
+			start = start || shard_size + size > max_size;
+		}
+
+		if (start) {
+			shards.emplace_back();
+			shard_size = 0;
+		}
+		shards.back().push_back(dir_name);
+		shard_size += size;
+	}
+
+	return shards;
+}
+
+/**
+ * @brief Name of the file of a shard
+ *
+ * @param filename Name given for the whole pakset, like pak.xlsx
+ * @param number Number of the shard, starting at 1
+ *
+ * @return name with the number before the extension, like pak.1.xlsx
+ */
+std::string Importer::shardName(const std::string& filename, const unsigned int number)
+{
+	const std::string::size_type slash = filename.find_last_of("\\/");
+	const std::string::size_type dot = filename.rfind('.');
+
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		return filename + "." + std::to_string(number);
+	}
+	return filename.substr(0, dot) + "." + std::to_string(number) + filename.substr(dot);
+}
+
+/**
+ * @brief Name of the file listing the shards
+ *
+ * @param filename Name given for the whole pakset, like pak.xlsx
+ *
+ * @return name with the extension replaced, like pak.shards
+ */
+std::string Importer::shardSetName(const std::string& filename)
+{
+	const std::string::size_type slash = filename.find_last_of("\\/");
+	const std::string::size_type dot = filename.rfind('.');
+
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		return filename + ".shards";
+	}
+	return filename.substr(0, dot) + ".shards";
+}
+
+/**
+ * @brief Time used for reproducible output
+ *
+ * @return SOURCE_DATE_EPOCH if set, otherwise the first time a zip
+ * entry can have, 1980-01-01T00:00:00Z
+ */
+std::time_t Importer::reproducibleTime()
+{
+	const char* epoch = std::getenv("SOURCE_DATE_EPOCH");
+
+	if (epoch && *epoch) {
+		const long long seconds = std::strtoll(epoch, nullptr, 10);
+		// zip times can't be before 1980
+		if (seconds >= 315532800) {
+			return seconds;
+		}
+	}
+	return 315532800;
+}
+
+/**
+ * @brief Add a file to the zip
+ *
+ * libzip only reads the data when the zip is closed, so it's
+ * kept alive until then.
+ *
+ * @param name Path of the file inside the zip
+ * @param data Content of the file
+ */
+void Importer::addToZip(const std::string& name, std::string data)
+{
+	zip_data.push_back(std::move(data));
+	sheet->addData(name, zip_data.back().data(), zip_data.back().size());
+}
+
+/**
+ * @brief Set the time of every zip entry
+ *
+ * libzip stamps entries with the current time and libzip++ can't
+ * change it, so the closed zip is opened again with libzip itself.
+ * Zip stores local time, the date is written as UTC so the result
+ * does not depend on the time zone of the machine, without changing
+ * the time zone of the process.
+ *
+ * @param time Time to set
+ */
+void Importer::setZipTime(const std::time_t time)
+{
+	// zip keeps a DOS date and time, built from UTC without touching TZ
+	std::tm utc;
+#ifdef _WIN32
+	gmtime_s(&utc, &time);
+#else
+	gmtime_r(&time, &utc);
+#endif
+	// the oldest time a DOS date holds
+	if (utc.tm_year < 80) {
+		utc = std::tm();
+		utc.tm_year = 80;
+		utc.tm_mday = 1;
+	}
+	const zip_uint16_t dos_time = (utc.tm_hour << 11) | (utc.tm_min << 5) | (utc.tm_sec / 2);
+	const zip_uint16_t dos_date = ((utc.tm_year - 80) << 9) | ((utc.tm_mon + 1) << 5) | utc.tm_mday;
+
+	int error = 0;
+	zip_t *archive = zip_open(filename.c_str(), 0, &error);
+
+	if (archive == NULL) {
+		zip_error_t zip_error;
+		zip_error_init_with_code(&zip_error, error);
+		std::ostringstream err_msg;
+		err_msg << "ZIP" << error << ":" << zip_error_strerror(&zip_error) << ": " << filename;
+		zip_error_fini(&zip_error);
+		throw std::runtime_error(err_msg.str());
+	}
+
+	const zip_int64_t entries = zip_get_num_entries(archive, 0);
+	for (zip_int64_t i = 0; i < entries; ++i) {
+		zip_file_set_dostime(archive, i, dos_time, dos_date, 0);
+	}
+
+	if (zip_close(archive) < 0) {
+		std::ostringstream err_msg;
+		err_msg << "ZIP" << errno << ":" << zip_strerror(archive) << ": " << filename;
+		zip_discard(archive);
+		throw std::runtime_error(err_msg.str());
+	}
 }
 
 /**
@@ -76,6 +389,68 @@ void Importer::addXMLdeclaration(pugi::xml_document& doc)
 	attr.set_value("yes");
 }
 
+/**
+ * @brief Check if a string is valid UTF-8
+ *
+ * Overlong forms, surrogates and code points past U+10FFFF are
+ * not valid, like for ICU.
+ *
+ * @param input String to check
+ *
+ * @return true if the whole string is UTF-8, which includes ASCII
+ */
+bool Importer::isUTF8(const std::string& input)
+{
+	const unsigned char* c = reinterpret_cast<const unsigned char*>(input.data());
+	const unsigned char* end = c + input.size();
+
+	while (c < end) {
+		if (*c < 0x80) {
+			++c;
+			continue;
+		}
+
+		unsigned int length;
+		unsigned int code;
+		unsigned int min;
+		if ((*c & 0xE0) == 0xC0) {
+			length = 2;
+			code = *c & 0x1F;
+			min = 0x80;
+		}
+		else if ((*c & 0xF0) == 0xE0) {
+			length = 3;
+			code = *c & 0x0F;
+			min = 0x800;
+		}
+		else if ((*c & 0xF8) == 0xF0) {
+			length = 4;
+			code = *c & 0x07;
+			min = 0x10000;
+		}
+		else {
+			return false;
+		}
+
+		if (end - c < length) {
+			return false;
+		}
+		for (unsigned int i = 1; i < length; ++i) {
+			if ((c[i] & 0xC0) != 0x80) {
+				return false;
+			}
+			code = (code << 6) | (c[i] & 0x3F);
+		}
+		if (code < min || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) {
+			return false;
+		}
+
+		c += length;
+	}
+
+	return true;
+}
+
 /**
  * @brief Convert string into UTF-8
  *
@@ -83,6 +458,10 @@ void Importer::addXMLdeclaration(pugi::xml_document& doc)
  * into UTF-8 encoding and will place the result into the passed
  * string stream.
  *
+ * Dats that already are UTF-8 or ASCII, almost all of them, are
+ * copied as they are. ICU is only loaded for the others and its
+ * detector is only opened for the first one.
+ *
  * @param input  String in whatever encoding to be converted
  * @param output String stream where UTF-8 encoded result will be put
  *
@@ -90,51 +469,238 @@ void Importer::addXMLdeclaration(pugi::xml_document& doc)
  */
 bool Importer::convertToUTF8(const std::string& input, std::stringstream& output)
 {
+	if (isUTF8(input)) {
+		output << input << '\0';
+		return true;
+	}
+
+	// loaded by the first dat that needs it
+	const ICU* icu = ICU::get();
+	if (icu == nullptr) { return false; }
+
 	UErrorCode enc_status = U_ZERO_ERROR;
-	UCharsetDetector *enc_detect = ucsdet_open(&enc_status);
-	if (U_FAILURE(enc_status)) { return false; }
 
-	ucsdet_setText(enc_detect, input.c_str(), input.length(), &enc_status);
-	if (U_FAILURE(enc_status)) { ucsdet_close(enc_detect); return false; }
+	if (detector == nullptr) {
+		detector = icu->detectorOpen(&enc_status);
+		if (U_FAILURE(enc_status)) { detector = nullptr; return false; }
+	}
+
+	icu->detectorSetText(detector, input.c_str(), input.length(), &enc_status);
+	if (U_FAILURE(enc_status)) { return false; }
 
 	// guess encoding
-	const UCharsetMatch *enc_match = ucsdet_detect(enc_detect, &enc_status);
-	if (U_FAILURE(enc_status)) { ucsdet_close(enc_detect); return false; }
+	const UCharsetMatch *enc_match = icu->detectorDetect(detector, &enc_status);
+	if (U_FAILURE(enc_status)) { return false; }
 
-	const char* enc_name = ucsdet_getName(enc_match, &enc_status);
-	if (U_FAILURE(enc_status)) { ucsdet_close(enc_detect); return false; }
+	const char* enc_name = icu->matchName(enc_match, &enc_status);
+	if (U_FAILURE(enc_status)) { return false; }
 
-	UConverter *enc_cnv = ucnv_open(enc_name, &enc_status);
-	if (U_FAILURE(enc_status)) { ucsdet_close(enc_detect); return false; }
+	UConverter *enc_cnv = icu->converterOpen(enc_name, &enc_status);
+	if (U_FAILURE(enc_status)) { return false; }
 
-	// Simutrans dat files are mostly ASCII, only comments can have special chars
-	// so twice the size is probably more than enough
-	size_t max_size = input.length() * 2;
-	char *converted = new char(max_size);
-//	char converted[max_size];
+	// a byte of a legacy encoding is at most 3 bytes in UTF-8, so it always fits
+	std::string converted(input.length() * 3, '\0');
 
 	// convert to UTF-8
-	max_size = ucnv_toAlgorithmic(UCNV_UTF8, enc_cnv, converted, max_size, input.c_str(), input.length(), &enc_status);
-	if (U_FAILURE(enc_status)) { ucsdet_close(enc_detect); return false; }
+	const int32_t size = icu->converterToAlgorithmic(UCNV_UTF8, enc_cnv, &converted[0], converted.size(), input.c_str(), input.length(), &enc_status);
+	icu->converterClose(enc_cnv);
+	if (U_FAILURE(enc_status)) { return false; }
 
 	// put result into stream
-	output << std::string(converted, max_size) << '\0';
+	converted.resize(size);
+	output << converted << '\0';
 
-	ucsdet_close(enc_detect);
 	return true;
 }
 
 /**
- * @brief Create an worksheet file
+ * @brief Read the dats of a sheet
  *
- * Writes all dats passed in a worksheet file and saves it
- * in the xlsx file.
+ * Values are kept with the sheet and every string is counted, the
+ * sheet is only written once the strings of all sheets are known.
  *
- * @param dats Vector containing the location of all dats to write
- * @param dir Directory where the dat files are
+ * @param dats Vector containing all dats to write
+ * @param dir Directory where the dat files are, relative to the root
  * @param index The index of the sheet, used for saving the correct file
+ * @param selected Whether this is the sheet shown when opening the file
  */
-void Importer::createSheet(const std::vector<std::string>& dats, const std::string& dir, const unsigned int index)
+void Importer::createSheet(const std::vector<DatSource::entry_t>& dats, const std::string& dir, const unsigned int index, const bool selected)
+{
+	// parameter names, the id only groups the values of the same parameter
+	Interner parameters;
+	// always have name and filename columns
+	parameters.intern("name");
+	parameters.intern("filename");
+	// values of each object, in the order they are found
+	std::vector<std::vector<cell_t>> objects;
+	// position + 1 of each parameter in the current object, 0 if not set yet
+	std::vector<unsigned int> positions;
+
+	for (auto const& dat : dats) {
+		// path used in warnings
+		const std::string dat_name = root + (dir.empty() ? "" : dir + "/") + dat.name;
+		// read it all and put in string, stopping at the first null like getline did
+		std::string dat_buf;
+		source->read(dir.empty() ? dat.name : dir + "/" + dat.name, dat_buf);
+		dat_buf.resize(std::min(dat_buf.size(), dat_buf.find('\0')));
+		std::stringstream dat_file;
+
+		// put converted string into stream
+		if (convertToUTF8(dat_buf, dat_file)) {
+			std::string param;
+			bool createRow = true;
+
+			// add columns/paramater values
+			while (std::getline(dat_file, param)) {
+				// check for key = value
+				std::stringstream param_stream(param);
+				std::getline(param_stream, param, '=');
+
+				// remove leading and trailing whitespaces
+				std::string::size_type start = param.find_first_not_of(" \t");
+				std::string::size_type end = param.find_last_not_of(" \t\n\r");
+				// blank lines become empty, files without \r have nothing left
+				param = param.substr((start != std::string::npos ? start : param.length()), (end == std::string::npos ? end : end + 1 - start));
+
+				// object separation line, move to next row
+				if (!param.empty() && param.front() == '-') {
+					// move to next row/object
+					createRow = true;
+				}
+				// skip empty lines
+				else if (param.size() > 1 && param.front() != '\r' && param.front() != '#') {
+					std::string value;
+					bool number = false;
+
+					// comment line
+					if (param.front() == '#') {
+						value = param.substr(1);
+						param = "#";
+					}
+					else {
+						// convert parameter to lowercase to merge things like Name & name
+						std::transform(param.begin(), param.end(), param.begin(), ::tolower);
+						std::getline(param_stream, value);
+
+						if (value.length() > 0) {
+							// remove leading and trailing whitespaces
+							start = value.find_first_not_of(" \t");
+							end = value.find_last_not_of(" \t\n\r");
+							// no checks needed, start always returns at least \r|\n
+							value = value.substr(start, (end == std::string::npos ? end : end + 1 - start));
+
+							// number type
+							number = isNumber(value);
+						}
+					}
+
+					if (value.length() > 0) {
+						// create row
+						if (createRow) {
+							// forget the parameters of the previous object
+							if (!objects.empty()) {
+								for (auto const& cell : objects.back()) {
+									positions[cell.param] = 0;
+								}
+							}
+							objects.emplace_back();
+							createRow = false;
+						}
+
+						const unsigned int param_id = parameters.intern(param);
+						if (param_id >= positions.size()) {
+							positions.resize(param_id + 1, 0);
+						}
+
+						std::vector<cell_t>& object = objects.back();
+
+						// if parameter was already set we replace and alert
+						if (positions[param_id]) {
+							std::clog << dat_name << " : Value overwriten warning OV0:Parameter '" << param << "' overwritten." << std::endl;
+							object[positions[param_id] - 1] = cell_t{param_id, value, number};
+						}
+						else {
+							object.push_back(cell_t{param_id, value, number});
+							positions[param_id] = object.size();
+						}
+					}
+					else {
+						std::clog << dat_name << " : Value is null warning NV0:The following line seems to be invalid and was ignored:\n\t" << param << std::endl;
+					}
+				}
+			}
+		}
+		else if (ICU::get() == nullptr) {
+			// why ICU is missing was told once already
+			std::clog << dat_name << " : Encoding warning UE2:File is not in UTF-8 and was skipped, ICU could not be loaded." << std::endl;
+		}
+		else {
+			std::clog << dat_name << " : Encoding warning UE0:An error occurred while trying to detect file encoding. File was skipped. Saving it under a Unicode encoding will most likely fix this.";
+		}
+	}
+
+	// canonical order of the parameters, related ones are next to each other
+	std::vector<unsigned int> order(parameters.size());
+	for (unsigned int i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&parameters](const unsigned int a, const unsigned int b) {
+		return DatKeys::before(parameters.name(a), parameters.name(b));
+	});
+
+	// column of each parameter
+	std::vector<unsigned int> columns(order.size());
+	for (unsigned int col = 0; col < order.size(); ++col) {
+		columns[order[col]] = col;
+	}
+
+	sheet_data_t data{index, selected, std::vector<std::string>(), std::vector<std::vector<cell_t>>()};
+
+	// row 1 has the parameter names
+	for (unsigned int col = 0; col < order.size(); ++col) {
+		const std::string& param = parameters.name(order[col]);
+
+		if (col >= CellRef::MAX_COLUMNS) {
+			std::clog << dir << " : Too many parameters warning TMP0:Parameter '" << param << "' does not fit in the sheet and was ignored." << std::endl;
+			continue;
+		}
+
+		data.header.push_back(param);
+		countString(param);
+	}
+
+	// one row per object
+	for (auto& object : objects) {
+		for (auto& cell : object) {
+			cell.param = columns[cell.param];
+		}
+
+		// cells must be ordered by column in the xml
+		std::sort(object.begin(), object.end(), [](const cell_t& a, const cell_t& b) {
+			return a.param < b.param;
+		});
+
+		while (!object.empty() && object.back().param >= CellRef::MAX_COLUMNS) {
+			object.pop_back();
+		}
+		for (auto const& cell : object) {
+			if (!cell.number) {
+				countString(cell.value);
+			}
+		}
+
+		data.rows.push_back(std::move(object));
+	}
+
+	sheets_data.push_back(std::move(data));
+}
+
+/**
+ * @brief Add the sheet file in the zip
+ *
+ * @param data Sheet read from its dats
+ */
+void Importer::writeSheet(const sheet_data_t& data)
 {
 	// start creating XML
 	pugi::xml_document doc;
@@ -158,7 +724,7 @@ void Importer::createSheet(const std::vector<std::string>& dats, const std::stri
 	child1 = child1.append_child("sheetView");
 	// only one sheet is "open" and that's the first one
 	// aka the sheet that shows when you open the xlsx file
-	if (index == 1) {
+	if (data.selected) {
 		attr = child1.append_attribute("tabSelected");
 		attr.set_value("1");
 	}
@@ -200,207 +766,167 @@ void Importer::createSheet(const std::vector<std::string>& dats, const std::stri
 
 	// finally start adding what's in the dats
 	child1 = worksheet.append_child("sheetData");
-	pugi::xml_node child3;
-
-	// parameter names to build row 1
-	std::vector<std::string> parameters;
-	// always start with name parameter
-	parameters.push_back("name");
-	parameters.push_back("filename");
-
-	// skip first (parameter names) row as we don't know them yet
-	// row 0 does not exist
-	int row = 1;
-	for (auto const& dat_name : dats) {
-		// open file, read it all and put in string
-		std::ifstream dat_file_open(dir + dat_name);
-		std::string dat_buf;
-		std::getline(dat_file_open, dat_buf, '\0');
-		std::stringstream dat_file;
 
-		// put converted string into stream
-		if (convertToUTF8(dat_buf, dat_file)) {
-			// list of column xml nodes
-			std::vector<unsigned short> cols_list;
-			pugi::xml_node nodes_list[702];
-			std::string param;
-			bool createRow = true;
-
-			// add columns/paramater values
-			while (std::getline(dat_file, param)) {
-				// check for key = value
-				std::stringstream param_stream(param);
-				std::getline(param_stream, param, '=');
-
-				// remove leading and trailing whitespaces
-				std::string::size_type start = param.find_first_not_of(" \t");
-				std::string::size_type end = param.find_last_not_of(" \t\n\r");
-				// no checks needed, start always returns at least \r|\n
-				param = param.substr((start != std::string::npos ? start : param.length()), (end == std::string::npos ? end : end + 1 - start));
-
-				// object separation line, move to next row
-				if (param.front() == '-') {
-					// move to next row/object
-					createRow = true;
-					// restart columns/parameters list
-					cols_list.clear();
-				}
-				// skip empty lines
-				else if (param.size() > 1 && param.front() != '\r' && param.front() != '#') {
-					std::string value;
-					std::string type("s");
+	// row 1 has the parameter names
+	unsigned int next_column = 0;
+	child2 = child1.append_child("row");
+	if (!compact) {
+		attr = child2.append_attribute("r");
+		attr.set_value("1");
+	}
+	for (unsigned int col = 0; col < data.header.size(); ++col) {
+		addCell(child2, col, 1, data.header[col], false, next_column);
+	}
 
-					// comment line
-					if (param.front() == '#') {
-						value = param.substr(1);
-						param = "#";
-					}
-					else {
-						// convert parameter to lowercase to merge things like Name & name
-						std::transform(param.begin(), param.end(), param.begin(), ::tolower);
-						std::getline(param_stream, value);
+	// one row per object, row 1 is taken by the parameter names
+	unsigned int row = 1;
+	for (auto const& object : data.rows) {
+		child2 = child1.append_child("row");
+		if (!compact) {
+			attr = child2.append_attribute("r");
+			attr.set_value(row + 1);
+		}
+		++row;
 
-						if (value.length() > 0) {
-							// remove leading and trailing whitespaces
-							start = value.find_first_not_of(" \t");
-							end = value.find_last_not_of(" \t\n\r");
-							// no checks needed, start always returns at least \r|\n
-							value = value.substr(start, (end == std::string::npos ? end : end + 1 - start));
+		next_column = 0;
+		for (auto const& cell : object) {
+			addCell(child2, cell.param, row, cell.value, cell.number, next_column);
+		}
+	}
 
-							// number type
-							if (value.find_first_not_of("0123456789") == std::string::npos) {
-								type = "n";
-							}
-						}
-					}
+	std::string sheet_name("xl/worksheets/sheet" + std::to_string(data.file) + ".xml");
+	std::ostringstream buffer;
+	doc.save(buffer, "", pugi::format_raw);
+	addToZip(sheet_name, buffer.str());
+}
 
-					if (value.length() > 0) {
-						// string are saved in sharedStrings file
-						if (type == "s") {
-							value = std::to_string(findInVectorOrAdd(sharedStrings, value));
-						}
+/**
+ * @brief Check if a value is written as a number
+ *
+ * Only values that read back as exactly the same text are numbers,
+ * so 1.50, 007, 1e3 or 16 digit ids stay strings and the dats don't
+ * change after the sheet is saved by a spreadsheet application.
+ * Lists like 1,2 are strings too.
+ *
+ * @param value Value of a parameter
+ *
+ * @return true if it's written as a number
+ */
+bool Importer::isNumber(const std::string& value)
+{
+	const char* first = value.data();
+	const char* last = first + value.size();
 
-						// create row
-						if (createRow) {
-							child2 = child1.append_child("row");
-							attr = child2.append_attribute("r");
-							attr.set_value(++row);
-							createRow = false;
-						}
+	// plain decimals only, no exponent, infinity or NaN
+	if (value.find_first_not_of("-.0123456789") != std::string::npos) {
+		return false;
+	}
+	// spreadsheets only keep 15 significant digits
+	const std::string::size_type leading = value.find_first_not_of("-.0");
+	if (leading != std::string::npos && value.size() - leading - (value.find('.', leading) != std::string::npos) > 15) {
+		return false;
+	}
 
-						// get the column this value must be defined
-						unsigned short col = findInVectorOrAdd(parameters, param);
+	double number;
+	const std::from_chars_result parsed = std::from_chars(first, last, number);
+	if (parsed.ec != std::errc() || parsed.ptr != last) {
+		return false;
+	}
 
-						// get column letter code
-						unsigned char div = col / 26;
-						std::ostringstream cell_pos;
-						if (div > 0) {
-							// @ is 'A-1', that's because when div = 1 it has to add 'A'
-							cell_pos << (unsigned char)(div + '@');
-						}
-						cell_pos << (unsigned char)((col % 26) + 'A') << row;
+	// shortest text of the double without exponent, must be the value itself
+	char buffer[64];
+	const std::to_chars_result written = std::to_chars(buffer, buffer + sizeof(buffer), number, std::chars_format::fixed);
+	return written.ec == std::errc() && value.compare(0, std::string::npos, buffer, written.ptr - buffer) == 0 && (number != 0 || value == "0");
+}
 
-						// add the column
-						auto col_lower = std::lower_bound(cols_list.begin(), cols_list.end(), col);
+/**
+ * @brief Count a use of a string
+ *
+ * @param value The string
+ */
+void Importer::countString(const std::string& value)
+{
+	const unsigned int id = strings.intern(value);
 
-						// if column already exists we replace and alert
-						if (col_lower != cols_list.end() && *col_lower == col) {
-							pugi::xml_text value_node = nodes_list[col].child("v").text();
-							std::clog << dir << dat_name << " : Value overwriten warning OV0:Parameter '" << param << "' overwritten." << std::endl;
-							value_node.set(value.c_str());
-						}
-						else {
-							if (col_lower == cols_list.end()) {
-								nodes_list[col] = child2.append_child("c");
-							}
-							else {
-								nodes_list[col] = child2.insert_child_before("c", nodes_list[*col_lower]);
-							}
+	if (id >= string_uses.size()) {
+		string_uses.push_back(0);
+	}
+	string_uses[id]++;
+}
 
-							cols_list.insert(col_lower, col);
+/**
+ * @brief Decide where each string is written
+ *
+ * Strings already in the shared strings keep their index, sheets
+ * that were not made again still use them. Strings used by a single
+ * cell are written in the cell, the others are added to the shared
+ * strings, the most used first so they get the shortest indexes.
+ */
+void Importer::orderStrings()
+{
+	string_slots.assign(strings.size(), INLINE);
+	std::vector<unsigned int> added;
 
-							attr = nodes_list[col].append_attribute("r");
-							attr.set_value(cell_pos.str().c_str());
-							attr = nodes_list[col].append_attribute("t");
-							attr.set_value(type.c_str());
-							child3 = nodes_list[col].append_child("v");
-							child3 = child3.append_child(pugi::node_pcdata);
-							child3.set_value(value.c_str());
-						}
-					}
-					else {
-						std::clog << dir << dat_name << " : Value is null warning NV0:The following line seems to be invalid and was ignored:\n\t" << param << std::endl;
-					}
-				}
-			}
+	for (unsigned int id = 0; id < strings.size(); ++id) {
+		auto known = shared_index.find(strings.name(id));
+		if (known != shared_index.end()) {
+			string_slots[id] = known->second;
 		}
-		else {
-			std::clog << dir << dat_name << " : Encoding warning UE0:An error occurred while trying to detect file encoding. File was skipped. Saving it under a Unicode encoding will most likely fix this.";
+		else if (string_uses[id] > 1) {
+			added.push_back(id);
 		}
 	}
 
-	// prepend row 1
-	child2 = child1.prepend_child("row");
-	attr = child2.append_attribute("r");
-	attr.set_value("1");
-	unsigned short col = 0;
-	// populate row 1 with parameter names
-	for (auto const& param : parameters) {
-		// get column letter code
-		unsigned char div = col / 26;
-		std::ostringstream cell_pos;
-		if (div > 0) {
-			cell_pos << (unsigned char)(div + '@');
-		}
-		cell_pos << (unsigned char)((col % 26) + 'A') << "1";
-
-		std::string value = std::to_string(findInVectorOrAdd(sharedStrings, param));
-
-		child3 = child2.append_child("c");
-		attr = child3.append_attribute("r");
-		attr.set_value(cell_pos.str().c_str());
-		attr = child3.append_attribute("t");
-		attr.set_value("s");
-		child3 = child3.append_child("v");
-		child3 = child3.append_child(pugi::node_pcdata);
-		child3.set_value(value.c_str());
+	// stable so strings used as often keep the order they were found
+	std::stable_sort(added.begin(), added.end(), [this](const unsigned int a, const unsigned int b) {
+		return string_uses[a] > string_uses[b];
+	});
 
-		col++;
+	for (auto const id : added) {
+		string_slots[id] = shared_strings.size();
+		shared_index.emplace(strings.name(id), shared_strings.size());
+		shared_strings.push_back(strings.name(id));
 	}
-
-	std::string sheet_name("xl/worksheets/sheet" + std::to_string(index) + ".xml");
-	std::ostringstream buffer;
-	doc.save(buffer, "", pugi::format_raw);
-//	sheet->add(libzip::source_buffer(buffer.str()), sheet_name, ZIP_FL_ENC_UTF_8);
-	sheet->addData(sheet_name, buffer.str().c_str(), buffer.str().size());
 }
 
 /**
- * @brief Check if value is in vector and return index
+ * @brief Add a cell to a row of a sheet
  *
- * Will iterate over the vector to see if `value` is in the vector.
- * If `value` is not in the vector it's added.
+ * Numbers have no type, it's the default. Strings are written in
+ * the cell or point to the shared strings, see orderStrings().
  *
- * @param str_v Vector to be searched on
- * @param value Value to be searched for
- *
- * @return index where value is located
+ * @param row_node Row the cell is added to
+ * @param column Zero based column of the cell
+ * @param row Row of the cell
+ * @param value Value of the cell
+ * @param number Whether the value is a number
+ * @param next_column Column after the previous cell, updated
  */
-unsigned int Importer::findInVectorOrAdd(std::vector<std::string>& str_v, const std::string& value)
+void Importer::addCell(pugi::xml_node& row_node, const unsigned int column, const unsigned int row, const std::string& value, const bool number, unsigned int& next_column)
 {
-	const unsigned int size = str_v.size();
+	pugi::xml_node cell = row_node.append_child("c");
 
-	for (unsigned int i = 0; i < size; ++i) {
-		if (str_v[i] == value) {
-			return i;
-		}
+	if (!compact || column != next_column) {
+		cell.append_attribute("r").set_value(CellRef::ref(column, row).c_str());
 	}
+	next_column = column + 1;
 
-	// if it was not found we add to it
-	str_v.push_back(value);
-	// index starts at 0, size is last_index + 1
-	// thus we just need to return the old size
-	return size;
+	if (number) {
+		cell.append_child("v").append_child(pugi::node_pcdata).set_value(value.c_str());
+		return;
+	}
+
+	unsigned int id = 0;
+	strings.find(value, id);
+
+	if (string_slots[id] == INLINE) {
+		cell.append_attribute("t").set_value("inlineStr");
+		cell.append_child("is").append_child("t").append_child(pugi::node_pcdata).set_value(value.c_str());
+	}
+	else {
+		cell.append_attribute("t").set_value("s");
+		cell.append_child("v").append_child(pugi::node_pcdata).set_value(std::to_string(string_slots[id]).c_str());
+	}
 }
 
 /**
@@ -412,106 +938,52 @@ unsigned int Importer::findInVectorOrAdd(std::vector<std::string>& str_v, const
  * @warn The function is recursive, it calls itself for each
  * sub-folder and so on, index is also updated automatically.
  *
- * @param dir_name Directory to analyse and create sheets
+ * @param dir_name Directory to analyse and create sheets, relative to the root
  * @param index Current sheet index
+ * @param recursive Whether sub-folders are also read
  */
-void Importer::readDir(const std::string& dir_name, unsigned int& index)
+void Importer::readDir(const std::string& dir_name, unsigned int& index, const bool recursive)
 {
 	/* we get the list of subdirs and dat files now */
 	/* so we can deal with each later */
 	std::vector<std::string> dirs;
-	std::vector<std::string> dats;
+	std::vector<DatSource::entry_t> dats;
 
-#ifdef _WIN32
-	// Windows only
-	HANDLE dir;
-	WIN32_FIND_DATAA ent;
-	char find_term[2048];
-	std::snprintf(find_term, 2048, "%s/*", dir_name.c_str());
-
-	// try starting it up and fail if no handle found
-	if ((dir = FindFirstFileA(find_term, &ent)) == INVALID_HANDLE_VALUE) {
-		std::ostringstream err_msg;
-		err_msg << "WRD" << errno << ":" << strerror(errno);
-		throw std::runtime_error(err_msg.str());
-	}
+	source->list(dir_name, dirs, dats);
 
-	// do first to include result from FindFirstFile
-	do {
-		// skip those two
-		if (std::strcmp(ent.cFileName, ".") && std::strcmp(ent.cFileName, "..")) {
-			const char* extension = std::strrchr(ent.cFileName, '.');
+	// create sheet file
+	if (dats.size() > 0) {
+		worksheet_t worksheet;
 
-			// directories are added to dirs list
-			if (ent.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-				dirs.push_back(std::string(ent.cFileName, std::strlen(ent.cFileName)));
-			}
-			// files that have extension .dat are added to dats list
-			else if (extension != NULL && !std::strcmp(extension, ".dat")) {
-				dats.push_back(std::string(ent.cFileName, std::strlen(ent.cFileName)));
-			}
+		if (!dir_name.empty()) {
+			worksheet.name = dir_name;
+			std::replace(worksheet.name.begin(), worksheet.name.end(), '/',  ';');
 		}
-	} while (FindNextFileA(dir, &ent));
-
-	FindClose(dir);
-#else
-	// Other platforms (Linux/OpenBSD)
-	DIR *dir;
-	struct dirent *ent;
-
-	// failed opening directory
-	if ((dir = opendir(dir_name.c_str())) == NULL) {
-		std::ostringstream err_msg;
-		err_msg << "URD" << errno << ":" << strerror(errno);
-		throw std::runtime_error(err_msg.str());
-	}
-
-	// read directory
-	while ((ent = readdir(dir)) != NULL) {
-		// skip those two
-		if (std::strcmp(ent->d_name, ".") && std::strcmp(ent->d_name, "..")) {
-			const char* extension = std::strrchr(ent->d_name, '.');
-
-			// directories are added to dirs list
-			if (ent->d_type == DT_DIR) {
-				dirs.push_back(std::string(ent->d_name, std::strlen(ent->d_name)));
-			}
-			// regular files that have extension .dat are added to dats list
-			else if (ent->d_type == DT_REG && extension != NULL && !std::strcmp(extension, ".dat")) {
-				dats.push_back(std::string(ent->d_name, std::strlen(ent->d_name)));
-			}
+		else {
+			worksheet.name = ";";
 		}
-	}
-	closedir(dir);
-#endif
+		worksheet.signature = dirSignature(dats);
 
-	// does current dir has an ending slash?
-	// if it does not we will have to add it
-	bool has_slash = (dir_name.find_last_of("\\/") == dir_name.size() - 1);
-	bool is_root = dir_name.length() == root_dir_size;
+		// directories keep their sheet file when updating
+		auto old = previous.find(worksheet.name);
+		worksheet.file = (old != previous.end() ? old->second.file : next_file++);
 
-	// create sheet file
-	if (dats.size() > 0) {
-		createSheet(dats, dir_name + (has_slash ? "" : "/"),  index++);
-		if (!is_root) {
-			std::string sheet_name = dir_name.substr(root_dir_size);
-			std::replace(sheet_name.begin(), sheet_name.end(), '/',  ';');
-			worksheets.push_back(sheet_name);
+		// unchanged sheets are left untouched in the zip, not even recompressed
+		if (old != previous.end() && old->second.signature == worksheet.signature && sheet->hasEntry("xl/worksheets/sheet" + std::to_string(worksheet.file) + ".xml")) {
+			reused++;
 		}
 		else {
-			worksheets.push_back(";");
+			createSheet(dats, dir_name, worksheet.file, index == 1);
 		}
-	}
 
-	// take into account the ending slash that will be added if not present
-	if (is_root && !has_slash) {
-		root_dir_size = root_dir_size + 1;
+		index++;
+		worksheets.push_back(worksheet);
 	}
 
 	// enter sub-folders
-	if (dirs.size() > 0) {
+	if (recursive && dirs.size() > 0) {
 		for (auto const& dir : dirs) {
-			readDir(dir_name + (has_slash ? "" : "/") + dir, index);
+			readDir(dir_name.empty() ? dir : dir_name + "/" + dir, index, true);
 		}
 	}
 }
@@ -519,14 +991,20 @@ void Importer::readDir(const std::string& dir_name, unsigned int& index)
 /**
  * @brief Starts the importing
  *
- * Imports a pakset structure into an xlsx file
+ * Imports a pakset structure into an xlsx file. The pakset can
+ * be a directory or a tar or zip archive, which is read directly
+ * without extracting it.
  *
- * @param root_dir Root directory of the pakset
+ * @param root_dir Root directory or archive of the pakset
  */
 void Importer::import(const std::string& root_dir)
 {
-	// used later for relative paths
-	root_dir_size = root_dir.length();
+	source = DatSource::open(root_dir);
+	// used in warnings, without ending slash
+	root = root_dir;
+	while (root.size() > 1 && (root.back() == '/' || root.back() == '\\')) {
+		root.pop_back();
+	}
 
 	/*
 	 * /xl/worksheets/sheet($index).xml
@@ -534,7 +1012,58 @@ void Importer::import(const std::string& root_dir)
 	 * Sheet files, each on its own xml file
 	 */
 	unsigned int index = 1;
-	readDir(root_dir, index);
+	if (only_dirs.empty()) {
+		readDir("", index, true);
+	}
+	else {
+		for (auto const& dir : only_dirs) {
+			readDir(dir, index, false);
+		}
+	}
+
+	// sheets are only written once every string is known
+	orderStrings();
+	for (auto const& data : sheets_data) {
+		writeSheet(data);
+	}
+	sheets_data.clear();
+
+	// remove sheets of directories that no longer exist
+	for (auto const& old : previous) {
+		bool found = false;
+		for (auto const& worksheet : worksheets) {
+			if (worksheet.file == old.second.file) {
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			sheet->deleteEntry("xl/worksheets/sheet" + std::to_string(old.second.file) + ".xml");
+		}
+	}
+
+	if (reused > 0) {
+		std::cout << reused << " of " << worksheets.size() << " sheets were not changed.\n";
+	}
+
+	/*
+	 * /datSheet/manifest.xml
+	 *
+	 * Signature of the dats of each sheet, used for updating
+	 * only what changed on the next import
+	 */
+	pugi::xml_document manifest;
+	addXMLdeclaration(manifest);
+	pugi::xml_node manifest_node = manifest.append_child("manifest");
+	for (auto const& worksheet : worksheets) {
+		pugi::xml_node node = manifest_node.append_child("sheet");
+		node.append_attribute("name").set_value(worksheet.name.c_str());
+		node.append_attribute("file").set_value(worksheet.file);
+		node.append_attribute("signature").set_value(worksheet.signature.c_str());
+	}
+	std::ostringstream manifest_buffer;
+	manifest.save(manifest_buffer, "", pugi::format_raw);
+	addToZip("datSheet/manifest.xml", manifest_buffer.str());
 
 	/*
 	 * /_rels/.rels
@@ -544,7 +1073,7 @@ void Importer::import(const std::string& root_dir)
 	 */
 	std::ostringstream buffer("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\"><Relationship Id=\"rId3\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/extended-properties\" Target=\"docProps/app.xml\"/><Relationship Id=\"rId2\" Type=\"http://schemas.openxmlformats.org/package/2006/relationships/metadata/core-properties\" Target=\"docProps/core.xml\"/><Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/officeDocument\" Target=\"xl/workbook.xml\"/></Relationships>");
 //	sheet->add(libzip::source_buffer(buffer.str()), "_rels/.rels", ZIP_FL_ENC_UTF_8);
-	sheet->addData("_rels/.rels", buffer.str().c_str(), buffer.str().size());
+	addToZip("_rels/.rels", buffer.str());
 
 	buffer.str("");
 	pugi::xml_node node1, node2, node3;
@@ -562,7 +1091,7 @@ void Importer::import(const std::string& root_dir)
 	node1 = shared.append_child("sst");
 	attr = node1.append_attribute("xmlns");
 	attr.set_value("http://schemas.openxmlformats.org/spreadsheetml/2006/main");
-	for (auto const& string : sharedStrings) {
+	for (auto const& string : shared_strings) {
 		node2 = node1.append_child("si");
 		node2 = node2.append_child("t");
 		node2 = node2.append_child(pugi::node_pcdata);
@@ -571,7 +1100,7 @@ void Importer::import(const std::string& root_dir)
 
 	shared.save(buffer, "", pugi::format_raw);
 	//sheet->add(libzip::source_buffer(buffer.str()), "xl/sharedStrings.xml", ZIP_FL_ENC_UTF_8);
-	sheet->addData("xl/sharedStrings.xml", buffer.str().c_str(), buffer.str().size());
+	addToZip("xl/sharedStrings.xml", buffer.str());
 	buffer.str("");
 
 	/*
@@ -588,14 +1117,14 @@ void Importer::import(const std::string& root_dir)
 	// id must continue for sharedStrings
 	unsigned int id = 0;
 	while (id < worksheets.size()) {
-		id++;
 		node2 = node1.append_child("Relationship");
 		attr = node2.append_attribute("Id");
-		attr.set_value(std::string("rId" + std::to_string(id)).c_str());
+		attr.set_value(std::string("rId" + std::to_string(id + 1)).c_str());
 		attr = node2.append_attribute("Type");
 		attr.set_value("http://schemas.openxmlformats.org/officeDocument/2006/relationships/worksheet");
 		attr = node2.append_attribute("Target");
-		attr.set_value(std::string("worksheets/sheet" + std::to_string(id) + ".xml").c_str());
+		attr.set_value(std::string("worksheets/sheet" + std::to_string(worksheets[id].file) + ".xml").c_str());
+		id++;
 	}
 	node2 = node1.append_child("Relationship");
 	attr = node2.append_attribute("Id");
@@ -607,7 +1136,7 @@ void Importer::import(const std::string& root_dir)
 
 	workbook_rels.save(buffer, "", pugi::format_raw);
 //	sheet->add(libzip::source_buffer(buffer.str()), "xl/_rels/workbook.xml.rels", ZIP_FL_ENC_UTF_8);
-	sheet->addData("xl/_rels/workbook.xml.rels", buffer.str().c_str(), buffer.str().size());
+	addToZip("xl/_rels/workbook.xml.rels", buffer.str());
 	buffer.str("");
 
 	/*
@@ -657,17 +1186,17 @@ void Importer::import(const std::string& root_dir)
 	attr = node2.append_attribute("ContentType");
 	attr.set_value("application/vnd.openxmlformats-officedocument.extended-properties+xml");
 	// sheet files
-	for (unsigned int id = 0; id < worksheets.size(); ) {
+	for (auto const& worksheet : worksheets) {
 		node2 = node1.append_child("Override");
 		attr = node2.append_attribute("PartName");
-		attr.set_value(std::string("/xl/worksheets/sheet" + std::to_string(++id) + ".xml").c_str());
+		attr.set_value(std::string("/xl/worksheets/sheet" + std::to_string(worksheet.file) + ".xml").c_str());
 		attr = node2.append_attribute("ContentType");
 		attr.set_value("application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml");
 	}
 
 	types.save(buffer, "", pugi::format_raw);
 //	sheet->add(libzip::source_buffer(buffer.str()), "[Content_Types].xml", ZIP_FL_ENC_UTF_8);
-	sheet->addData("[Content_Types].xml", buffer.str().c_str(), buffer.str().size());
+	addToZip("[Content_Types].xml", buffer.str());
 	buffer.str("");
 
 	/*
@@ -684,10 +1213,10 @@ void Importer::import(const std::string& root_dir)
 	attr.set_value("http://schemas.openxmlformats.org/officeDocument/2006/relationships");
 	node2 = node1.append_child("sheets");
 	id = 1;
-	for (auto const& sheet_name : worksheets) {
+	for (auto const& worksheet : worksheets) {
 		node3 = node2.append_child("sheet");
 		attr = node3.append_attribute("name");
-		attr.set_value(sheet_name.c_str());
+		attr.set_value(worksheet.name.c_str());
 		attr = node3.append_attribute("sheetId");
 		attr.set_value(id);
 		attr = node3.append_attribute("r:id");
@@ -697,7 +1226,7 @@ void Importer::import(const std::string& root_dir)
 
 	workbook.save(buffer, "", pugi::format_raw);
 //	sheet->add(libzip::source_buffer(buffer.str()), "xl/workbook.xml", ZIP_FL_ENC_UTF_8);
-	sheet->addData("xl/workbook.xml", buffer.str().c_str(), buffer.str().size());
+	addToZip("xl/workbook.xml", buffer.str());
 	buffer.str("");
 
 	/*
@@ -739,19 +1268,19 @@ void Importer::import(const std::string& root_dir)
 	node3 = node2.append_child("vt:variant");
 	node3 = node3.append_child("vt:i4");
 	node3 = node3.append_child(pugi::node_pcdata);
-	const char* size = std::to_string(worksheets.size()).c_str();
-	node3.set_value(size); // number of sheets
+	const std::string size = std::to_string(worksheets.size());
+	node3.set_value(size.c_str()); // number of sheets
 	// names of the sheets
 	node2 = node1.append_child("TitlesOfParts");
 	node2 = node2.append_child("vt:vector");
 	attr = node2.append_attribute("size");
-	attr.set_value(size);
+	attr.set_value(size.c_str());
 	attr = node2.append_attribute("baseType");
 	attr.set_value("lpstr");
-	for (auto const& sheet_name : worksheets) {
+	for (auto const& worksheet : worksheets) {
 		node3 = node2.append_child("vt:lpstr");
 		node3 = node3.append_child(pugi::node_pcdata);
-		node3.set_value(sheet_name.c_str());
+		node3.set_value(worksheet.name.c_str());
 	}
 	// if links are up-to-date, we don't have them
 	node2 = node1.append_child("LinksUpToDate");
@@ -772,7 +1301,7 @@ void Importer::import(const std::string& root_dir)
 
 	app.save(buffer, "", pugi::format_raw);
 //	sheet->add(libzip::source_buffer(buffer.str()), "docProps/app.xml", ZIP_FL_ENC_UTF_8);
-	sheet->addData("docProps/app.xml", buffer.str().c_str(), buffer.str().size());
+	addToZip("docProps/app.xml", buffer.str());
 	buffer.str("");
 
 	/*
@@ -797,11 +1326,12 @@ void Importer::import(const std::string& root_dir)
 	node2 = node1.append_child("dc:title");
 	node2 = node2.append_child(pugi::node_pcdata);
 
-	std::string pakname = root_dir;
-	if (root_dir.find_last_of("\\/") == root_dir_size - 1) {
-		pakname = pakname.substr(0, root_dir_size - 1);
+	std::string pakname = root.substr(root.find_last_of("\\/") + 1);
+	// archives are named like the pakset
+	const std::string::size_type dot = pakname.rfind('.');
+	if (dot != std::string::npos && (pakname.compare(dot, std::string::npos, ".tar") == 0 || pakname.compare(dot, std::string::npos, ".zip") == 0)) {
+		pakname.erase(dot);
 	}
-	pakname = pakname.substr(pakname.find_last_of("\\/") + 1);
 	node2.set_value(pakname.c_str());
 	// name of the author
 	node2 = node1.append_child("dc:creator");
@@ -815,7 +1345,7 @@ void Importer::import(const std::string& root_dir)
 
 	// creation time
 	char time[21];
-	std::time_t now = std::time(nullptr);
+	std::time_t now = reproducible ? reproducibleTime() : std::time(nullptr);
 	std::strftime(time, 21, "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
 
 	node2 = node1.append_child("dcterms:created");
@@ -831,5 +1361,10 @@ void Importer::import(const std::string& root_dir)
 
 	core.save(buffer, "", pugi::format_raw);
 //	sheet->add(libzip::source_buffer(buffer.str()), "docProps/core.xml", ZIP_FL_ENC_UTF_8);
-	sheet->addData("docProps/core.xml", buffer.str().c_str(), buffer.str().size());
+	addToZip("docProps/core.xml", buffer.str());
+
+	if (reproducible) {
+		sheet->close();
+		setZipTime(now);
+	}
 }
@@ -1,37 +1,140 @@
 #include <vector>      // vector
+#include <deque>       // deque
+#include <string>      // string
+#include <ctime>       // time_t
+#include <map>         // map
+#include <unordered_map> // unordered_map
 #include <libzippp\libzippp.h>     // libzip++
 #include "pugixml-1.14/src/pugixml.hpp" // pugixml
+#include <memory>      // unique_ptr
+#include "schema.hh"   // CellRef, Interner
+#include "source.hh"   // DatSource
+
+struct UCharsetDetector;
 
 #define VERSION "1.2.0"
 
 /**
- * Importer from a directory tree to a valid Open Office XML xlsx
+ * Importer from a directory tree or archive to a valid Open Office XML xlsx
  */
 class Importer
 {
 	/** pointer to loaded spreadsheet xlsx file */
 	libzippp::ZipArchive *sheet;
-	/** xlsx sharedStrings file */
-	std::vector<std::string> sharedStrings;
-	/** name for the worksheets */
-	std::vector<std::string> worksheets;
-	unsigned int root_dir_size;
+	/** name of the xlsx file */
+	std::string filename;
+	/** content of the files added to the zip, must live until it's closed */
+	std::deque<std::string> zip_data;
+	/** whether the same input must always give the same output */
+	bool reproducible;
+	/** whether attributes implied by the position are left out */
+	bool compact;
+	/** strings of the xlsx sharedStrings file, in file order */
+	std::vector<std::string> shared_strings;
+	/** index of each string in shared_strings */
+	std::unordered_map<std::string, unsigned int> shared_index;
+	/** strings of the sheets being made, counted before any is written */
+	Interner strings;
+	/** number of cells using each string of strings */
+	std::vector<unsigned int> string_uses;
+	/** index in shared_strings of each string of strings, INLINE if used once */
+	std::vector<unsigned int> string_slots;
+	/** slot of strings written in the cell itself */
+	static const unsigned int INLINE = ~0u;
+	/** a worksheet of the workbook */
+	struct worksheet_t {
+		/** name of the sheet, the directory with ; as separator */
+		std::string name;
+		/** number of the sheet file, xl/worksheets/sheet(file).xml */
+		unsigned int file;
+		/** signature of the dats in the directory when the sheet was made */
+		std::string signature;
+	};
+	/** a value read from a dat */
+	struct cell_t {
+		/** id of the parameter in the sheet being created, its column once every dat is read */
+		unsigned int param;
+		std::string value;
+		/** whether the value is written as a number instead of a string */
+		bool number;
+	};
+	/** a sheet read from its dats, only written once every string is counted */
+	struct sheet_data_t {
+		/** number of the sheet file */
+		unsigned int file;
+		/** whether this is the sheet shown when opening the file */
+		bool selected;
+		/** parameter of each column */
+		std::vector<std::string> header;
+		/** cells of each object ordered by column */
+		std::vector<std::vector<cell_t>> rows;
+	};
+	/** sheets read and not written yet */
+	std::vector<sheet_data_t> sheets_data;
+	/** worksheets in workbook order */
+	std::vector<worksheet_t> worksheets;
+	/** worksheets of the xlsx being updated, indexed by name */
+	std::map<std::string, worksheet_t> previous;
+	/** number of the next new sheet file */
+	unsigned int next_file;
+	/** number of sheets kept from the xlsx being updated */
+	unsigned int reused;
+	/** where the dats of the pakset are read from */
+	std::unique_ptr<DatSource> source;
+	/** path of the pakset, used in warnings */
+	std::string root;
+	/** ICU encoding detector, only opened for the first dat that is not UTF-8 */
+	UCharsetDetector *detector;
+	/** directories imported without their subdirectories, empty imports the whole pakset */
+	std::vector<std::string> only_dirs;
 
+	// Time used for reproducible output
+	static std::time_t reproducibleTime();
+	// Add a file to the zip
+	void addToZip(const std::string& name, std::string data);
+	// Set the time of every zip entry
+	void setZipTime(const std::time_t time);
 	// Adds the xml declaration header
 	void addXMLdeclaration(pugi::xml_document& doc);
+	// Check if a string is valid UTF-8
+	static bool isUTF8(const std::string& input);
 	// Converts a string from whatever encoding to UTF-8
 	bool convertToUTF8(const std::string& input, std::stringstream& output);
+	// Load what's needed to update an existing xlsx
+	void loadPrevious();
+	// Signature of the dats of a directory
+	std::string dirSignature(const std::vector<DatSource::entry_t>& dats);
+	// Read the dats of a sheet
+	void createSheet(const std::vector<DatSource::entry_t>& dats, const std::string& dir, const unsigned int index, const bool selected);
+	// Count a use of a string
+	void countString(const std::string& value);
+	// Decide where each string is written
+	void orderStrings();
+	// Add a cell to a row of a sheet
+	void addCell(pugi::xml_node& row_node, const unsigned int column, const unsigned int row, const std::string& value, const bool number, unsigned int& next_column);
 	// Add the sheet file in the zip
-	void createSheet(const std::vector<std::string>& dats, const std::string& dir, const unsigned int index);
-	// Searches a vector and add value if not found
-	unsigned int findInVectorOrAdd(std::vector<std::string>& str_v, const std::string& value);
+	void writeSheet(const sheet_data_t& data);
 	// Iterate over directory to find results
-	void readDir(const std::string& dir_name, unsigned int& index);
+	void readDir(const std::string& dir_name, unsigned int& index, const bool recursive);
 public:
 	// Create an xlsx file
-	Importer(const std::string& filename);
+	Importer(const std::string& filename, const bool update = false);
 	// Destructor to remove sheet from memory
 	~Importer();
+	// Make the output reproducible
+	void setReproducible(const bool enable);
+	// Leave out attributes implied by the position
+	void setCompact(const bool enable);
+	// Only import some directories
+	void setDirs(const std::vector<std::string>& dirs);
+	// Split a pakset in shards
+	static std::vector<std::vector<std::string>> shard(const std::string& root_dir, const unsigned long long max_size);
+	// Name of the file of a shard
+	static std::string shardName(const std::string& filename, const unsigned int number);
+	// Name of the file listing the shards
+	static std::string shardSetName(const std::string& filename);
+	// Check if a value is written as a number
+	static bool isNumber(const std::string& value);
 	// Start importing
 	void import(const std::string& root_dir);
 };
@@ -0,0 +1,210 @@
+#include "keys.hh"
+
+/**
+ * Known keys in canonical order, the index is the id of the key.
+ * Indexed keys like `image[0][1]` are listed without the index.
+ */
+static constexpr std::string_view known_keys[] = {
+	// identification
+	"name", "filename", "obj", "type", "copyright",
+	// timeline
+	"intro_year", "intro_month", "retire_year", "retire_month",
+	// transport
+	"waytype", "own_waytype", "engine_type", "freight", "payload", "overcrowded_capacity", "capacity", "comfort", "loading_time", "min_loading_time", "max_loading_time",
+	// performance and costs
+	"speed", "power", "gear", "tractive_effort", "weight", "axle_load", "length", "cost", "runningcost", "fixed_cost", "maintenance",
+	"brake_force", "rolling_resistance", "air_resistance", "minimum_runway_length", "range", "sound", "smoke", "constraint",
+	// ways and bridges
+	"topspeed", "max_weight", "system_type", "draw_as_ding", "clip_below", "pillar_distance", "pillar_asymmetric", "max_height",
+	// buildings
+	"dims", "level", "enables_pax", "enables_post", "enables_ware", "chance", "climates", "location", "build_time", "extension_building", "allow_underground", "needs_ground", "noinfo", "noconstruction",
+	// goods
+	"value", "catg", "speed_bonus", "weight_per_unit", "metric", "mapcolor",
+	// factories
+	"productivity", "distributionweight", "electricity_boost", "pax_boost", "mail_boost", "pax_demand", "mail_demand",
+	"inputgood", "inputcapacity", "inputsupplier", "inputfactor", "outputgood", "outputcapacity", "outputfactor", "fields",
+	"smoketile", "smokeoffset", "smokespeed", "smokeuplift", "smokelifetime",
+	// signs and signals
+	"offset_left", "single_way", "free_route", "is_signal", "is_presignal", "is_prioritysignal", "is_longblocksignal", "no_foreground",
+	// images
+	"icon", "cursor", "image", "emptyimage", "freightimage", "freightimagetype", "frontimage", "backimage", "frontdiagonal", "backdiagonal",
+	"frontslope", "backslope", "frontimageup", "backimageup", "frontpillar", "backpillar", "frontstart", "backstart", "frontramp", "backramp", "diagonal", "imageup", "imageup2"
+};
+
+const unsigned int DatKeys::COUNT = sizeof(known_keys) / sizeof(known_keys[0]);
+
+/** slots of the hash table, a power of two */
+static constexpr unsigned int KEY_SLOTS = 1024;
+/** seed giving no collisions for the keys above, when keys are
+ * changed and the static_assert fails another one must be found */
+static constexpr unsigned int KEY_SEED = 0x4e1;
+
+/**
+ * @brief Lowercase an ASCII character
+ */
+static constexpr unsigned char lower(const char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+/**
+ * @brief Slot of a key in the hash table
+ *
+ * FNV-1a of the lowercase key with the high bits folded in.
+ */
+static constexpr unsigned int keySlot(const std::string_view key)
+{
+	unsigned int hash = KEY_SEED;
+
+	for (std::string_view::size_type i = 0; i < key.size(); ++i) {
+		hash ^= lower(key[i]);
+		hash *= 16777619u;
+	}
+
+	return (hash ^ (hash >> 16)) & (KEY_SLOTS - 1);
+}
+
+/**
+ * Hash table with the id + 1 of the key in each slot, 0 for
+ * empty slots
+ */
+struct key_table_t {
+	unsigned char slot[KEY_SLOTS];
+	bool perfect;
+
+	constexpr key_table_t() : slot(), perfect(true)
+	{
+		for (unsigned int i = 0; i < sizeof(known_keys) / sizeof(known_keys[0]); ++i) {
+			const unsigned int s = keySlot(known_keys[i]);
+			if (slot[s]) {
+				perfect = false;
+			}
+			slot[s] = i + 1;
+		}
+	}
+};
+
+static constexpr key_table_t key_table;
+static_assert(key_table.perfect, "known dat keys collide, KEY_SEED must be changed");
+static_assert(sizeof(known_keys) / sizeof(known_keys[0]) < 255, "key ids must fit in the table");
+
+/**
+ * @brief Find the id of a known key
+ *
+ * @param key Parameter name, in any case
+ * @param id Receives the id of the key
+ *
+ * @return false if the key is not known
+ */
+bool DatKeys::find(const std::string_view key, unsigned int& id)
+{
+	const unsigned int entry = key_table.slot[keySlot(key)];
+
+	if (entry == 0) {
+		return false;
+	}
+
+	const std::string_view known = known_keys[entry - 1];
+	if (known.size() != key.size()) {
+		return false;
+	}
+	for (std::string_view::size_type i = 0; i < key.size(); ++i) {
+		if (lower(key[i]) != (unsigned char)known[i]) {
+			return false;
+		}
+	}
+
+	id = entry - 1;
+	return true;
+}
+
+/**
+ * @brief Find the id of the group of a key
+ *
+ * The group of `image[0][1]` is `image`, keys without index are
+ * their own group.
+ *
+ * @param key Parameter name, in any case
+ * @param id Receives the id of the group
+ *
+ * @return false if the group is not a known key
+ */
+bool DatKeys::group(const std::string_view key, unsigned int& id)
+{
+	return find(key.substr(0, key.find('[')), id);
+}
+
+/**
+ * @brief Name of a known key
+ *
+ * @param id Id of the key
+ *
+ * @return lowercase name of the key
+ */
+std::string_view DatKeys::name(const unsigned int id)
+{
+	return known_keys[id];
+}
+
+/**
+ * @brief Canonical order of parameter names
+ *
+ * Known keys come first in the order of their ids, keys of the
+ * same group and unknown keys are sorted with numbers compared by
+ * value so `image[2]` comes before `image[10]`.
+ *
+ * @param a Parameter name
+ * @param b Parameter name
+ *
+ * @return true if a comes before b
+ */
+bool DatKeys::before(const std::string& a, const std::string& b)
+{
+	unsigned int group_a = COUNT;
+	unsigned int group_b = COUNT;
+	group(a, group_a);
+	group(b, group_b);
+
+	if (group_a != group_b) {
+		return group_a < group_b;
+	}
+
+	std::string::size_type i = 0;
+	std::string::size_type j = 0;
+
+	while (i < a.size() && j < b.size()) {
+		if (a[i] >= '0' && a[i] <= '9' && b[j] >= '0' && b[j] <= '9') {
+			// compare the whole numbers, ignoring leading zeros
+			while (i < a.size() && a[i] == '0') {
+				++i;
+			}
+			while (j < b.size() && b[j] == '0') {
+				++j;
+			}
+			const std::string::size_type start_a = i;
+			const std::string::size_type start_b = j;
+			while (i < a.size() && a[i] >= '0' && a[i] <= '9') {
+				++i;
+			}
+			while (j < b.size() && b[j] >= '0' && b[j] <= '9') {
+				++j;
+			}
+			if (i - start_a != j - start_b) {
+				return i - start_a < j - start_b;
+			}
+			const int order = a.compare(start_a, i - start_a, b, start_b, j - start_b);
+			if (order != 0) {
+				return order < 0;
+			}
+		}
+		else {
+			if (a[i] != b[j]) {
+				return (unsigned char)a[i] < (unsigned char)b[j];
+			}
+			++i;
+			++j;
+		}
+	}
+
+	return a.size() - i < b.size() - j;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>      // string
+#include <string_view> // string_view
+
+/**
+ * Parameter names known to Simutrans
+ *
+ * Known keys are found with a perfect hash built at compile time
+ * and get a small id, which is also their canonical position so
+ * related parameters end up next to each other. Keys are case
+ * insensitive like in makeobj.
+ */
+class DatKeys
+{
+public:
+	/** ids of the keys handled specially */
+	enum : unsigned int {
+		NAME = 0,
+		FILENAME = 1,
+		OBJ = 2
+	};
+	/** number of known keys, ids of other parameters start here */
+	static const unsigned int COUNT;
+
+	// Find the id of a known key
+	static bool find(const std::string_view key, unsigned int& id);
+	// Find the id of the group of a key
+	static bool group(const std::string_view key, unsigned int& id);
+	// Name of a known key
+	static std::string_view name(const unsigned int id);
+	// Canonical order of parameter names
+	static bool before(const std::string& a, const std::string& b);
+};
@@ -1,14 +1,46 @@
 #include <iostream>     // cout, cerr, clog, left, endl
 #include <iomanip>      // setw
 #include <cstring>      // strncmp
-#include "xlsx.hh"      // XLSX parser
+#include <vector>       // vector
+#include <string>       // string
+#include <sstream>      // ostringstream
+#include <fstream>      // ofstream
+#include <cerrno>       // errno
+#include <mutex>        // mutex, lock_guard
+#include <atomic>       // atomic
+#include <cstdlib>      // strtoul, strtoull
+#include <memory>       // unique_ptr
+#include "workbook.hh"  // XLSX, ODS and CSV parsers
 #include "importer.hh"  // XLSX importer
+#include "threadpool.hh" // ThreadPool, MemoryBudget
+#include "server.hh"    // Server
+#include "verify.hh"    // Verifier
+#include "validate.hh"  // Validator
+#include "query.hh"     // Table, Query
 
 int main(int argc, char const *argv[])
 {
 	int option = 0;
-	int files[256];
+	std::vector<int> files;
 	int num_files = 0;
+	unsigned int jobs = ThreadPool::defaultThreads();
+	unsigned long long memory_limit = 0;
+	std::vector<std::string> sheet_filters;
+	std::vector<std::string> object_filters;
+	std::vector<std::string> variants;
+	std::string socket_path;
+	std::string query_text;
+	bool reproducible = false;
+	bool compact = false;
+	bool update = false;
+	bool shard = false;
+	unsigned long long shard_size = 0;
+	bool validate = false;
+	bool images = false;
+	unsigned int tile_size = 0;
+	bool atomic = false;
+	bool csv = false;
+	DatOutput::durability_t durability = DatOutput::BATCH_SYNC;
 
 	// check passed arguments
 	for (int i = 1; i < argc; ++i) {
@@ -21,39 +53,368 @@ int main(int argc, char const *argv[])
 		else if (!std::strncmp(argv[i], "-i", 3) || !std::strncmp(argv[i], "--import", 9)) {
 			option |= 4;
 		}
+		else if (!std::strncmp(argv[i], "--serve", 8)) {
+			if (++i < argc) {
+				option |= 8;
+				socket_path = argv[i];
+			}
+		}
+		else if (!std::strncmp(argv[i], "-q", 3) || !std::strncmp(argv[i], "--query", 8)) {
+			if (++i < argc) {
+				option |= 32;
+				query_text = argv[i];
+			}
+		}
+		else if (!std::strncmp(argv[i], "--csv", 6)) {
+			csv = true;
+		}
+		else if (!std::strncmp(argv[i], "-u", 3) || !std::strncmp(argv[i], "--update", 9)) {
+			update = true;
+		}
+		else if (!std::strncmp(argv[i], "--shard", 8)) {
+			if (++i < argc) {
+				shard = true;
+				// by directory unless a size is given
+				shard_size = std::strtoull(argv[i], nullptr, 10) * 1024 * 1024;
+			}
+		}
+		else if (!std::strncmp(argv[i], "--reproducible", 15)) {
+			reproducible = true;
+		}
+		else if (!std::strncmp(argv[i], "--compact", 10)) {
+			compact = true;
+		}
+		else if (!std::strncmp(argv[i], "--verify", 9)) {
+			option |= 16;
+		}
+		else if (!std::strncmp(argv[i], "--validate", 11)) {
+			validate = true;
+		}
+		else if (!std::strncmp(argv[i], "--images", 9)) {
+			if (++i < argc) {
+				images = true;
+				tile_size = std::strtoul(argv[i], nullptr, 10);
+			}
+		}
+		else if (!std::strncmp(argv[i], "--atomic", 9)) {
+			atomic = true;
+		}
+		else if (!std::strncmp(argv[i], "--sync", 7)) {
+			if (++i < argc) {
+				if (!std::strncmp(argv[i], "none", 5)) {
+					durability = DatOutput::NO_SYNC;
+				}
+				else if (!std::strncmp(argv[i], "file", 5)) {
+					durability = DatOutput::FILE_SYNC;
+				}
+				else {
+					durability = DatOutput::BATCH_SYNC;
+				}
+			}
+		}
+		else if (!std::strncmp(argv[i], "-s", 3) || !std::strncmp(argv[i], "--sheet", 8)) {
+			if (++i < argc) {
+				sheet_filters.push_back(argv[i]);
+			}
+		}
+		else if (!std::strncmp(argv[i], "-o", 3) || !std::strncmp(argv[i], "--object", 9)) {
+			if (++i < argc) {
+				object_filters.push_back(argv[i]);
+			}
+		}
+		else if (!std::strncmp(argv[i], "--variants", 11)) {
+			if (++i < argc) {
+				// comma separated names
+				std::string list = argv[i];
+				std::string::size_type start = 0;
+				while (start <= list.size()) {
+					std::string::size_type end = list.find(',', start);
+					if (end == std::string::npos) {
+						end = list.size();
+					}
+					if (end > start) {
+						variants.push_back(list.substr(start, end - start));
+					}
+					start = end + 1;
+				}
+			}
+		}
+		else if (!std::strncmp(argv[i], "-j", 3) || !std::strncmp(argv[i], "--jobs", 7)) {
+			if (++i < argc) {
+				jobs = std::strtoul(argv[i], nullptr, 10);
+			}
+		}
+		else if (!std::strncmp(argv[i], "-m", 3) || !std::strncmp(argv[i], "--memory", 9)) {
+			if (++i < argc) {
+				memory_limit = std::strtoull(argv[i], nullptr, 10) * 1024 * 1024;
+			}
+		}
 		else if (argv[i][0] != '-') {
-			files[num_files++] = i;
+			files.push_back(i);
+			num_files++;
 		}
 	}
 
 	// if no arguments were passed and no option was chosen
-	if ((num_files == 0 && option == 0) || (option == 4 && num_files < 2)) {
+	if ((num_files == 0 && !(option & 3)) || ((option & 20) && num_files < 2)) {
 		std::clog << "datSheet : No file error NFN:No file specified!\n";
 		return EXIT_FAILURE;
 	}
 
 	// if --help was seleced
-	if (option > 1 && option != 4) {
-		std::cout << "usage:  datSheet [dir] <file(s)>\n\noptions:\n   " << std::left << std::setw(15) << "-i --import" << "Create sheet file from one directory\n" << std::setw(15) << "-h --help" << "Display this help text\n   " << std::setw(15) << "-V --version" << "Print version\n\nsupported file types: XLSX\n\nproject homepage: <https://github.com/An-dz/datSheet>\n";
+	if (option & 2) {
+		std::cout << "usage:  datSheet [options] [dir] <file(s)>\n\noptions:\n   " << std::left
+			<< std::setw(18) << "-i --import" << "Create sheet file from one directory, tar or zip\n   "
+			<< std::setw(18) << "-u --update" << "Import only directories changed since the last import\n   "
+			<< std::setw(18) << "--shard dirs|MB" << "Import in one file per top directory (dirs) or per MB of\n   " << std::setw(18) << "" << "dats, listed in a .shards file that can be exported\n   "
+			<< std::setw(18) << "--reproducible" << "Import always gives the same file for the same dats,\n   " << std::setw(18) << "" << "time is taken from SOURCE_DATE_EPOCH\n   "
+			<< std::setw(18) << "--compact" << "Import without the cell references implied by the position\n   "
+			<< std::setw(18) << "-s --sheet NAME" << "Only export sheets matching NAME (glob)\n   "
+			<< std::setw(18) << "-o --object NAME" << "Only export dat files matching NAME (glob)\n   "
+			<< std::setw(18) << "--variants LIST" << "Export each variant of LIST (comma separated) in its own\n   " << std::setw(18) << "" << "directory, columns like speed@NAME override for variant NAME\n   "
+			<< std::setw(18) << "-j --jobs N" << "Export up to N files at the same time\n   "
+			<< std::setw(18) << "-m --memory MB" << "Limit memory used by files exported at the same time\n   "
+			<< std::setw(18) << "--serve SOCKET" << "Keep files loaded and answer requests on a unix socket\n   "
+			<< std::setw(18) << "--atomic" << "Replace dats through temporary files so an interrupted\n   " << std::setw(18) << "" << "export never leaves half written dats\n   "
+			<< std::setw(18) << "--sync MODE" << "With --atomic, sync each dat (file), once at the end (batch,\n   " << std::setw(18) << "" << "default) or never (none)\n   "
+			<< std::setw(18) << "-q --query QUERY" << "Print aggregates of the objects instead of exporting, like\n   " << std::setw(18) << "" << "\"max(speed) where obj=vehicle group by waytype\"\n   "
+			<< std::setw(18) << "--csv" << "Print query results as CSV\n   "
+			<< std::setw(18) << "--validate" << "Check objects while exporting, exits with 3 on errors\n   "
+			<< std::setw(18) << "--images SIZE" << "Check the images of exported objects exist and hold the tiles,\n   " << std::setw(18) << "" << "SIZE is the size of a tile, 0 only checks they exist\n   "
+			<< std::setw(18) << "--verify" << "Compare the dats of <file> with [dir] without writing,\n   " << std::setw(18) << "" << "exits with 2 if they differ\n   "
+			<< std::setw(18) << "-h --help" << "Display this help text\n   "
+			<< std::setw(18) << "-V --version" << "Print version\n\nsupported file types: XLSX, ODS, directory of CSV/TSV files (one per sheet)\n\nproject homepage: <https://github.com/An-dz/datSheet>\n";
 		return EXIT_SUCCESS;
 	}
 	// if --version was selected
-	if (option > 0 && option != 4) {
+	if (option & 1) {
 		std::cout << "Simutrans datSheet " << VERSION << "\n   Copyright (c) 2018 Andre' Zanghelini (An_dz)\n   Project homepage: <https://github.com/An-dz/datSheet>\n\nA big thanks to the following libraries:\npugixml <https://pugixml.org>\n   Copyright (c) 2006-2018 Arseny Kapoulkine.\nlibzip <https://libzip.org/>\n   Copyright (c) 1999-2018 Dieter Baron and Thomas Klausner\nlibzip++ <http://hg.markand.fr/libzip>\n   Copyright (c) 2013-2018 David Demelier <markand@malikania.fr>\nICU <http://site.icu-project.org/>\n   Copyright (c) 1991-2018 Unicode, Inc. All rights reserved.\n";
 		return EXIT_SUCCESS;
 	}
 
-	try {
-		if (option == 0) {
+	// shard sets stand for every workbook they list, not when importing or verifying
+	std::vector<std::string> workbooks;
+	if (!(option & 20)) {
+		try {
 			for (int i = 0; i < num_files; ++i) {
-				XLSX xlsx(argv[files[i]]);
-				xlsx.parse();
+				for (auto const& workbook : Workbook::expand(argv[files[i]])) {
+					workbooks.push_back(workbook);
+				}
 			}
+		} catch (const std::runtime_error& e) {
+			std::cerr << "datSheet : error " << e.what() << std::endl;
+			return EXIT_FAILURE;
 		}
-		else {
-			Importer xlsx(argv[files[1]]);
+	}
+
+	// keep the files loaded and answer requests
+	if (option & 8) {
+		try {
+			Server server(socket_path, workbooks);
+			server.run();
+		} catch (const std::runtime_error& e) {
+			std::cerr << "datSheet : error " << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// compare the workbook with a dat tree
+	if (option & 16) {
+		try {
+			Verifier verifier(argv[files[1]]);
+			DatOutput output;
+			output.capture(verifier.generated());
+
+			std::unique_ptr<Workbook> workbook = Workbook::open(argv[files[0]]);
+			workbook->setOutput(output);
+			for (auto const& pattern : sheet_filters) {
+				workbook->filterSheet(pattern);
+			}
+			for (auto const& pattern : object_filters) {
+				workbook->filterObject(pattern);
+			}
+			workbook->parse();
+
+			// with object filters not every dat of the sheet is generated
+			verifier.setDirs(workbook->exportedDirs(), object_filters.empty());
+			if (verifier.verify(jobs)) {
+				return 2;
+			}
+		} catch (const std::runtime_error& e) {
+			std::cerr << "datSheet : error " << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::cout << "Finished without differences.\n";
+		return EXIT_SUCCESS;
+	}
+
+	// load the objects of every file and run the query over all of them
+	if (option & 32) {
+		try {
+			// a wrong query fails before reading anything
+			const Query query(query_text);
+			std::vector<Table> tables(workbooks.size());
+			std::mutex error_mutex;
+			std::string error;
+
+			{
+				ThreadPool pool(workbooks.size() < jobs ? workbooks.size() : jobs);
+
+				for (unsigned int i = 0; i < workbooks.size(); ++i) {
+					pool.run([&, i] {
+						try {
+							std::unique_ptr<Workbook> workbook = Workbook::open(workbooks[i]);
+							workbook->setTable(tables[i]);
+							for (auto const& pattern : sheet_filters) {
+								workbook->filterSheet(pattern);
+							}
+							for (auto const& pattern : object_filters) {
+								workbook->filterObject(pattern);
+							}
+							workbook->parse();
+						} catch (const std::runtime_error& e) {
+							std::lock_guard<std::mutex> lock(error_mutex);
+							error = e.what();
+						}
+					});
+				}
+			}
+
+			if (!error.empty()) {
+				throw std::runtime_error(error);
+			}
+
+			// files are added in the order they were given
+			Table objects;
+			for (auto const& table : tables) {
+				objects.append(table);
+			}
+			query.run(objects, std::cout, csv);
+		} catch (const std::runtime_error& e) {
+			std::cerr << "datSheet : error " << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// export every file in parallel, each one reports on its own
+	if (option == 0) {
+		// warnings are grouped by file when more than one is exported at once
+		const bool grouped = workbooks.size() > 1 && jobs > 1;
+		std::mutex output_mutex;
+		std::atomic<bool> failed(false);
+		MemoryBudget budget(memory_limit);
+		std::unique_ptr<Validator> validator;
+		if (validate || images) {
+			validator.reset(new Validator(jobs, validate));
+			if (images) {
+				validator->enableImages(tile_size);
+			}
+		}
+
+		{
+			ThreadPool pool(workbooks.size() < jobs ? workbooks.size() : jobs);
+
+			for (unsigned int i = 0; i < workbooks.size(); ++i) {
+				const char* filename = workbooks[i].c_str();
+
+				pool.run([&, filename] {
+					std::ostringstream warnings;
+					std::string error;
+
+					try {
+						// declared first so it outlives the workbook using it
+						DatOutput atomic_output;
+						std::unique_ptr<Workbook> workbook = Workbook::open(filename);
+						if (atomic) {
+							atomic_output.setAtomic(durability);
+							workbook->setOutput(atomic_output);
+						}
+						if (grouped) {
+							workbook->setLog(warnings);
+						}
+						if (validator) {
+							workbook->setValidator(*validator);
+						}
+						for (auto const& pattern : sheet_filters) {
+							workbook->filterSheet(pattern);
+						}
+						for (auto const& pattern : object_filters) {
+							workbook->filterObject(pattern);
+						}
+						for (auto const& variant : variants) {
+							workbook->addVariant(variant);
+						}
+
+						const unsigned long long memory = workbook->memoryEstimate();
+						budget.acquire(memory);
+						try {
+							workbook->parse();
+						}
+						catch (...) {
+							budget.release(memory);
+							throw;
+						}
+						budget.release(memory);
+					} catch (const std::runtime_error& e) {
+						error = e.what();
+						failed = true;
+					}
+
+					std::lock_guard<std::mutex> lock(output_mutex);
+					if (grouped && (!warnings.str().empty() || !error.empty())) {
+						std::clog << filename << ":\n" << warnings.str();
+					}
+					if (!error.empty()) {
+						std::cerr << "datSheet : error " << error << std::endl;
+					}
+				});
+			}
+		}
+
+		if (failed) {
+			return EXIT_FAILURE;
+		}
+		if (validator && validator->finish()) {
+			return 3;
+		}
+		std::cout << "Finished without errors.\n";
+		return EXIT_SUCCESS;
+	}
+
+	try {
+		if (!shard) {
+			Importer xlsx(argv[files[1]], update);
+			xlsx.setReproducible(reproducible);
+			xlsx.setCompact(compact);
 			xlsx.import(argv[files[0]]);
 		}
+		else {
+			// each shard is a workbook of its own, the set lists them for exporting
+			const std::string set_name = Importer::shardSetName(argv[files[1]]);
+			std::ostringstream set;
+
+			const std::vector<std::vector<std::string>> shards = Importer::shard(argv[files[0]], shard_size);
+			for (unsigned int i = 0; i < shards.size(); ++i) {
+				const std::string name = Importer::shardName(argv[files[1]], i + 1);
+				Importer xlsx(name, update);
+				xlsx.setReproducible(reproducible);
+				xlsx.setCompact(compact);
+				xlsx.setDirs(shards[i]);
+				xlsx.import(argv[files[0]]);
+				set << name.substr(name.find_last_of("\\/") + 1) << '\n';
+			}
+
+			std::ofstream set_file(set_name);
+			set_file << set.str();
+			if (!set_file) {
+				std::ostringstream err_msg;
+				err_msg << "SHD" << errno << ":Could not write shard set: " << set_name;
+				throw std::runtime_error(err_msg.str());
+			}
+			std::cout << shards.size() << " shards listed in " << set_name << ".\n";
+		}
 		std::cout << "Finished without errors.\n";
 	} catch (const std::runtime_error& e) {
 		std::cerr << "datSheet : error " << e.what() << std::endl;
@@ -0,0 +1,128 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mapped.hh"
+
+/**
+ * @brief Map a file
+ *
+ * The whole file is mapped read-only. Empty files are opened
+ * without a mapping since they can't be mapped, their data is
+ * null and their size 0.
+ *
+ * @param filename Path of the file
+ */
+MappedFile::MappedFile(const std::string& filename) : content(nullptr), length(0), opened(false)
+{
+#ifdef _WIN32
+	mapping = NULL;
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		return;
+	}
+	length = (size_t)size.QuadPart;
+
+	if (length > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			return;
+		}
+		content = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (content == NULL) {
+			return;
+		}
+	}
+#else
+	file = open(filename.c_str(), O_RDONLY);
+	if (file < 0) {
+		return;
+	}
+
+	struct stat info;
+	if (fstat(file, &info) != 0) {
+		return;
+	}
+	length = (size_t)info.st_size;
+
+	if (length > 0) {
+		void* data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data == MAP_FAILED) {
+			return;
+		}
+		content = (const char*)data;
+#ifdef POSIX_MADV_SEQUENTIAL
+		// files are read from start to end
+		posix_madvise(data, length, POSIX_MADV_SEQUENTIAL);
+#endif
+	}
+#endif
+
+	opened = true;
+}
+
+/**
+ * @brief Unmap the file
+ */
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (content != NULL) {
+		UnmapViewOfFile(content);
+	}
+	if (mapping != NULL) {
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+#else
+	if (content != nullptr) {
+		munmap((void*)content, length);
+	}
+	if (file >= 0) {
+		close(file);
+	}
+#endif
+}
+
+/**
+ * @brief Whether the file could be opened and mapped
+ *
+ * @return false if the file does not exist or can't be read
+ */
+bool MappedFile::isOpen() const
+{
+	return opened;
+}
+
+/**
+ * @brief Content of the file
+ *
+ * @return pointer to the first byte, null for empty files
+ */
+const char* MappedFile::data() const
+{
+	return content;
+}
+
+/**
+ * @brief Size of the file in bytes
+ *
+ * @return size of the file
+ */
+size_t MappedFile::size() const
+{
+	return length;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>      // string
+#include <cstddef>     // size_t
+
+/**
+ * Read-only memory map of a whole file
+ *
+ * Pages are only read when touched, so files can be scanned in
+ * place without copying them into a buffer first.
+ */
+class MappedFile
+{
+	/** start of the mapped content, null for empty files */
+	const char* content;
+	/** size of the file in bytes */
+	size_t length;
+	/** whether the file could be opened */
+	bool opened;
+#ifdef _WIN32
+	/** file and mapping handles */
+	void* file;
+	void* mapping;
+#else
+	/** file descriptor */
+	int file;
+#endif
+
+public:
+	// Map a file
+	MappedFile(const std::string& filename);
+	// Unmap the file
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	// Whether the file could be opened and mapped
+	bool isOpen() const;
+	// Content of the file
+	const char* data() const;
+	// Size of the file in bytes
+	size_t size() const;
+};
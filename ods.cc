@@ -0,0 +1,593 @@
+#include <sstream>   // ostringstream
+#include <string>    // string
+#include <charconv>  // from_chars
+#include <algorithm> // min
+#include <cerrno>    // errno
+#include <stdexcept> // runtime_error
+#include "ods.hh"
+
+/** most rows Calc saves in a table, rows repeated beyond it are dropped */
+static const unsigned int MAX_ROWS = 16777216;
+/** most spaces a single text:s element adds */
+static const unsigned int MAX_SPACES = 65536;
+
+/**
+ * @brief Append a character as UTF-8
+ *
+ * @param text Text receiving the character
+ * @param code Unicode code point
+ */
+static void appendUtf8(std::string& text, const unsigned long code)
+{
+	if (code < 0x80) {
+		text += (char)code;
+	}
+	else if (code < 0x800) {
+		text += (char)(0xC0 | (code >> 6));
+		text += (char)(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000) {
+		text += (char)(0xE0 | (code >> 12));
+		text += (char)(0x80 | ((code >> 6) & 0x3F));
+		text += (char)(0x80 | (code & 0x3F));
+	}
+	else {
+		text += (char)(0xF0 | (code >> 18));
+		text += (char)(0x80 | ((code >> 12) & 0x3F));
+		text += (char)(0x80 | ((code >> 6) & 0x3F));
+		text += (char)(0x80 | (code & 0x3F));
+	}
+}
+
+/**
+ * @brief Open an ods file
+ *
+ * An ods file is a zip file just like xlsx, the tables are only
+ * read when parsing.
+ *
+ * @param filename Name of the spreadsheet file
+ */
+ODS::ODS(const std::string& filename) : Workbook(filename)
+{
+	try {
+		// open as read-only
+		archive = new libzippp::ZipArchive(filename);
+		archive->open(libzippp::ZipArchive::ReadOnly);
+	}
+	catch (const std::runtime_error& e) {
+		std::ostringstream err_msg;
+		err_msg << "ZIP" << errno << ":" << e.what() << ": " << filename;
+		// send to main
+		throw std::runtime_error(err_msg.str());
+	}
+}
+
+/**
+ * @brief Destroy object
+ */
+ODS::~ODS()
+{
+	delete archive;
+}
+
+/**
+ * @brief Approximate memory needed to parse the file
+ *
+ * Only content.xml is read and no DOM is built, so this is the
+ * uncompressed size of content.xml.
+ *
+ * @return approximate amount of bytes
+ */
+const unsigned long long ODS::memoryEstimate() const
+{
+	return archive->getEntry("content.xml").getSize();
+}
+
+/**
+ * @brief Find the end of a tag
+ *
+ * Attribute values may hold a `>`, so quotes are followed.
+ *
+ * @param xml Text of the xml
+ * @param pos Position of the `<` starting the tag
+ *
+ * @return position of the `>` ending the tag, npos if the xml
+ * ends before
+ */
+std::string_view::size_type ODS::tagEnd(const std::string_view xml, std::string_view::size_type pos)
+{
+	char quote = 0;
+
+	for (++pos; pos < xml.size(); ++pos) {
+		const char c = xml[pos];
+
+		if (quote) {
+			if (c == quote) {
+				quote = 0;
+			}
+		}
+		else if (c == '"' || c == '\'') {
+			quote = c;
+		}
+		else if (c == '>') {
+			return pos;
+		}
+	}
+
+	return std::string_view::npos;
+}
+
+/**
+ * @brief Check the name of the tag at a position
+ *
+ * Names are compared with the prefixes Calc and every other
+ * OpenDocument writer use, like `table:` and `text:`.
+ *
+ * @param xml Text of the xml
+ * @param pos Position of the `<` starting the tag
+ * @param name Name of the tag, starting with `/` for end tags
+ *
+ * @return true if the tag has exactly this name
+ */
+bool ODS::isTag(const std::string_view xml, const std::string_view::size_type pos, const std::string_view name)
+{
+	const std::string_view::size_type after = pos + 1 + name.size();
+
+	if (after >= xml.size() || xml.compare(pos + 1, name.size(), name) != 0) {
+		return false;
+	}
+
+	const char c = xml[after];
+	return c == '>' || c == '/' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/**
+ * @brief Get the raw value of an attribute
+ *
+ * Attributes are read in order so a value can never be mistaken
+ * for an attribute name.
+ *
+ * @param tag Text between the `<` and `>` of a start tag
+ * @param name Name of the attribute, with its prefix
+ * @param value Receives the value, entities are not replaced
+ *
+ * @return true if the tag has the attribute
+ */
+bool ODS::attribute(const std::string_view tag, const std::string_view name, std::string_view& value)
+{
+	static const char* const SPACE = " \t\n\r";
+	// skip the name of the tag
+	std::string_view::size_type pos = tag.find_first_of(SPACE);
+
+	while (pos != std::string_view::npos && (pos = tag.find_first_not_of(SPACE, pos)) != std::string_view::npos) {
+		const std::string_view::size_type equal = tag.find('=', pos);
+		if (equal == std::string_view::npos) {
+			return false;
+		}
+
+		const std::string_view::size_type open = tag.find_first_of("\"'", equal);
+		if (open == std::string_view::npos) {
+			return false;
+		}
+
+		const std::string_view::size_type close = tag.find(tag[open], open + 1);
+		if (close == std::string_view::npos) {
+			return false;
+		}
+
+		const std::string_view::size_type name_end = tag.find_last_not_of(SPACE, equal - 1);
+		if (tag.substr(pos, name_end + 1 - pos) == name) {
+			value = tag.substr(open + 1, close - open - 1);
+			return true;
+		}
+
+		pos = close + 1;
+	}
+
+	return false;
+}
+
+/**
+ * @brief Get a repeat count attribute
+ *
+ * @param tag Text between the `<` and `>` of a start tag
+ * @param name Name of the attribute
+ * @param limit Largest count returned
+ *
+ * @return the count, 1 if missing or not valid
+ */
+unsigned int ODS::repeatCount(const std::string_view tag, const std::string_view name, const unsigned int limit)
+{
+	std::string_view text;
+	unsigned long long count = 0;
+
+	if (!attribute(tag, name, text) || std::from_chars(text.data(), text.data() + text.size(), count).ec != std::errc() || count == 0) {
+		return 1;
+	}
+
+	return (unsigned int)std::min<unsigned long long>(count, limit);
+}
+
+/**
+ * @brief Replace entities and append the text
+ *
+ * Unknown entities are kept as they are.
+ *
+ * @param raw Text as written in the xml
+ * @param text Receives the decoded text
+ */
+void ODS::decode(const std::string_view raw, std::string& text)
+{
+	std::string_view::size_type pos = 0;
+	std::string_view::size_type amp;
+
+	while ((amp = raw.find('&', pos)) != std::string_view::npos) {
+		text.append(raw, pos, amp - pos);
+
+		const std::string_view::size_type semicolon = raw.find(';', amp);
+		if (semicolon == std::string_view::npos) {
+			pos = amp;
+			break;
+		}
+
+		const std::string_view entity = raw.substr(amp + 1, semicolon - amp - 1);
+		unsigned long code = 0;
+
+		if (entity == "amp") {
+			text += '&';
+		}
+		else if (entity == "lt") {
+			text += '<';
+		}
+		else if (entity == "gt") {
+			text += '>';
+		}
+		else if (entity == "quot") {
+			text += '"';
+		}
+		else if (entity == "apos") {
+			text += '\'';
+		}
+		else if (entity.size() > 2 && entity[0] == '#' && entity[1] == 'x' && std::from_chars(entity.data() + 2, entity.data() + entity.size(), code, 16).ptr == entity.data() + entity.size() && code <= 0x10FFFF) {
+			appendUtf8(text, code);
+		}
+		else if (entity.size() > 1 && entity[0] == '#' && std::from_chars(entity.data() + 1, entity.data() + entity.size(), code).ptr == entity.data() + entity.size() && code <= 0x10FFFF) {
+			appendUtf8(text, code);
+		}
+		else {
+			text.append(raw, amp, semicolon + 1 - amp);
+		}
+
+		pos = semicolon + 1;
+	}
+
+	text.append(raw, std::min(pos, raw.size()), std::string_view::npos);
+}
+
+/**
+ * @brief Get the text of the paragraphs of a cell
+ *
+ * Paragraphs are joined with line breaks, spaces, tabs and line
+ * breaks written as elements are expanded and comments are left
+ * out.
+ *
+ * @param content Text between the start and end tags of the cell
+ *
+ * @return the text, only valid until the next value is read
+ */
+std::string_view ODS::paragraphs(const std::string_view content)
+{
+	std::string_view::size_type pos = 0;
+	std::string_view::size_type open;
+	bool paragraph = false;
+	bool first = true;
+
+	value_buffer.clear();
+
+	while ((open = content.find('<', pos)) != std::string_view::npos) {
+		// only text inside paragraphs is kept, not the indentation between them
+		if (paragraph) {
+			decode(content.substr(pos, open - pos), value_buffer);
+		}
+
+		const std::string_view::size_type close = tagEnd(content, open);
+		if (close == std::string_view::npos) {
+			return value_buffer;
+		}
+		pos = close + 1;
+
+		if (isTag(content, open, "text:p") || isTag(content, open, "text:h")) {
+			if (!first) {
+				value_buffer += '\n';
+			}
+			first = false;
+			paragraph = content[close - 1] != '/';
+		}
+		else if (isTag(content, open, "/text:p") || isTag(content, open, "/text:h")) {
+			paragraph = false;
+		}
+		else if (!paragraph) {
+			// comments have paragraphs of their own
+			if (isTag(content, open, "office:annotation") && content[close - 1] != '/') {
+				const std::string_view::size_type end = content.find("</office:annotation>", pos);
+				if (end == std::string_view::npos) {
+					return value_buffer;
+				}
+				pos = end;
+			}
+		}
+		else if (isTag(content, open, "text:s")) {
+			value_buffer.append(repeatCount(content.substr(open + 1, close - open - 1), "text:c", MAX_SPACES), ' ');
+		}
+		else if (isTag(content, open, "text:tab")) {
+			value_buffer += '\t';
+		}
+		else if (isTag(content, open, "text:line-break")) {
+			value_buffer += '\n';
+		}
+	}
+
+	if (paragraph) {
+		decode(content.substr(pos), value_buffer);
+	}
+
+	return value_buffer;
+}
+
+/**
+ * @brief Get the value of a cell
+ *
+ * Numbers, dates and booleans come from their office attribute,
+ * so they are the value and not the formatted text, like in xlsx.
+ * Formulas are not recomputed, their saved value is used. Values
+ * without entities point into the xml and are not copied.
+ *
+ * @param cell Cell with a value type
+ *
+ * @return the value as text, only valid until the next call
+ */
+std::string_view ODS::cellValue(const cell_t& cell)
+{
+	std::string_view type;
+	std::string_view raw;
+	attribute(cell.tag, "office:value-type", type);
+
+	if (type == "string") {
+		if (!attribute(cell.tag, "office:string-value", raw)) {
+			return paragraphs(cell.content);
+		}
+	}
+	else if (type == "boolean") {
+		attribute(cell.tag, "office:boolean-value", raw);
+	}
+	else if (type == "date") {
+		attribute(cell.tag, "office:date-value", raw);
+	}
+	else if (type == "time") {
+		attribute(cell.tag, "office:time-value", raw);
+	}
+	else {
+		// float, percentage and currency
+		attribute(cell.tag, "office:value", raw);
+	}
+
+	if (raw.find('&') == std::string_view::npos) {
+		return raw;
+	}
+
+	value_buffer.clear();
+	decode(raw, value_buffer);
+	return value_buffer;
+}
+
+/**
+ * @brief Collect the cells of a row
+ *
+ * Only cells with a value are kept, cells repeated over several
+ * columns are kept once with their count.
+ *
+ * @param xml Text of the xml
+ * @param pos Position after the start tag of the row
+ *
+ * @return position after the end tag of the row
+ */
+std::string_view::size_type ODS::readRow(const std::string_view xml, std::string_view::size_type pos)
+{
+	unsigned int column = 0;
+
+	row_cells.clear();
+
+	while ((pos = xml.find('<', pos)) != std::string_view::npos) {
+		const std::string_view::size_type close = tagEnd(xml, pos);
+		if (close == std::string_view::npos) {
+			break;
+		}
+
+		if (isTag(xml, pos, "/table:table-row")) {
+			return close + 1;
+		}
+
+		const bool covered = isTag(xml, pos, "table:covered-table-cell");
+		if (!covered && !isTag(xml, pos, "table:table-cell")) {
+			pos = close + 1;
+			continue;
+		}
+
+		const std::string_view tag = xml.substr(pos + 1, close - pos - 1);
+		const unsigned int repeat = repeatCount(tag, "table:number-columns-repeated", CellRef::MAX_COLUMNS);
+		std::string_view content;
+		std::string_view type;
+
+		pos = close + 1;
+		if (xml[close - 1] != '/') {
+			const std::string_view end_tag = (covered ? "</table:covered-table-cell>" : "</table:table-cell>");
+			const std::string_view::size_type end = std::min(xml.find(end_tag, pos), xml.size());
+			content = xml.substr(pos, end - pos);
+			pos = std::min(end + end_tag.size(), xml.size());
+		}
+
+		// cells without a type are empty, whatever their count
+		if (column < CellRef::MAX_COLUMNS && attribute(tag, "office:value-type", type)) {
+			row_cells.push_back(cell_t{column, std::min(repeat, CellRef::MAX_COLUMNS - column), tag, content});
+		}
+		column = std::min(column + repeat, CellRef::MAX_COLUMNS);
+	}
+
+	return xml.size();
+}
+
+/**
+ * @brief Create the dats of one table
+ *
+ * The first row holds the parameter names, every other row with
+ * a value in column A is an object. A row repeated several times
+ * is decoded once and its dat written for each of them, empty
+ * rows only move the row number.
+ *
+ * @param xml Text of the xml
+ * @param pos Position after the start tag of the table
+ * @param sheet_nr Internal number of the sheet
+ *
+ * @return position after the end tag of the table
+ */
+std::string_view::size_type ODS::parseTable(const std::string_view xml, std::string_view::size_type pos, const unsigned int sheet_nr)
+{
+	Schema schema;
+	std::string last_filename;
+	unsigned int row = 0;
+
+	while ((pos = xml.find('<', pos)) != std::string_view::npos) {
+		const std::string_view::size_type close = tagEnd(xml, pos);
+		if (close == std::string_view::npos) {
+			break;
+		}
+
+		if (isTag(xml, pos, "/table:table")) {
+			return close + 1;
+		}
+
+		// rows may be inside header rows and groups, which are ignored
+		if (!isTag(xml, pos, "table:table-row")) {
+			pos = close + 1;
+			continue;
+		}
+
+		const unsigned int repeat = repeatCount(xml.substr(pos + 1, close - pos - 1), "table:number-rows-repeated", MAX_ROWS);
+		if (xml[close - 1] == '/') {
+			row_cells.clear();
+			pos = close + 1;
+		}
+		else {
+			pos = readRow(xml, close + 1);
+		}
+
+		unsigned int first = row + 1;
+		unsigned int count = std::min(repeat, MAX_ROWS - row);
+		row += count;
+
+		// paramater names are in the first row
+		if (first == 1 && count > 0) {
+			for (auto const& cell : row_cells) {
+				const std::string_view value = cellValue(cell);
+				for (unsigned int column = cell.column; column < cell.column + cell.repeat; ++column) {
+					headerCell(schema, column, value);
+				}
+			}
+			first++;
+			count--;
+		}
+
+		// rows without column A are not objects
+		if (count == 0 || row_cells.empty() || row_cells.front().column != 0) {
+			continue;
+		}
+
+		startDat();
+
+		for (auto const& cell : row_cells) {
+			std::string_view value;
+			bool decoded = false;
+
+			for (unsigned int column = cell.column; column < cell.column + cell.repeat; ++column) {
+				// value of columns without parameter is never read
+				if (schema.action(column) == Schema::SKIP) {
+					continue;
+				}
+				if (!decoded) {
+					value = cellValue(cell);
+					decoded = true;
+				}
+				if (!value.empty()) {
+					addValue(schema, column, value);
+				}
+			}
+		}
+
+		for (unsigned int i = 0; i < count; ++i) {
+			finishDat(sheet_nr, first + i, last_filename);
+		}
+	}
+
+	return xml.size();
+}
+
+/**
+ * @brief Parse every table
+ *
+ * Tables are added as sheets while content.xml is scanned, tables
+ * not selected are skipped without looking at their rows.
+ */
+void ODS::readSheets()
+{
+	std::string xml_data;
+
+	try {
+		libzippp::ZipEntry entry = archive->getEntry("content.xml");
+		if (entry.isNull()) {
+			throw std::runtime_error("File not found");
+		}
+		xml_data = entry.readAsText();
+	}
+	catch (const std::runtime_error& e) {
+		std::ostringstream err_msg;
+		err_msg << "ZIP" << errno << ":" << e.what() << ": content.xml";
+		// send to main
+		throw std::runtime_error(err_msg.str());
+	}
+
+	const std::string_view xml(xml_data);
+	std::string_view::size_type pos = 0;
+
+	while ((pos = xml.find("<table:table", pos)) != std::string_view::npos) {
+		const std::string_view::size_type close = tagEnd(xml, pos);
+		if (close == std::string_view::npos) {
+			break;
+		}
+
+		// also found at table:table-row and others
+		if (!isTag(xml, pos, "table:table")) {
+			pos = close + 1;
+			continue;
+		}
+
+		std::string_view raw_name;
+		std::string name;
+		attribute(xml.substr(pos + 1, close - pos - 1), "table:name", raw_name);
+		decode(raw_name, name);
+		addSheet(name, "content.xml");
+
+		const unsigned int sheet_nr = sheets_v.size() - 1;
+		pos = close + 1;
+
+		if (xml[close - 1] == '/') {
+			continue;
+		}
+
+		if (!sheetSelected(sheet_nr)) {
+			pos = xml.find("</table:table>", pos);
+			continue;
+		}
+
+		pos = parseTable(xml, pos, sheet_nr);
+	}
+}
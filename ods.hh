@@ -0,0 +1,67 @@
+#pragma once
+#include <string>      // string
+#include <string_view> // string_view
+#include <vector>      // vector
+#include <libzippp\libzippp.h>     // libzip++
+#include "schema.hh"   // Schema
+#include "workbook.hh" // Workbook
+
+/**
+ * Parser for OpenDocument ods spreadsheets
+ *
+ * Every table is in content.xml, which is scanned once from start
+ * to end without building a DOM. Cells and rows repeated with
+ * number-columns-repeated and number-rows-repeated are decoded once,
+ * so the thousands of empty rows and columns Calc saves at the end
+ * of a table cost nothing. Formulas are exported with the value
+ * saved in the file.
+ */
+class ODS : public Workbook
+{
+	/** pointer to the loaded ods file */
+	libzippp::ZipArchive *archive;
+	/** a cell with a value, pointing into content.xml */
+	struct cell_t {
+		/** first column, zero based */
+		unsigned int column;
+		/** number of columns it is repeated in */
+		unsigned int repeat;
+		/** between the < and > of the start tag */
+		std::string_view tag;
+		/** between the start and end tags, empty if self closing */
+		std::string_view content;
+	};
+	/** cells of the row being read, reused by every row */
+	std::vector<cell_t> row_cells;
+	/** decoded value of the last cell read */
+	std::string value_buffer;
+
+	// Find the end of a tag
+	static std::string_view::size_type tagEnd(const std::string_view xml, std::string_view::size_type pos);
+	// Check the name of the tag at a position
+	static bool isTag(const std::string_view xml, const std::string_view::size_type pos, const std::string_view name);
+	// Get the raw value of an attribute
+	static bool attribute(const std::string_view tag, const std::string_view name, std::string_view& value);
+	// Get a repeat count attribute
+	static unsigned int repeatCount(const std::string_view tag, const std::string_view name, const unsigned int limit);
+	// Replace entities and append the text
+	static void decode(const std::string_view raw, std::string& text);
+	// Get the text of the paragraphs of a cell
+	std::string_view paragraphs(const std::string_view content);
+	// Get the value of a cell
+	std::string_view cellValue(const cell_t& cell);
+	// Collect the cells of a row
+	std::string_view::size_type readRow(const std::string_view xml, std::string_view::size_type pos);
+	// Create the dats of one table
+	std::string_view::size_type parseTable(const std::string_view xml, std::string_view::size_type pos, const unsigned int sheet_nr);
+	// Parse every table
+	void readSheets() override;
+
+public:
+	// Open an ods file
+	ODS(const std::string& filename);
+	// Destructor
+	~ODS();
+	// Approximate memory needed to parse the file
+	const unsigned long long memoryEstimate() const override;
+};
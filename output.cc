@@ -0,0 +1,723 @@
+#include <utility>   // move
+#include <set>       // set
+#include <sys/types.h>
+#include <sys/stat.h>  // mkdirat
+
+#ifdef _WIN32
+#include <fstream>   // ofstream
+#include <cstdio>      // remove
+#include <iterator>    // istreambuf_iterator
+#include <windows.h>   // CreateDirectoryA, MoveFileExA
+#else
+#include <fcntl.h>     // openat
+#include <unistd.h>    // write, close, fsync, syncfs, unlink
+#include <cerrno>      // errno
+#include <cstdio>      // renameat, rename, remove
+#endif
+
+#include "output.hh"
+
+/**
+ * @brief Write dats on disk
+ */
+DatOutput::DatOutput() : memory(nullptr), atomic(false), durability(BATCH_SYNC), busy(false), flushing(false), stopping(false)
+{
+	pending.open = false;
+}
+
+/**
+ * @brief Write what is still queued and stop the writer
+ */
+DatOutput::~DatOutput()
+{
+	if (writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cv.notify_all();
+		writer.join();
+	}
+
+#ifndef _WIN32
+	for (auto const& dir : open_dirs) {
+		close(dirs[dir].dir.fd);
+	}
+#endif
+}
+
+/**
+ * @brief Keep dats in memory
+ *
+ * Nothing is written on disk anymore, every dat is stored in the
+ * map with its path, including the extension, as key.
+ *
+ * @param dats Map that will receive the dats
+ */
+void DatOutput::capture(std::map<std::string, std::string>& dats)
+{
+	memory = &dats;
+}
+
+/**
+ * @brief Replace dats atomically
+ *
+ * Each dat is written to a hidden temporary file next to it and
+ * renamed over the old one once complete, so after a crash a dat
+ * is either the old one or the new one. Objects appended to the
+ * same dat are added to the temporary file before it is renamed.
+ *
+ * @param sync What is synced so renamed dats survive a crash
+ */
+void DatOutput::setAtomic(const durability_t sync)
+{
+	atomic = true;
+	durability = sync;
+}
+
+/**
+ * @brief Write a dat file
+ *
+ * Dats going to disk are only queued, errors writing them are
+ * returned by flush(). When the queue is full this waits for the
+ * writer to take a dat.
+ *
+ * @param filenames Name of the file without extension
+ * @param dat_stream String containing the whole dat file
+ * @param append Whether it should append to existing file, if not it overwrites
+ * @param sheet Sheet of the dat, only given back in failures
+ * @param row Row of the dat, only given back in failures
+ *
+ * @return 0 if no errors
+ * @return 1 if no filename was provided
+ */
+const unsigned int DatOutput::write(const std::string& filenames, const std::string& dat_stream, const bool append, const unsigned int sheet, const unsigned int row)
+{
+	int i = 0;
+	while (filenames[i] == '/') i++;
+	std::string filename = filenames.c_str() + i;
+
+	if (filename.length() == 0 || filename.back() == '/') {
+		return 1;
+	}
+
+	if (memory) {
+		std::string& dat = (*memory)[filename + ".dat"];
+
+		if (append) {
+			dat.append("---\n");
+		}
+		else {
+			dat.clear();
+		}
+		dat.append(dat_stream);
+		return 0;
+	}
+
+	job_t job{std::move(filename), std::string(), append, sheet, row};
+	if (append) {
+		job.dat.reserve(dat_stream.size() + 4);
+		job.dat.append("---\n");
+	}
+	job.dat.append(dat_stream);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (!writer.joinable()) {
+		writer = std::thread(&DatOutput::work, this);
+	}
+	cv.wait(lock, [this] { return jobs.size() < QUEUE_SIZE; });
+	jobs.push_back(std::move(job));
+	lock.unlock();
+	cv.notify_all();
+
+	return 0;
+}
+
+/**
+ * @brief Wait until every dat is written
+ *
+ * @return dats that could not be written since the last flush, in
+ * the order they were queued
+ */
+std::vector<DatOutput::failure_t> DatOutput::flush()
+{
+	std::vector<failure_t> result;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	if (writer.joinable()) {
+		flushing = true;
+		cv.notify_all();
+		cv.wait(lock, [this] { return jobs.empty() && !busy && !flushing; });
+	}
+	result.swap(failures);
+
+	return result;
+}
+
+/**
+ * @brief Writer thread loop
+ *
+ * Dats are taken in the order they were queued, so a dat always
+ * exists by the time the objects appended to it are written. Once
+ * the queue is empty and a flush or stop is asked for, writes are
+ * finished before anyone looks at the files.
+ */
+void DatOutput::work()
+{
+	for (;;) {
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [this] { return stopping || flushing || !jobs.empty(); });
+
+		if (jobs.empty()) {
+			busy = true;
+			lock.unlock();
+
+			finishWrites();
+
+			lock.lock();
+			busy = false;
+			flushing = false;
+			const bool stop = stopping;
+			lock.unlock();
+			cv.notify_all();
+
+			if (stop) {
+				return;
+			}
+			continue;
+		}
+
+		const job_t job = std::move(jobs.front());
+		jobs.pop_front();
+		busy = true;
+		lock.unlock();
+		cv.notify_all();
+
+		const unsigned int code = writeFile(job);
+
+		lock.lock();
+		if (code != 0) {
+			failures.push_back(failure_t{code, job.sheet, job.row, job.filename});
+		}
+		busy = false;
+		lock.unlock();
+		cv.notify_all();
+	}
+}
+
+/**
+ * @brief Name of a dat without empty and . components
+ *
+ * Names of the same dat written in different ways give the same
+ * name, so its place in the batch is found.
+ *
+ * @param filename Name of the dat
+ *
+ * @return the name with only the components that matter
+ */
+static std::string cleanName(const std::string& filename)
+{
+	std::string result;
+	std::string::size_type start = 0;
+
+	while (start <= filename.size()) {
+		std::string::size_type end = filename.find('/', start);
+		if (end == std::string::npos) {
+			end = filename.size();
+		}
+		if (end > start && filename.compare(start, end - start, ".") != 0) {
+			result += (result.empty() ? "" : "/") + filename.substr(start, end - start);
+		}
+		start = end + 1;
+	}
+
+	return result;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Write a whole buffer to a file
+ *
+ * @param file Descriptor of the file
+ * @param data Data to be written
+ * @param size Size of the data
+ *
+ * @return false if writing failed
+ */
+static bool writeAll(const int file, const char* data, std::string::size_type size)
+{
+	while (size > 0) {
+		const ssize_t written = ::write(file, data, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Sync a file or a directory already closed
+ *
+ * A directory is synced so the files renamed in it stay renamed.
+ *
+ * @param path Path of the file or directory
+ * @return True if it is on disk, false otherwise
+ */
+static bool syncPath(const std::string& path)
+{
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	const bool synced = fsync(fd) == 0;
+	return close(fd) == 0 && synced;
+}
+#endif
+
+/**
+ * @brief Get a directory, creating it if missing
+ *
+ * Parents are handled first, so each directory costs at most one
+ * mkdir and is then opened once. Files and sub-directories are
+ * opened relative to its descriptor, without resolving the whole
+ * path again. Only the most recently used directories are kept
+ * open, the others are opened again when they come back.
+ *
+ * @param dir Path of the directory, relative to the output root
+ *
+ * @return the directory, exists is false if it could not be created
+ */
+DatOutput::dir_t DatOutput::openDir(const std::string& dir)
+{
+#ifdef _WIN32
+	const dir_t root{-1, true};
+#else
+	const dir_t root{AT_FDCWD, true};
+#endif
+
+	if (dir.empty()) {
+		return root;
+	}
+
+	const auto known = dirs.find(dir);
+#ifdef _WIN32
+	if (known != dirs.end()) {
+		return known->second.dir;
+	}
+#else
+	if (known != dirs.end() && known->second.dir.fd >= 0) {
+		open_dirs.splice(open_dirs.begin(), open_dirs, known->second.use);
+		return known->second.dir;
+	}
+	// one closed to leave room for others is opened again below
+	if (known != dirs.end() && (known->second.dir.fd != -1 || !known->second.dir.exists)) {
+		return known->second.dir;
+	}
+#endif
+
+	const std::string::size_type slash = dir.rfind('/');
+	const dir_t parent = (slash == std::string::npos ? root : openDir(dir.substr(0, slash)));
+	const std::string name = dir.substr(slash == std::string::npos ? 0 : slash + 1);
+
+	// empty and . components are the parent itself, not kept apart
+	// so each descriptor belongs to a single directory
+	if (!parent.exists || name.empty() || name == ".") {
+		return parent;
+	}
+
+	dir_t result{-1, false};
+#ifdef _WIN32
+	const DWORD attributes = (CreateDirectoryA(dir.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS) ? GetFileAttributesA(dir.c_str()) : INVALID_FILE_ATTRIBUTES;
+	result.exists = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	// without a descriptor of the parent the path is relative to the current directory
+	const std::string path = (parent.fd == AT_FDCWD ? dir : name);
+
+	if (known != dirs.end() || mkdirat(parent.fd, path.c_str(), 0755) == 0 || errno == EEXIST) {
+		closeDirs();
+		result.fd = openat(parent.fd, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		result.exists = true;
+
+		if (result.fd < 0) {
+			// a file with the name of the directory, otherwise out of descriptors
+			result.exists = !(errno == ENOTDIR || errno == ENOENT || errno == EACCES);
+			result.fd = AT_FDCWD;
+		}
+	}
+#endif
+
+	known_dir_t& entry = dirs[dir];
+	entry.dir = result;
+#ifndef _WIN32
+	if (result.fd >= 0) {
+		open_dirs.push_front(dir);
+		entry.use = open_dirs.begin();
+	}
+#endif
+
+	return result;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Close directories until another one can be opened
+ *
+ * The least recently used are closed first, the directory of the
+ * pending dat is never closed.
+ */
+void DatOutput::closeDirs()
+{
+	auto oldest = open_dirs.end();
+
+	while (open_dirs.size() >= MAX_OPEN_DIRS && oldest != open_dirs.begin()) {
+		--oldest;
+		dir_t& old = dirs[*oldest].dir;
+		if (pending.open && old.fd == pending.dir.fd) {
+			continue;
+		}
+		close(old.fd);
+		old.fd = -1;
+		oldest = open_dirs.erase(oldest);
+	}
+}
+#endif
+
+/**
+ * @brief Write one dat on disk
+ *
+ * Missing directories are created, files in a directory that
+ * could not be created fail without trying to open them.
+ *
+ * @param job Dat to be written
+ *
+ * @return 0 if no errors
+ * @return 2 if file could not be opened
+ * @return 3 if writing failed
+ */
+unsigned int DatOutput::writeFile(const job_t& job)
+{
+	const std::string::size_type slash = job.filename.rfind('/');
+	const dir_t dir = openDir(slash == std::string::npos ? std::string() : job.filename.substr(0, slash));
+
+	if (!dir.exists) {
+		return 2;
+	}
+
+	if (atomic) {
+		return writeAtomic(job);
+	}
+
+#ifdef _WIN32
+	const std::string path = job.filename + ".dat";
+
+	// open file replacing if it already exists
+	std::ofstream dat_file(path, (job.append ? std::ios::app : std::ios::trunc));
+
+	if (!dat_file.is_open()) {
+		return 2;
+	}
+
+	dat_file.write(job.dat.data(), job.dat.size());
+	dat_file.close();
+
+	return dat_file.fail() ? 3 : 0;
+#else
+	const std::string path = (dir.fd == AT_FDCWD ? job.filename : job.filename.substr(slash + 1)) + ".dat";
+
+	// open file replacing if it already exists
+	const int file = openat(dir.fd, path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (job.append ? O_APPEND : O_TRUNC), 0644);
+
+	if (file < 0) {
+		return 2;
+	}
+
+	bool failed = !writeAll(file, job.dat.data(), job.dat.size());
+
+	if (close(file) != 0) {
+		failed = true;
+	}
+
+	return failed ? 3 : 0;
+#endif
+}
+
+/**
+ * @brief Write one dat to a temporary file
+ *
+ * The temporary file stays open while the next dats append to it,
+ * it is only renamed over the dat when another one comes. When
+ * appending to a dat that is not pending the existing dat is
+ * copied first, so the rename never loses objects.
+ *
+ * @param job Dat to be written, its directory already exists
+ *
+ * @return 0 if no errors, writing errors are reported when renaming
+ * @return 2 if file could not be opened
+ */
+unsigned int DatOutput::writeAtomic(const job_t& job)
+{
+	if (pending.open && (job.filename != pending.filename || !job.append)) {
+		commitPending();
+	}
+
+	if (pending.open) {
+		if (!writePending(job.dat.data(), job.dat.size())) {
+			pending.failed = true;
+		}
+		return 0;
+	}
+
+	const std::string::size_type slash = job.filename.rfind('/');
+	const std::string::size_type base = (slash == std::string::npos ? 0 : slash + 1);
+	pending.dir = openDir(job.filename.substr(0, base == 0 ? 0 : slash));
+
+#ifdef _WIN32
+	const std::string prefix = job.filename.substr(0, base);
+#else
+	// without a descriptor of the directory names are relative to the current directory
+	const std::string prefix = (pending.dir.fd == AT_FDCWD ? job.filename.substr(0, base) : std::string());
+#endif
+	// hidden and not ending in .dat so nothing else ever takes it for a dat
+	pending.target = prefix + job.filename.substr(base) + ".dat";
+	pending.temp = prefix + "." + job.filename.substr(base) + ".dat.tmp";
+
+	bool failed = false;
+	std::string previous;
+	// a dat of the batch is still in its temporary file, which is
+	// where appended objects go and what is replaced otherwise
+	const bool batched = renames.erase(cleanName(job.filename)) != 0;
+	const std::string& old_name = (batched ? pending.temp : pending.target);
+
+#ifdef _WIN32
+	if (job.append) {
+		std::ifstream old_file(old_name);
+		if (old_file.is_open()) {
+			previous.assign(std::istreambuf_iterator<char>(old_file), std::istreambuf_iterator<char>());
+			failed = old_file.bad();
+		}
+	}
+
+	pending.stream.open(pending.temp, std::ios::trunc);
+	if (!pending.stream.is_open()) {
+		return 2;
+	}
+#else
+	if (job.append) {
+		const int old_file = openat(pending.dir.fd, old_name.c_str(), O_RDONLY | O_CLOEXEC);
+		if (old_file >= 0) {
+			char buffer[65536];
+			for (;;) {
+				const ssize_t got = read(old_file, buffer, sizeof(buffer));
+				if (got < 0 && errno == EINTR) {
+					continue;
+				}
+				if (got <= 0) {
+					failed = got < 0;
+					break;
+				}
+				previous.append(buffer, got);
+			}
+			close(old_file);
+		}
+		else if (errno != ENOENT) {
+			failed = true;
+		}
+	}
+
+	pending.fd = openat(pending.dir.fd, pending.temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (pending.fd < 0) {
+		return 2;
+	}
+#endif
+
+	pending.open = true;
+	pending.filename = job.filename;
+	pending.sheet = job.sheet;
+	pending.row = job.row;
+	pending.failed = failed || !writePending(previous.data(), previous.size()) || !writePending(job.dat.data(), job.dat.size());
+
+	return 0;
+}
+
+/**
+ * @brief Add data to the temporary file
+ *
+ * @param data Data to be written
+ * @param size Size of the data
+ *
+ * @return false if writing failed
+ */
+bool DatOutput::writePending(const char* data, std::string::size_type size)
+{
+#ifdef _WIN32
+	pending.stream.write(data, size);
+	return !pending.stream.fail();
+#else
+	return writeAll(pending.fd, data, size);
+#endif
+}
+
+/**
+ * @brief Rename the temporary file into place
+ *
+ * If anything went wrong the temporary file is removed and the
+ * old dat is left untouched. When syncing by batch the temporary
+ * file only joins the batch, it's renamed by commitBatch().
+ */
+void DatOutput::commitPending()
+{
+	if (!pending.open) {
+		return;
+	}
+	pending.open = false;
+
+	bool failed = pending.failed;
+
+#ifdef _WIN32
+	pending.stream.close();
+	failed = failed || pending.stream.fail();
+	pending.stream.clear();
+#else
+	if (durability == FILE_SYNC && fsync(pending.fd) != 0) {
+		failed = true;
+	}
+	if (close(pending.fd) != 0) {
+		failed = true;
+	}
+#endif
+
+	if (!failed && durability == BATCH_SYNC) {
+		const std::string::size_type slash = pending.filename.rfind('/');
+		const std::string dir = (slash == std::string::npos ? std::string() : pending.filename.substr(0, slash + 1));
+		const std::string name = pending.filename.substr(slash == std::string::npos ? 0 : slash + 1);
+
+		renames[cleanName(pending.filename)] = rename_t{dir + "." + name + ".dat.tmp", dir + name + ".dat", (dir.empty() ? std::string(".") : dir), pending.sheet, pending.row};
+		return;
+	}
+
+#ifdef _WIN32
+	const DWORD flags = MOVEFILE_REPLACE_EXISTING | (durability == FILE_SYNC ? MOVEFILE_WRITE_THROUGH : 0);
+	if (failed || !MoveFileExA(pending.temp.c_str(), pending.target.c_str(), flags)) {
+		std::remove(pending.temp.c_str());
+		failed = true;
+	}
+#else
+	if (failed || renameat(pending.dir.fd, pending.temp.c_str(), pending.dir.fd, pending.target.c_str()) != 0) {
+		unlinkat(pending.dir.fd, pending.temp.c_str(), 0);
+		failed = true;
+	}
+	else if (durability == FILE_SYNC) {
+		// the rename itself is only durable once the directory is synced
+		if (pending.dir.fd != AT_FDCWD) {
+			failed = fsync(pending.dir.fd) != 0;
+		}
+		else {
+			const std::string::size_type slash = pending.target.rfind('/');
+			failed = !syncPath(slash == std::string::npos ? "." : pending.target.substr(0, slash));
+		}
+	}
+#endif
+
+	if (failed) {
+		std::lock_guard<std::mutex> lock(mutex);
+		failures.push_back(failure_t{3, pending.sheet, pending.row, pending.filename});
+	}
+}
+
+/**
+ * @brief Rename the dats of the batch once they are on disk
+ *
+ * Every temporary file is synced before the first one replaces a
+ * dat, so after a crash a dat is never renamed without its data.
+ * If that sync fails none of them is renamed. The directories are
+ * synced after, for the renames themselves.
+ */
+void DatOutput::commitBatch()
+{
+	if (renames.empty()) {
+		return;
+	}
+
+#ifndef _WIN32
+	bool synced = true;
+	bool synced_all = false;
+#ifdef __linux__
+	// only the file system holding the dats
+	const int root = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (root >= 0) {
+		synced = syncfs(root) == 0;
+		synced_all = true;
+		close(root);
+	}
+#endif
+	// sync() cannot report errors, each file is synced instead
+	for (auto dat = renames.cbegin(); !synced_all && synced && dat != renames.cend(); ++dat) {
+		synced = syncPath(dat->second.temp);
+	}
+
+	// nothing is renamed unless all the data is known to be on disk
+	if (!synced) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto const& dat : renames) {
+			unlink(dat.second.temp.c_str());
+			failures.push_back(failure_t{3, dat.second.sheet, dat.second.row, dat.first});
+		}
+		renames.clear();
+		return;
+	}
+#endif
+
+	std::set<std::string> renamed_dirs;
+	for (auto const& dat : renames) {
+		bool failed;
+#ifdef _WIN32
+		// no sync of the whole volume, each file is flushed instead
+		const HANDLE file = CreateFileA(dat.second.temp.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		failed = file == INVALID_HANDLE_VALUE || !FlushFileBuffers(file);
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+		}
+		failed = failed || !MoveFileExA(dat.second.temp.c_str(), dat.second.target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+		failed = std::rename(dat.second.temp.c_str(), dat.second.target.c_str()) != 0;
+#endif
+
+		if (failed) {
+			std::remove(dat.second.temp.c_str());
+			std::lock_guard<std::mutex> lock(mutex);
+			failures.push_back(failure_t{3, dat.second.sheet, dat.second.row, dat.first});
+		}
+		else {
+			renamed_dirs.insert(dat.second.dir);
+		}
+	}
+	renames.clear();
+
+#ifndef _WIN32
+	for (auto const& dir : renamed_dirs) {
+		syncPath(dir);
+	}
+#endif
+}
+
+/**
+ * @brief Finish everything before the files are looked at
+ *
+ * Renames the dat still pending and, when syncing by batch, every
+ * dat written since the last time.
+ */
+void DatOutput::finishWrites()
+{
+	if (!atomic) {
+		return;
+	}
+
+	commitPending();
+	commitBatch();
+}
@@ -0,0 +1,178 @@
+#pragma once
+#include <string>             // string
+#include <map>                // map
+#include <unordered_map>      // unordered_map
+#include <vector>             // vector
+#include <deque>              // deque
+#include <list>               // list
+#include <thread>             // thread
+#include <mutex>              // mutex
+#include <condition_variable> // condition_variable
+#ifdef _WIN32
+#include <fstream>            // ofstream
+#endif
+
+/**
+ * Destination of the generated dat files
+ *
+ * Writes dats on disk or, when capturing, keeps them in memory
+ * indexed by their path. Dats written on disk are queued and
+ * written by a thread of their own, so parsing never waits for
+ * the disk unless the queue is full. In atomic mode a dat is
+ * written to a temporary file renamed over the old one, so an
+ * interrupted export never leaves half written dats.
+ */
+class DatOutput
+{
+public:
+	/** a dat that could not be written on disk */
+	struct failure_t {
+		/** 2 if the file could not be opened, 3 if writing failed */
+		unsigned int code;
+		/** sheet and row passed when writing */
+		unsigned int sheet;
+		unsigned int row;
+		/** name of the file without extension */
+		std::string filename;
+	};
+	/** what is done so dats written atomically survive a crash */
+	enum durability_t {
+		/** nothing, the system writes them when it wants */
+		NO_SYNC,
+		/** each dat and its directory are synced before going on */
+		FILE_SYNC,
+		/** dats are renamed once the whole file system is synced,
+		 * after every dat is written, and their directories after */
+		BATCH_SYNC
+	};
+
+private:
+	/** when set dats are kept here instead of written on disk */
+	std::map<std::string, std::string> *memory;
+
+	/** a dat waiting to be written */
+	struct job_t {
+		std::string filename;
+		/** content, including the separator when appending */
+		std::string dat;
+		bool append;
+		unsigned int sheet;
+		unsigned int row;
+	};
+	/** maximum number of dats waiting to be written */
+	static const unsigned int QUEUE_SIZE = 64;
+	/** dats waiting, written in order so appends stay in place */
+	std::deque<job_t> jobs;
+	/** dats that could not be written */
+	std::vector<failure_t> failures;
+	/** a directory dats are written to */
+	struct dir_t {
+		/** descriptor files are opened relative to, AT_FDCWD when the
+		 * directory could not be kept open and paths must be used,
+		 * -1 while it's closed to leave room for others */
+		int fd;
+		/** whether it exists or was created */
+		bool exists;
+	};
+	/** a directory seen by the writer */
+	struct known_dir_t {
+		dir_t dir;
+		/** its place in open_dirs while it's open */
+		std::list<std::string>::iterator use;
+	};
+	/** directories kept open at most, so many sheets or workbooks
+	 * exported in parallel don't run out of descriptors */
+	static const unsigned int MAX_OPEN_DIRS = 32;
+	/** every directory seen by the writer, created if missing */
+	std::unordered_map<std::string, known_dir_t> dirs;
+	/** directories kept open, the most recently used first */
+	std::list<std::string> open_dirs;
+	/** whether dats are written to a temporary file and renamed */
+	bool atomic;
+	/** sync done when writing atomically */
+	durability_t durability;
+	/** dat being written to its temporary file, appended objects
+	 * are added to it until another dat comes */
+	struct pending_t {
+		bool open;
+		/** name of the dat without extension */
+		std::string filename;
+		dir_t dir;
+		/** temporary and final name, relative to dir */
+		std::string temp;
+		std::string target;
+#ifdef _WIN32
+		std::ofstream stream;
+#else
+		int fd;
+#endif
+		/** what is given back if it fails */
+		unsigned int sheet;
+		unsigned int row;
+		/** whether writing failed */
+		bool failed;
+	} pending;
+	/** a dat written to its temporary file, renamed with its batch */
+	struct rename_t {
+		/** temporary and final name, relative to the current directory */
+		std::string temp;
+		std::string target;
+		/** directory of the dat, synced after the rename */
+		std::string dir;
+		/** what is given back if it fails */
+		unsigned int sheet;
+		unsigned int row;
+	};
+	/** dats waiting for the batch to be synced, by cleaned name
+	 * without extension */
+	std::map<std::string, rename_t> renames;
+	/** protects jobs, failures and the flags below */
+	std::mutex mutex;
+	/** signalled when a job is queued, taken or finished */
+	std::condition_variable cv;
+	/** whether the writer is writing a job */
+	bool busy;
+	/** set when the writer must finish every dat */
+	bool flushing;
+	/** set when the writer must stop */
+	bool stopping;
+	/** writer thread, only started on the first dat written on disk */
+	std::thread writer;
+
+	// Writer thread loop
+	void work();
+	// Get a directory, creating it if missing
+	dir_t openDir(const std::string& dir);
+#ifndef _WIN32
+	// Close directories until another one can be opened
+	void closeDirs();
+#endif
+	// Write one dat on disk
+	unsigned int writeFile(const job_t& job);
+	// Write one dat to a temporary file
+	unsigned int writeAtomic(const job_t& job);
+	// Add data to the temporary file
+	bool writePending(const char* data, std::string::size_type size);
+	// Rename the temporary file into place
+	void commitPending();
+	// Finish everything before the files are looked at
+	void finishWrites();
+	// Rename the dats of the batch once they are on disk
+	void commitBatch();
+
+public:
+	// Write dats on disk
+	DatOutput();
+	// Write what is still queued and stop the writer
+	~DatOutput();
+	DatOutput(const DatOutput&) = delete;
+	DatOutput& operator=(const DatOutput&) = delete;
+	// Keep dats in memory instead of writing them
+	void capture(std::map<std::string, std::string>& dats);
+	// Replace dats atomically
+	void setAtomic(const durability_t sync);
+	// Write a dat file
+	const unsigned int write(const std::string& filename, const std::string& dat_stream, const bool append, const unsigned int sheet = 0, const unsigned int row = 0);
+	// Wait until every dat is written
+	std::vector<failure_t> flush();
+};
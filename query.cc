@@ -0,0 +1,1111 @@
+#include <sstream>   // ostringstream
+#include <string>    // string
+#include <cstring>   // strlen
+#include <cstdio>    // snprintf
+#include <cctype>    // isalpha, isalnum, isdigit, isspace, tolower
+#include <cmath>     // isnan, NAN
+#include <charconv>  // from_chars
+#include <algorithm> // stable_sort, max
+#include <stdexcept> // runtime_error
+#include "query.hh"
+
+const unsigned int Table::NO_TEXT;
+const unsigned int Query::NO_NODE;
+
+/** columns every table starts with */
+static const unsigned int SHEET_COLUMN = 0;
+static const unsigned int DAT_COLUMN = 1;
+
+/**
+ * @brief Lowercase copy of a text
+ *
+ * @param text Any text
+ *
+ * @return the text with ASCII letters in lowercase
+ */
+static std::string lowercase(const std::string_view text)
+{
+	std::string lower(text);
+
+	for (char& c : lower) {
+		c = std::tolower((unsigned char)c);
+	}
+
+	return lower;
+}
+
+/**
+ * @brief Start with no objects
+ */
+Table::Table() : rows(0)
+{
+	addColumn("sheet");
+	addColumn("dat");
+}
+
+/**
+ * @brief Get a column by name, adding it if missing
+ *
+ * Names are case insensitive like keys in dats.
+ *
+ * @param name Name of the parameter
+ *
+ * @return index of the column
+ */
+unsigned int Table::addColumn(const std::string_view name)
+{
+	const std::string key = lowercase(name);
+	auto found = column_ids.find(key);
+
+	if (found != column_ids.end()) {
+		return found->second;
+	}
+
+	column_ids.emplace(key, columns.size());
+	columns.push_back(column_t{std::string(name), std::vector<double>(), std::vector<unsigned int>()});
+	return columns.size() - 1;
+}
+
+/**
+ * @brief Set a value, growing the column up to the row
+ *
+ * Objects without the parameter are missing values, they are
+ * only added when a later object has it.
+ *
+ * @param column Index of the column
+ * @param row Index of the object
+ * @param number Value if it is a number, NaN if not
+ * @param text Id of the value if it is not a number
+ */
+void Table::set(const unsigned int column, const unsigned int row, const double number, const unsigned int text)
+{
+	column_t& values = columns[column];
+	values.numbers.resize(row, NAN);
+	values.texts.resize(row, NO_TEXT);
+	values.numbers.push_back(number);
+	values.texts.push_back(text);
+}
+
+/**
+ * @brief Forget the values of an unfinished object
+ */
+void Table::startRow()
+{
+	pending.clear();
+}
+
+/**
+ * @brief Add a value to the object being read
+ *
+ * Columns are found by parameter id, the name is only looked up
+ * the first time an id is seen.
+ *
+ * @param param Id of the parameter in the workbook
+ * @param name Name of the parameter
+ * @param value Value of the cell
+ */
+void Table::addValue(const unsigned int param, const std::string_view name, const std::string_view value)
+{
+	if (param >= param_columns.size()) {
+		param_columns.resize(param + 1, NO_TEXT);
+	}
+	if (param_columns[param] == NO_TEXT) {
+		param_columns[param] = addColumn(name);
+	}
+
+	const double number_value = number(value);
+	pending.push_back(pending_t{param_columns[param], number_value, std::isnan(number_value) ? texts.intern(std::string(value)) : NO_TEXT});
+}
+
+/**
+ * @brief Finish the object being read
+ *
+ * @param sheet Name of the sheet of the object
+ * @param dat Name of the dat file of the object
+ */
+void Table::addRow(const std::string_view sheet, const std::string_view dat)
+{
+	set(SHEET_COLUMN, rows, NAN, texts.intern(std::string(sheet)));
+	set(DAT_COLUMN, rows, NAN, texts.intern(std::string(dat)));
+
+	// a parameter repeated in the row keeps its last value
+	for (auto const& value : pending) {
+		set(value.column, rows, value.number, value.text);
+	}
+
+	pending.clear();
+	rows++;
+}
+
+/**
+ * @brief Add every object of another table
+ *
+ * Columns and texts are matched by name.
+ *
+ * @param other Table filled by another workbook
+ */
+void Table::append(const Table& other)
+{
+	std::vector<unsigned int> text_ids;
+	text_ids.reserve(other.texts.size());
+	for (auto const& text : other.texts.list()) {
+		text_ids.push_back(texts.intern(text));
+	}
+
+	for (auto const& source : other.columns) {
+		column_t& target = columns[addColumn(source.name)];
+		target.numbers.resize(rows, NAN);
+		target.texts.resize(rows, NO_TEXT);
+		target.numbers.insert(target.numbers.end(), source.numbers.begin(), source.numbers.end());
+
+		for (const unsigned int id : source.texts) {
+			target.texts.push_back(id == NO_TEXT ? NO_TEXT : text_ids[id]);
+		}
+	}
+
+	rows += other.rows;
+
+	for (auto& column : columns) {
+		column.numbers.resize(rows, NAN);
+		column.texts.resize(rows, NO_TEXT);
+	}
+}
+
+/**
+ * @brief Number of objects
+ *
+ * @return number of rows of the table
+ */
+unsigned int Table::size() const
+{
+	return rows;
+}
+
+/**
+ * @brief Find a column by name
+ *
+ * @param name Name of the parameter, in any case
+ *
+ * @return the column, null if no object has the parameter
+ */
+const Table::column_t* Table::find(const std::string_view name) const
+{
+	auto found = column_ids.find(lowercase(name));
+	return found == column_ids.end() ? nullptr : &columns[found->second];
+}
+
+/**
+ * @brief Find the id of a text
+ *
+ * @param text Text value
+ * @param id Receives the id
+ *
+ * @return true if some object has the value
+ */
+bool Table::findText(const std::string& text, unsigned int& id) const
+{
+	return texts.find(text, id);
+}
+
+/**
+ * @brief Get a text by id
+ *
+ * @param id Id of the text
+ *
+ * @return the text
+ */
+const std::string& Table::text(const unsigned int id) const
+{
+	return texts.name(id);
+}
+
+/**
+ * @brief Read a value as a number
+ *
+ * Only plain decimal numbers are numbers, lists like `1,2` and
+ * names starting with a digit are texts.
+ *
+ * @param value Value of a cell
+ *
+ * @return the number, NaN if the value is not a number
+ */
+double Table::number(const std::string_view value)
+{
+	double result;
+
+	if (value.empty() || !(std::isdigit((unsigned char)value[0]) || value[0] == '-' || value[0] == '.')) {
+		return NAN;
+	}
+
+	const std::from_chars_result read = std::from_chars(value.data(), value.data() + value.size(), result);
+	if (read.ec != std::errc() || read.ptr != value.data() + value.size()) {
+		return NAN;
+	}
+
+	return result;
+}
+
+/**
+ * @brief Parse a query
+ *
+ * @param text Text of the query
+ *
+ * @throw runtime_error if the query is not valid
+ */
+Query::Query(const std::string& text) : source(text), current(0), aggregated(false), allow_aggregates(false), order(NO_NODE), descending(false), limit(0)
+{
+	tokenize();
+
+	acceptKeyword("select");
+	do {
+		parseItem();
+	} while (acceptSymbol(","));
+
+	if (acceptKeyword("where")) {
+		do {
+			parseCondition();
+		} while (acceptKeyword("and"));
+	}
+
+	if (acceptKeyword("group")) {
+		if (!acceptKeyword("by")) {
+			fail("Expected BY");
+		}
+		do {
+			group.push_back(parseExpression());
+		} while (acceptSymbol(","));
+	}
+
+	if (acceptKeyword("order")) {
+		if (!acceptKeyword("by")) {
+			fail("Expected BY");
+		}
+
+		const token_t& token = tokens[current];
+		if (token.kind == token_t::NUMBER && token.number >= 1 && token.number <= items.size() && token.number == (unsigned int)token.number) {
+			order = (unsigned int)token.number - 1;
+			current++;
+		}
+		else {
+			// by the text of an item, which can be several tokens
+			for (unsigned int i = 0; i < items.size() && order == NO_NODE; ++i) {
+				const std::string::size_type end = token.start + items[i].title.size();
+				if (lowercase(source.substr(token.start, items[i].title.size())) != lowercase(items[i].title)) {
+					continue;
+				}
+				for (unsigned int next = current; tokens[next].kind != token_t::END && tokens[next].end <= end; ++next) {
+					if (tokens[next].end == end) {
+						order = i;
+						current = next + 1;
+					}
+				}
+			}
+		}
+		if (order == NO_NODE) {
+			fail("Expected the number or text of an item");
+		}
+
+		if (acceptKeyword("desc")) {
+			descending = true;
+		}
+		else {
+			acceptKeyword("asc");
+		}
+	}
+
+	if (acceptKeyword("limit")) {
+		const token_t& token = tokens[current];
+		if (token.kind != token_t::NUMBER || token.number < 1 || token.number > ~0u) {
+			fail("Expected a number");
+		}
+		limit = (unsigned int)token.number;
+		current++;
+	}
+
+	if (tokens[current].kind != token_t::END) {
+		fail("Unexpected text");
+	}
+}
+
+/**
+ * @brief Split the query in tokens
+ *
+ * Words are letters, digits, `_` and the brackets of parameters
+ * like `constraint[prev][0]`.
+ */
+void Query::tokenize()
+{
+	static const char* const SYMBOLS[] = {"!=", "<>", "<=", ">=", "=", "<", ">", "+", "-", "*", "/", "(", ")", ","};
+	std::string::size_type pos = 0;
+
+	for (;;) {
+		while (pos < source.size() && std::isspace((unsigned char)source[pos])) {
+			pos++;
+		}
+
+		token_t token{token_t::END, std::string(), 0, pos, pos};
+		if (pos == source.size()) {
+			tokens.push_back(token);
+			return;
+		}
+
+		const char c = source[pos];
+		if (std::isdigit((unsigned char)c) || (c == '.' && pos + 1 < source.size() && std::isdigit((unsigned char)source[pos + 1]))) {
+			const std::from_chars_result read = std::from_chars(source.data() + pos, source.data() + source.size(), token.number, std::chars_format::fixed);
+			token.kind = token_t::NUMBER;
+			pos = read.ptr - source.data();
+		}
+		else if (std::isalpha((unsigned char)c) || c == '_') {
+			while (pos < source.size() && (std::isalnum((unsigned char)source[pos]) || source[pos] == '_' || source[pos] == '[' || source[pos] == ']')) {
+				pos++;
+			}
+			token.kind = token_t::WORD;
+			token.text = source.substr(token.start, pos - token.start);
+		}
+		else if (c == '\'' || c == '"') {
+			const std::string::size_type close = source.find(c, pos + 1);
+			if (close == std::string::npos) {
+				current = tokens.size();
+				tokens.push_back(token);
+				fail("Unclosed text");
+			}
+			token.kind = token_t::STRING;
+			token.text = source.substr(pos + 1, close - pos - 1);
+			pos = close + 1;
+		}
+		else {
+			for (const char* symbol : SYMBOLS) {
+				if (!source.compare(pos, std::strlen(symbol), symbol)) {
+					token.kind = token_t::SYMBOL;
+					// both ways of writing not equal are the same
+					token.text = (!std::strcmp(symbol, "<>") ? "!=" : symbol);
+					pos += std::strlen(symbol);
+					break;
+				}
+			}
+			if (token.kind == token_t::END) {
+				current = tokens.size();
+				tokens.push_back(token);
+				fail("Unexpected character");
+			}
+		}
+
+		token.end = pos;
+		tokens.push_back(token);
+	}
+}
+
+/**
+ * @brief Stop with a parse error
+ *
+ * @param message What was wrong
+ *
+ * @throw runtime_error always, with the position of the current
+ * token
+ */
+void Query::fail(const std::string& message) const
+{
+	std::ostringstream err_msg;
+	err_msg << "QRY1:" << message << " at position " << tokens[current].start + 1 << ": " << source;
+	// send to main
+	throw std::runtime_error(err_msg.str());
+}
+
+/**
+ * @brief Check if the current token is a keyword
+ *
+ * @param keyword Lowercase keyword
+ *
+ * @return true if the token is the word in any case
+ */
+bool Query::isKeyword(const char* keyword) const
+{
+	return tokens[current].kind == token_t::WORD && lowercase(tokens[current].text) == keyword;
+}
+
+/**
+ * @brief Skip the current token if it is a keyword
+ *
+ * @param keyword Lowercase keyword
+ *
+ * @return true if it was skipped
+ */
+bool Query::acceptKeyword(const char* keyword)
+{
+	if (!isKeyword(keyword)) {
+		return false;
+	}
+
+	current++;
+	return true;
+}
+
+/**
+ * @brief Skip the current token if it is a symbol
+ *
+ * @param symbol The symbol
+ *
+ * @return true if it was skipped
+ */
+bool Query::acceptSymbol(const char* symbol)
+{
+	if (tokens[current].kind != token_t::SYMBOL || tokens[current].text != symbol) {
+		return false;
+	}
+
+	current++;
+	return true;
+}
+
+/**
+ * @brief Parse an item of the SELECT list
+ */
+void Query::parseItem()
+{
+	const std::string::size_type start = tokens[current].start;
+
+	allow_aggregates = true;
+	const unsigned int node = parseExpression();
+	allow_aggregates = false;
+
+	items.push_back(item_t{source.substr(start, tokens[current - 1].end - start), node});
+}
+
+/**
+ * @brief Parse a comparison
+ */
+void Query::parseCondition()
+{
+	static const char* const OPERATORS[] = {"=", "!=", "<", "<=", ">", ">="};
+	condition_t condition;
+	condition.left = parseExpression();
+
+	for (const char* op : OPERATORS) {
+		if (acceptSymbol(op)) {
+			condition.op = op;
+			condition.right = parseExpression();
+			conditions.push_back(condition);
+			return;
+		}
+	}
+
+	fail("Expected a comparison");
+}
+
+/**
+ * @brief Parse a sum or difference
+ *
+ * @return index of the node
+ */
+unsigned int Query::parseExpression()
+{
+	unsigned int left = parseTerm();
+
+	for (;;) {
+		if (acceptSymbol("+")) {
+			left = addNode(node_t{node_t::ADD, 0, std::string(), left, parseTerm(), NONE});
+		}
+		else if (acceptSymbol("-")) {
+			left = addNode(node_t{node_t::SUBTRACT, 0, std::string(), left, parseTerm(), NONE});
+		}
+		else {
+			return left;
+		}
+	}
+}
+
+/**
+ * @brief Parse a product or division
+ *
+ * @return index of the node
+ */
+unsigned int Query::parseTerm()
+{
+	unsigned int left = parseFactor();
+
+	for (;;) {
+		if (acceptSymbol("*")) {
+			left = addNode(node_t{node_t::MULTIPLY, 0, std::string(), left, parseFactor(), NONE});
+		}
+		else if (acceptSymbol("/")) {
+			left = addNode(node_t{node_t::DIVIDE, 0, std::string(), left, parseFactor(), NONE});
+		}
+		else {
+			return left;
+		}
+	}
+}
+
+/**
+ * @brief Parse a value, parameter or parenthesis
+ *
+ * @return index of the node
+ */
+unsigned int Query::parseFactor()
+{
+	const token_t& token = tokens[current];
+
+	if (acceptSymbol("-")) {
+		return addNode(node_t{node_t::NEGATE, 0, std::string(), parseFactor(), 0, NONE});
+	}
+	if (acceptSymbol("(")) {
+		const unsigned int inside = parseExpression();
+		if (!acceptSymbol(")")) {
+			fail("Expected )");
+		}
+		return inside;
+	}
+
+	if (token.kind == token_t::NUMBER) {
+		current++;
+		return addNode(node_t{node_t::NUMBER, token.number, std::string(), 0, 0, NONE});
+	}
+	if (token.kind == token_t::STRING) {
+		current++;
+		return addNode(node_t{node_t::TEXT, 0, token.text, 0, 0, NONE});
+	}
+	if (token.kind == token_t::WORD && tokens[current + 1].kind == token_t::SYMBOL && tokens[current + 1].text == "(") {
+		static const char* const AGGREGATES[] = {"count", "sum", "min", "max", "avg"};
+
+		for (unsigned int i = 0; i < 5; ++i) {
+			if (!isKeyword(AGGREGATES[i])) {
+				continue;
+			}
+			// not in conditions, groups or other aggregates
+			if (!allow_aggregates) {
+				fail("Aggregate not allowed here");
+			}
+
+			unsigned int argument = NO_NODE;
+			current += 2;
+			allow_aggregates = false;
+			aggregated = true;
+			if (i != 0 || !acceptSymbol("*")) {
+				argument = parseExpression();
+			}
+			if (!acceptSymbol(")")) {
+				fail("Expected )");
+			}
+			allow_aggregates = true;
+
+			return addNode(node_t{node_t::AGGREGATE, 0, std::string(), argument, 0, (aggregate_t)(COUNT + i)});
+		}
+
+		fail("Unknown function");
+	}
+	if (token.kind == token_t::WORD) {
+		current++;
+		return addNode(node_t{node_t::COLUMN, 0, token.text, 0, 0, NONE});
+	}
+
+	fail("Expected a value");
+}
+
+/**
+ * @brief Add a node
+ *
+ * @param node The node
+ *
+ * @return index of the node
+ */
+unsigned int Query::addNode(node_t&& node)
+{
+	nodes.push_back(std::move(node));
+	return nodes.size() - 1;
+}
+
+/**
+ * @brief Compute an expression for some rows
+ *
+ * Works on a whole column at a time. Arithmetic on texts and
+ * missing values gives missing values.
+ *
+ * @param table Table with the objects
+ * @param node Index of the node
+ * @param rows Rows to compute
+ *
+ * @return value of the expression for each row
+ */
+Query::values_t Query::evaluate(const Table& table, const unsigned int node, const std::vector<unsigned int>& rows) const
+{
+	const node_t& expr = nodes[node];
+	const std::size_t count = rows.size();
+	values_t result;
+
+	if (expr.kind == node_t::COLUMN) {
+		const Table::column_t* column = table.find(expr.text);
+
+		if (column != nullptr) {
+			result.numbers.resize(count);
+			result.texts.resize(count);
+			// columns end at the last object with the parameter
+			const std::size_t size = column->numbers.size();
+			for (std::size_t i = 0; i < count; ++i) {
+				result.numbers[i] = (rows[i] < size ? column->numbers[rows[i]] : NAN);
+				result.texts[i] = (rows[i] < size ? column->texts[rows[i]] : Table::NO_TEXT);
+			}
+			return result;
+		}
+	}
+
+	if (expr.kind == node_t::NUMBER) {
+		result.numbers.assign(count, expr.number);
+		result.texts.assign(count, Table::NO_TEXT);
+		return result;
+	}
+
+	if (expr.kind == node_t::TEXT || expr.kind == node_t::COLUMN) {
+		// texts no object has never match, but must not be missing
+		unsigned int id = Table::NO_TEXT - 1;
+		table.findText(expr.text, id);
+		result.numbers.assign(count, NAN);
+		result.texts.assign(count, id);
+		return result;
+	}
+
+	result = evaluate(table, expr.left, rows);
+	result.texts.assign(count, Table::NO_TEXT);
+
+	if (expr.kind == node_t::NEGATE) {
+		for (double& number : result.numbers) {
+			number = -number;
+		}
+		return result;
+	}
+
+	arithmetic(expr.kind, result.numbers, evaluate(table, expr.right, rows).numbers);
+	return result;
+}
+
+/**
+ * @brief Compute an item for every group
+ *
+ * Aggregates are computed in a single pass over the values of
+ * every selected row, anything else outside an aggregate takes
+ * the value of the first row of the group.
+ *
+ * @param table Table with the objects
+ * @param node Index of the node
+ * @param groups Selected rows and their groups
+ *
+ * @return value of the expression for each group
+ */
+Query::values_t Query::evaluateGroups(const Table& table, const unsigned int node, const groups_t& groups) const
+{
+	const node_t& expr = nodes[node];
+	values_t result;
+
+	if (expr.kind == node_t::NUMBER || expr.kind == node_t::TEXT || expr.kind == node_t::COLUMN) {
+		result = evaluate(table, node, groups.first_rows);
+		result.numbers.resize(groups.count, NAN);
+		result.texts.resize(groups.count, Table::NO_TEXT);
+		return result;
+	}
+
+	if (expr.kind != node_t::AGGREGATE) {
+		result = evaluateGroups(table, expr.left, groups);
+		result.texts.assign(groups.count, Table::NO_TEXT);
+
+		if (expr.kind == node_t::NEGATE) {
+			for (double& number : result.numbers) {
+				number = -number;
+			}
+		}
+		else {
+			arithmetic(expr.kind, result.numbers, evaluateGroups(table, expr.right, groups).numbers);
+		}
+		return result;
+	}
+
+	std::vector<double> sums(groups.count, 0);
+	std::vector<double> counts(groups.count, 0);
+	std::vector<double> extremes(groups.count, NAN);
+
+	if (expr.left == NO_NODE) {
+		for (std::size_t i = 0; i < groups.rows.size(); ++i) {
+			counts[groups.group_of[i]]++;
+		}
+	}
+	else {
+		const values_t values = evaluate(table, expr.left, groups.rows);
+
+		for (std::size_t i = 0; i < groups.rows.size(); ++i) {
+			const double number = values.numbers[i];
+			const unsigned int g = groups.group_of[i];
+
+			if (expr.aggregate == COUNT) {
+				counts[g] += !std::isnan(number) || values.texts[i] != Table::NO_TEXT;
+			}
+			else if (!std::isnan(number)) {
+				sums[g] += number;
+				counts[g]++;
+				if (std::isnan(extremes[g]) || (expr.aggregate == MIN ? number < extremes[g] : number > extremes[g])) {
+					extremes[g] = number;
+				}
+			}
+		}
+	}
+
+	result.texts.assign(groups.count, Table::NO_TEXT);
+	switch (expr.aggregate) {
+		case COUNT:
+			result.numbers = counts;
+			break;
+		case SUM:
+			result.numbers = sums;
+			break;
+		case AVG:
+			for (unsigned int g = 0; g < groups.count; ++g) {
+				sums[g] = (counts[g] ? sums[g] / counts[g] : NAN);
+			}
+			result.numbers = sums;
+			break;
+		default:
+			result.numbers = extremes;
+			break;
+	}
+
+	return result;
+}
+
+/**
+ * @brief Apply an arithmetic operator to whole columns
+ *
+ * @param kind ADD, SUBTRACT, MULTIPLY or DIVIDE
+ * @param numbers Left operands, receive the results
+ * @param other Right operands
+ */
+void Query::arithmetic(const node_t::kind_t kind, std::vector<double>& numbers, const std::vector<double>& other)
+{
+	const std::size_t count = numbers.size();
+
+	switch (kind) {
+		case node_t::ADD:
+			for (std::size_t i = 0; i < count; ++i) {
+				numbers[i] += other[i];
+			}
+			break;
+		case node_t::SUBTRACT:
+			for (std::size_t i = 0; i < count; ++i) {
+				numbers[i] -= other[i];
+			}
+			break;
+		case node_t::MULTIPLY:
+			for (std::size_t i = 0; i < count; ++i) {
+				numbers[i] *= other[i];
+			}
+			break;
+		default:
+			// division by zero is missing instead of infinite
+			for (std::size_t i = 0; i < count; ++i) {
+				numbers[i] = (other[i] == 0 ? NAN : numbers[i] / other[i]);
+			}
+			break;
+	}
+}
+
+/**
+ * @brief Compare two values
+ *
+ * Numbers compare as numbers and texts as texts. A number and a
+ * text are different and have no order, like in SQL nothing holds
+ * for missing values.
+ *
+ * @param table Table with the texts
+ * @param op One of = != < <= > >=
+ * @param left_number Number on the left, NaN if not a number
+ * @param left_text Text on the left
+ * @param right_number Number on the right, NaN if not a number
+ * @param right_text Text on the right
+ *
+ * @return true if the comparison holds
+ */
+bool Query::compare(const Table& table, const std::string& op, const double left_number, const unsigned int left_text, const double right_number, const unsigned int right_text)
+{
+	const bool left_missing = std::isnan(left_number) && left_text == Table::NO_TEXT;
+	const bool right_missing = std::isnan(right_number) && right_text == Table::NO_TEXT;
+	int order;
+
+	if (left_missing || right_missing) {
+		return false;
+	}
+
+	if (!std::isnan(left_number) && !std::isnan(right_number)) {
+		order = (left_number < right_number ? -1 : left_number > right_number);
+	}
+	else if (std::isnan(left_number) && std::isnan(right_number)) {
+		// texts no object has are not in the table
+		if (left_text == right_text) {
+			order = 0;
+		}
+		else if (left_text >= Table::NO_TEXT - 1 || right_text >= Table::NO_TEXT - 1) {
+			return op == "!=";
+		}
+		else {
+			order = table.text(left_text).compare(table.text(right_text));
+		}
+	}
+	else {
+		return op == "!=";
+	}
+
+	if (op == "=") {
+		return order == 0;
+	}
+	if (op == "!=") {
+		return order != 0;
+	}
+	if (op == "<") {
+		return order < 0;
+	}
+	if (op == "<=") {
+		return order <= 0;
+	}
+	if (op == ">") {
+		return order > 0;
+	}
+	return order >= 0;
+}
+
+/**
+ * @brief Order of two cells when sorting
+ *
+ * Numbers go before texts and missing values go last.
+ *
+ * @param table Table with the texts
+ * @param a First cell
+ * @param b Second cell
+ *
+ * @return negative if a goes first, positive if b goes first and
+ * 0 if they are equal
+ */
+int Query::compareCells(const Table& table, const cell_t& a, const cell_t& b)
+{
+	const int a_kind = (!std::isnan(a.number) ? 0 : a.text < Table::NO_TEXT - 1 ? 1 : 2);
+	const int b_kind = (!std::isnan(b.number) ? 0 : b.text < Table::NO_TEXT - 1 ? 1 : 2);
+
+	if (a_kind != b_kind) {
+		return a_kind - b_kind;
+	}
+	if (a_kind == 0) {
+		return a.number < b.number ? -1 : a.number > b.number;
+	}
+	if (a_kind == 1) {
+		return table.text(a.text).compare(table.text(b.text));
+	}
+	return 0;
+}
+
+/**
+ * @brief Text of a cell
+ *
+ * @param table Table with the texts
+ * @param cell The cell
+ *
+ * @return the number with up to 15 digits, the text or nothing
+ * if missing
+ */
+std::string Query::format(const Table& table, const cell_t& cell)
+{
+	if (!std::isnan(cell.number)) {
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.15g", cell.number == 0 ? 0.0 : cell.number);
+		return buffer;
+	}
+	if (cell.text < Table::NO_TEXT - 1) {
+		return table.text(cell.text);
+	}
+	return std::string();
+}
+
+/**
+ * @brief Run the query and print the result
+ *
+ * Conditions shrink the list of selected rows one after the
+ * other, then rows are put in groups and every aggregate is
+ * computed in a single pass over its values. Without GROUP BY
+ * aggregates take every selected row and plain queries list each
+ * row. Results are sorted by the groups unless ORDER BY is given.
+ *
+ * @param table Table with the objects
+ * @param out Stream where the result is printed
+ * @param csv Whether to print CSV instead of aligned columns
+ */
+void Query::run(const Table& table, std::ostream& out, const bool csv) const
+{
+	std::vector<unsigned int> rows(table.size());
+	for (unsigned int i = 0; i < rows.size(); ++i) {
+		rows[i] = i;
+	}
+
+	for (auto const& condition : conditions) {
+		const values_t left = evaluate(table, condition.left, rows);
+		const values_t right = evaluate(table, condition.right, rows);
+		std::vector<unsigned int> kept;
+
+		for (std::size_t i = 0; i < rows.size(); ++i) {
+			if (compare(table, condition.op, left.numbers[i], left.texts[i], right.numbers[i], right.texts[i])) {
+				kept.push_back(rows[i]);
+			}
+		}
+		rows.swap(kept);
+	}
+
+	// group of each selected row and first row of each group
+	std::vector<unsigned int> group_of(rows.size(), 0);
+	std::vector<unsigned int> first_rows;
+
+	if (!aggregated && group.empty()) {
+		first_rows = rows;
+		for (unsigned int i = 0; i < rows.size(); ++i) {
+			group_of[i] = i;
+		}
+	}
+	else if (group.empty()) {
+		if (!rows.empty()) {
+			first_rows.push_back(rows[0]);
+		}
+	}
+	else {
+		std::vector<values_t> keys;
+		for (const unsigned int node : group) {
+			keys.push_back(evaluate(table, node, rows));
+		}
+
+		std::unordered_map<std::string, unsigned int> groups;
+		std::string key;
+		for (unsigned int i = 0; i < rows.size(); ++i) {
+			key.clear();
+			for (auto const& values : keys) {
+				const double number = (values.numbers[i] == 0 ? 0.0 : values.numbers[i]);
+				key.append((const char*)&number, sizeof(number));
+				key.append((const char*)&values.texts[i], sizeof(values.texts[i]));
+			}
+
+			auto found = groups.emplace(key, (unsigned int)first_rows.size());
+			if (found.second) {
+				first_rows.push_back(rows[i]);
+			}
+			group_of[i] = found.first->second;
+		}
+	}
+
+	// compute every item for every group, aggregates of nothing are still one row
+	const groups_t groups{rows, group_of, first_rows, (aggregated && group.empty() ? 1 : (unsigned int)first_rows.size())};
+	const unsigned int group_count = groups.count;
+	std::vector<std::vector<cell_t>> columns;
+
+	for (auto const& item : items) {
+		const values_t values = evaluateGroups(table, item.node, groups);
+		std::vector<cell_t> cells;
+
+		for (unsigned int g = 0; g < group_count; ++g) {
+			cells.push_back(cell_t{values.numbers[g], values.texts[g]});
+		}
+		columns.push_back(cells);
+	}
+
+	// columns the result is sorted by
+	std::vector<std::vector<cell_t>> sort_keys;
+	if (order != NO_NODE) {
+		sort_keys.push_back(columns[order]);
+	}
+	else if (!group.empty()) {
+		for (const unsigned int node : group) {
+			const values_t values = evaluate(table, node, first_rows);
+			std::vector<cell_t> cells;
+			for (unsigned int g = 0; g < group_count; ++g) {
+				cells.push_back(cell_t{values.numbers[g], values.texts[g]});
+			}
+			sort_keys.push_back(cells);
+		}
+	}
+
+	std::vector<unsigned int> result(group_count);
+	for (unsigned int g = 0; g < group_count; ++g) {
+		result[g] = g;
+	}
+
+	std::stable_sort(result.begin(), result.end(), [&](const unsigned int a, const unsigned int b) {
+		for (auto const& keys : sort_keys) {
+			// missing values go last in both directions
+			const bool a_missing = std::isnan(keys[a].number) && keys[a].text >= Table::NO_TEXT - 1;
+			const bool b_missing = std::isnan(keys[b].number) && keys[b].text >= Table::NO_TEXT - 1;
+			if (a_missing != b_missing) {
+				return b_missing;
+			}
+
+			const int difference = compareCells(table, keys[a], keys[b]);
+			if (difference != 0) {
+				return descending ? difference > 0 : difference < 0;
+			}
+		}
+		return false;
+	});
+
+	if (limit && result.size() > limit) {
+		result.resize(limit);
+	}
+
+	// text of every cell, the titles are the first row
+	std::vector<std::vector<std::string>> lines(1);
+	for (auto const& item : items) {
+		lines[0].push_back(item.title);
+	}
+	for (const unsigned int g : result) {
+		lines.emplace_back();
+		for (auto const& cells : columns) {
+			lines.back().push_back(format(table, cells[g]));
+		}
+	}
+
+	if (csv) {
+		for (auto const& line : lines) {
+			for (unsigned int i = 0; i < line.size(); ++i) {
+				const std::string& field = line[i];
+				out << (i ? "," : "");
+
+				if (field.find_first_of(",\"\r\n") == std::string::npos) {
+					out << field;
+					continue;
+				}
+
+				out << '"';
+				for (const char c : field) {
+					out << (c == '"' ? "\"\"" : std::string(1, c));
+				}
+				out << '"';
+			}
+			out << '\n';
+		}
+		return;
+	}
+
+	// numbers are aligned to the right
+	std::vector<std::string::size_type> widths(items.size(), 0);
+	for (auto const& line : lines) {
+		for (unsigned int i = 0; i < line.size(); ++i) {
+			widths[i] = std::max(widths[i], line[i].size());
+		}
+	}
+
+	for (unsigned int l = 0; l < lines.size(); ++l) {
+		std::string text;
+		for (unsigned int i = 0; i < items.size(); ++i) {
+			const std::string& field = lines[l][i];
+			const std::string padding(widths[i] - field.size(), ' ');
+			const bool right = l > 0 && !std::isnan(columns[i][result[l - 1]].number);
+
+			text += (i ? "  " : "");
+			text += (right ? padding + field : field + (i + 1 < items.size() ? padding : ""));
+		}
+		out << text << '\n';
+
+		if (l == 0) {
+			for (unsigned int i = 0; i < items.size(); ++i) {
+				out << (i ? "  " : "") << std::string(widths[i], '-');
+			}
+			out << '\n';
+		}
+	}
+}
@@ -0,0 +1,234 @@
+#pragma once
+#include <string>        // string
+#include <string_view>   // string_view
+#include <vector>        // vector
+#include <unordered_map> // unordered_map
+#include <ostream>       // ostream
+#include "schema.hh"     // Interner
+
+/**
+ * Exported objects loaded in typed columns
+ *
+ * Each parameter is a column holding the value of every object,
+ * numbers as doubles and anything else as the id of an interned
+ * text, so filters and aggregates run over plain arrays and texts
+ * are compared by id. Two extra columns, `sheet` and `dat`, hold
+ * where each object comes from.
+ */
+class Table
+{
+public:
+	/** text id of values that are numbers or missing */
+	static const unsigned int NO_TEXT = ~0u;
+	/** values of one parameter, numbers are NaN where there is no number */
+	struct column_t {
+		std::string name;
+		std::vector<double> numbers;
+		std::vector<unsigned int> texts;
+	};
+
+private:
+	/** every column, sheet and dat are the first two */
+	std::vector<column_t> columns;
+	/** column of each lowercase name */
+	std::unordered_map<std::string, unsigned int> column_ids;
+	/** column of each parameter id of the workbook filling the table */
+	std::vector<unsigned int> param_columns;
+	/** every text value */
+	Interner texts;
+	/** a value of the object being read */
+	struct pending_t {
+		unsigned int column;
+		double number;
+		unsigned int text;
+	};
+	/** values of the object being read, kept until it is finished */
+	std::vector<pending_t> pending;
+	/** number of objects */
+	unsigned int rows;
+
+	// Get a column by name, adding it if missing
+	unsigned int addColumn(const std::string_view name);
+	// Set a value, growing the column up to the row
+	void set(const unsigned int column, const unsigned int row, const double number, const unsigned int text);
+
+public:
+	// Start with no objects
+	Table();
+	// Forget the values of an unfinished object
+	void startRow();
+	// Add a value to the object being read
+	void addValue(const unsigned int param, const std::string_view name, const std::string_view value);
+	// Finish the object being read
+	void addRow(const std::string_view sheet, const std::string_view dat);
+	// Add every object of another table
+	void append(const Table& other);
+	// Number of objects
+	unsigned int size() const;
+	// Find a column by name
+	const column_t* find(const std::string_view name) const;
+	// Find the id of a text
+	bool findText(const std::string& text, unsigned int& id) const;
+	// Get a text by id
+	const std::string& text(const unsigned int id) const;
+	// Read a value as a number
+	static double number(const std::string_view value);
+};
+
+/**
+ * Aggregate query over a Table
+ *
+ * Understands a small subset of SQL:
+ *
+ *     [SELECT] item, ... [WHERE cond AND ...] [GROUP BY expr, ...]
+ *     [ORDER BY n|item [DESC]] [LIMIT n]
+ *
+ * Expressions use parameters, numbers, 'texts', + - * / and, in
+ * items, COUNT, SUM, MIN, MAX and AVG of an expression. Words
+ * that are not a parameter of any object are texts, so
+ * `obj = vehicle` works without quotes. Each step is run over
+ * whole columns of the rows still selected.
+ */
+class Query
+{
+	/** how the values of a group are combined */
+	enum aggregate_t {
+		NONE,
+		COUNT,
+		SUM,
+		MIN,
+		MAX,
+		AVG
+	};
+	/** part of a parsed expression */
+	struct node_t {
+		enum kind_t {
+			NUMBER,
+			TEXT,
+			COLUMN,
+			NEGATE,
+			ADD,
+			SUBTRACT,
+			MULTIPLY,
+			DIVIDE,
+			/** aggregate of left over the group, left is NO_NODE for COUNT(*) */
+			AGGREGATE
+		} kind;
+		double number;
+		/** text, or name of the column */
+		std::string text;
+		/** indexes of the operands */
+		unsigned int left;
+		unsigned int right;
+		aggregate_t aggregate;
+	};
+	/** column of the result */
+	struct item_t {
+		/** text of the item in the query */
+		std::string title;
+		unsigned int node;
+	};
+	/** comparison in the WHERE clause */
+	struct condition_t {
+		unsigned int left;
+		/** one of = != < <= > >= */
+		std::string op;
+		unsigned int right;
+	};
+	/** piece of the query text */
+	struct token_t {
+		enum kind_t {
+			END,
+			WORD,
+			NUMBER,
+			STRING,
+			SYMBOL
+		} kind;
+		std::string text;
+		double number;
+		/** position in the query, for errors and titles */
+		std::string::size_type start;
+		std::string::size_type end;
+	};
+	/** values of an expression for some rows */
+	struct values_t {
+		std::vector<double> numbers;
+		std::vector<unsigned int> texts;
+	};
+	/** selected rows put in groups */
+	struct groups_t {
+		const std::vector<unsigned int>& rows;
+		/** group of each selected row */
+		const std::vector<unsigned int>& group_of;
+		/** first row of each group, missing for a group without rows */
+		const std::vector<unsigned int>& first_rows;
+		unsigned int count;
+	};
+	/** a cell of the result */
+	struct cell_t {
+		double number;
+		unsigned int text;
+	};
+	/** index of no node */
+	static const unsigned int NO_NODE = ~0u;
+
+	std::string source;
+	std::vector<token_t> tokens;
+	/** token being parsed */
+	unsigned int current;
+	std::vector<node_t> nodes;
+	std::vector<item_t> items;
+	std::vector<condition_t> conditions;
+	std::vector<unsigned int> group;
+	/** whether any item has an aggregate */
+	bool aggregated;
+	/** whether an aggregate can be parsed where the parser is */
+	bool allow_aggregates;
+	/** item results are sorted by, NO_NODE if not set */
+	unsigned int order;
+	bool descending;
+	/** most rows printed, 0 prints all */
+	unsigned int limit;
+
+	// Split the query in tokens
+	void tokenize();
+	// Stop with a parse error
+	[[noreturn]] void fail(const std::string& message) const;
+	// Check if the current token is a keyword
+	bool isKeyword(const char* keyword) const;
+	// Skip the current token if it is a keyword
+	bool acceptKeyword(const char* keyword);
+	// Skip the current token if it is a symbol
+	bool acceptSymbol(const char* symbol);
+	// Parse an item of the SELECT list
+	void parseItem();
+	// Parse a comparison
+	void parseCondition();
+	// Parse a sum or difference
+	unsigned int parseExpression();
+	// Parse a product or division
+	unsigned int parseTerm();
+	// Parse a value, parameter or parenthesis
+	unsigned int parseFactor();
+	// Add a node
+	unsigned int addNode(node_t&& node);
+
+	// Compute an expression for some rows
+	values_t evaluate(const Table& table, const unsigned int node, const std::vector<unsigned int>& rows) const;
+	// Compute an item for every group
+	values_t evaluateGroups(const Table& table, const unsigned int node, const groups_t& groups) const;
+	// Apply an arithmetic operator to whole columns
+	static void arithmetic(const node_t::kind_t kind, std::vector<double>& numbers, const std::vector<double>& other);
+	// Compare two values
+	static bool compare(const Table& table, const std::string& op, const double left_number, const unsigned int left_text, const double right_number, const unsigned int right_text);
+	// Order of two cells when sorting
+	static int compareCells(const Table& table, const cell_t& a, const cell_t& b);
+	// Text of a cell
+	static std::string format(const Table& table, const cell_t& cell);
+
+public:
+	// Parse a query
+	Query(const std::string& text);
+	// Run the query and print the result
+	void run(const Table& table, std::ostream& out, const bool csv) const;
+};
@@ -0,0 +1,300 @@
+#include "schema.hh"
+#include "keys.hh"   // DatKeys
+
+const unsigned int CellRef::MAX_COLUMNS;
+const unsigned int CellRef::MAX_LENGTH;
+const unsigned int Schema::NO_PARAM;
+
+/**
+ * Lookup table with the value of each column letter, 1 for A
+ * up to 26 for Z in both cases, 0 for anything else
+ */
+struct letter_table_t {
+	unsigned char value[256];
+
+	constexpr letter_table_t() : value()
+	{
+		for (int c = 0; c < 26; ++c) {
+			value['A' + c] = c + 1;
+			value['a' + c] = c + 1;
+		}
+	}
+};
+
+static constexpr letter_table_t letter_table;
+
+/**
+ * @brief Parse a cell reference
+ *
+ * Converts the letters and digits of a reference into numbers
+ * without any allocation. Absolute references ($A$1) are accepted.
+ *
+ * @param ref Reference like "AB12"
+ * @param column Will receive the zero based column
+ * @param row Will receive the row
+ *
+ * @return false if the reference is invalid or out of the sheet
+ */
+bool CellRef::parse(const char* ref, unsigned int& column, unsigned int& row)
+{
+	const unsigned char* c = reinterpret_cast<const unsigned char*>(ref);
+	column = 0;
+	row = 0;
+
+	if (*c == '$') {
+		++c;
+	}
+
+	// at most three letters, XFD
+	unsigned int letters = 0;
+	while (letter_table.value[*c] && letters < 3) {
+		column = column * 26 + letter_table.value[*c++];
+		++letters;
+	}
+
+	if (letters == 0 || column > MAX_COLUMNS) {
+		return false;
+	}
+
+	if (*c == '$') {
+		++c;
+	}
+
+	// at most 7 digits, 1048576
+	unsigned int digits = 0;
+	while (*c >= '0' && *c <= '9' && digits < 7) {
+		row = row * 10 + (*c++ - '0');
+		++digits;
+	}
+
+	column--;
+	return digits > 0 && *c == '\0' && row > 0;
+}
+
+/**
+ * @brief Get the letters of a column
+ *
+ * @param column Zero based column
+ *
+ * @return column letters, A for 0, AA for 26 and so on
+ */
+std::string CellRef::column(unsigned int column)
+{
+	char letters[3];
+	unsigned int size = 0;
+
+	// bijective base 26, there's no zero digit
+	column++;
+	do {
+		column--;
+		letters[size++] = 'A' + column % 26;
+		column /= 26;
+	} while (column > 0 && size < 3);
+
+	std::string result;
+	while (size > 0) {
+		result += letters[--size];
+	}
+	return result;
+}
+
+/**
+ * @brief Build a reference from column and row
+ *
+ * @param column Zero based column
+ * @param row Row number
+ *
+ * @return reference like "AB12"
+ */
+std::string CellRef::ref(const unsigned int column, const unsigned int row)
+{
+	return CellRef::column(column) + std::to_string(row);
+}
+
+/**
+ * @brief Get the id of a string
+ *
+ * @param name String to look for
+ *
+ * @return id of the string, a new one if it was not known
+ */
+unsigned int Interner::intern(const std::string& name)
+{
+	auto found = ids.find(name);
+
+	if (found != ids.end()) {
+		return found->second;
+	}
+
+	const unsigned int id = names.size();
+	ids.emplace(name, id);
+	names.push_back(name);
+	return id;
+}
+
+/**
+ * @brief Get the id of a string without adding it
+ *
+ * @param name String to look for
+ * @param id Will receive the id if found
+ *
+ * @return whether the string is known
+ */
+bool Interner::find(const std::string& name, unsigned int& id) const
+{
+	auto found = ids.find(name);
+
+	if (found == ids.end()) {
+		return false;
+	}
+
+	id = found->second;
+	return true;
+}
+
+/**
+ * @brief Get the string of an id
+ *
+ * @param id Id returned by intern
+ *
+ * @return the string
+ */
+const std::string& Interner::name(const unsigned int id) const
+{
+	return names[id];
+}
+
+/**
+ * @brief Number of strings
+ *
+ * @return number of strings, also the id of the next one
+ */
+unsigned int Interner::size() const
+{
+	return names.size();
+}
+
+/**
+ * @brief All strings ordered by id
+ *
+ * @return vector where the index is the id
+ */
+const std::vector<std::string>& Interner::list() const
+{
+	return names;
+}
+
+/**
+ * @brief Remove all columns
+ */
+void Schema::clear()
+{
+	columns.clear();
+}
+
+/**
+ * @brief Set the parameter of a column
+ *
+ * @param column Zero based column
+ * @param param Id of the parameter, known keys must use their
+ * DatKeys id
+ * @param name Name of the parameter
+ * @param variant Variant whose value of the parameter is in the
+ * column, 0 if the value is the same for every variant
+ */
+void Schema::set(const unsigned int column, const unsigned int param, const std::string& name, const unsigned int variant)
+{
+	if (column >= columns.size()) {
+		columns.resize(column + 1, column_t{NO_PARAM, SKIP, std::string(), 0});
+	}
+
+	action_t action = VALUE;
+	if (name.empty()) {
+		action = SKIP;
+	}
+	else if (param == DatKeys::FILENAME) {
+		action = FILENAME;
+	}
+	else if (param == DatKeys::NAME) {
+		action = NAME;
+	}
+	else if (name.front() == '#') {
+		action = COMMENT;
+	}
+
+	// comments are written as "#comment value" and parameters as "param=value"
+	std::string prefix;
+	if (action == COMMENT) {
+		prefix = name + " ";
+	}
+	else if (action != SKIP && action != FILENAME) {
+		prefix = name + "=";
+	}
+
+	columns[column] = column_t{action == SKIP ? NO_PARAM : param, action, prefix, variant};
+}
+
+/**
+ * @brief Get the parameter of a column
+ *
+ * @param column Zero based column
+ *
+ * @return id of the parameter, NO_PARAM if the column has none
+ */
+unsigned int Schema::get(const unsigned int column) const
+{
+	return column < columns.size() ? columns[column].param : NO_PARAM;
+}
+
+/**
+ * @brief Get the variant a column is for
+ *
+ * @param column Zero based column
+ *
+ * @return variant overridden by the column, 0 if the column is for
+ * every variant or has no parameter
+ */
+unsigned int Schema::variant(const unsigned int column) const
+{
+	return column < columns.size() ? columns[column].variant : 0;
+}
+
+/**
+ * @brief Get what must be done with the value of a column
+ *
+ * @param column Zero based column
+ *
+ * @return action of the column, SKIP if the column has no parameter
+ */
+Schema::action_t Schema::action(const unsigned int column) const
+{
+	return column < columns.size() ? columns[column].action : SKIP;
+}
+
+/**
+ * @brief Append the dat line of a column
+ *
+ * Writes the precomputed prefix, the value and a line break
+ * at the end of the dat.
+ *
+ * @param dat Buffer with the dat being built
+ * @param column Zero based column, must have a parameter
+ * @param value Value of the cell
+ */
+void Schema::append(std::string& dat, const unsigned int column, const std::string_view& value) const
+{
+	const std::string& prefix = columns[column].prefix;
+	dat.append(prefix);
+	dat.append(value.data(), value.size());
+	dat.push_back('\n');
+}
+
+/**
+ * @brief Number of columns
+ *
+ * @return number of columns up to the last one with a parameter
+ */
+unsigned int Schema::size() const
+{
+	return columns.size();
+}
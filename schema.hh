@@ -0,0 +1,109 @@
+#pragma once
+#include <string>        // string
+#include <string_view>   // string_view
+#include <vector>        // vector
+#include <unordered_map> // unordered_map
+
+/**
+ * Conversion between spreadsheet cell references and numbers
+ *
+ * Columns are zero based (A = 0) and rows are one based, as
+ * they're written in the reference.
+ */
+class CellRef
+{
+public:
+	/** number of columns in a sheet, A to XFD */
+	static const unsigned int MAX_COLUMNS = 16384;
+	/** longest possible reference, XFD1048576 */
+	static const unsigned int MAX_LENGTH = 10;
+
+	// Parse a reference like "AB12"
+	static bool parse(const char* ref, unsigned int& column, unsigned int& row);
+	// Get the letters of a column
+	static std::string column(unsigned int column);
+	// Build a reference from column and row
+	static std::string ref(const unsigned int column, const unsigned int row);
+};
+
+/**
+ * Assigns a small sequential id to each distinct string
+ */
+class Interner
+{
+	/** id of each string */
+	std::unordered_map<std::string, unsigned int> ids;
+	/** string of each id */
+	std::vector<std::string> names;
+
+public:
+	// Get the id of a string, adding it if not known
+	unsigned int intern(const std::string& name);
+	// Get the id of a string without adding it
+	bool find(const std::string& name, unsigned int& id) const;
+	// Get the string of an id
+	const std::string& name(const unsigned int id) const;
+	// Number of strings
+	unsigned int size() const;
+	// All strings ordered by id
+	const std::vector<std::string>& list() const;
+};
+
+/**
+ * Parameter names of the columns of a sheet
+ *
+ * Built once from the header row, it tells what must be done with
+ * the value of each column and holds the text written before it,
+ * so rows don't need to look at the parameter names again.
+ *
+ * Only grows up to the last column with a parameter, so memory
+ * depends on the columns actually used and not on the sheet limit.
+ */
+class Schema
+{
+public:
+	/** what to do with the value of a column */
+	enum action_t {
+		/** column without parameter, the value is not even read */
+		SKIP,
+		/** value is the dat file name and is not written */
+		FILENAME,
+		/** written as name=value, also the file name without a filename column */
+		NAME,
+		/** written as a comment line */
+		COMMENT,
+		/** written as parameter=value */
+		VALUE
+	};
+
+	/** id of columns without a parameter */
+	static const unsigned int NO_PARAM = ~0u;
+
+private:
+	/** parameter id, action and text written before the value of a column */
+	struct column_t {
+		unsigned int param;
+		action_t action;
+		std::string prefix;
+		/** variant the column overrides the parameter for, 0 for every variant */
+		unsigned int variant;
+	};
+	/** every column up to the last one with a parameter */
+	std::vector<column_t> columns;
+
+public:
+	// Remove all columns
+	void clear();
+	// Set the parameter of a column
+	void set(const unsigned int column, const unsigned int param, const std::string& name, const unsigned int variant = 0);
+	// Get the parameter of a column
+	unsigned int get(const unsigned int column) const;
+	// Get the variant a column is for
+	unsigned int variant(const unsigned int column) const;
+	// Get what must be done with the value of a column
+	action_t action(const unsigned int column) const;
+	// Append the dat line of a column
+	void append(std::string& dat, const unsigned int column, const std::string_view& value) const;
+	// Number of columns up to the last one with a parameter
+	unsigned int size() const;
+};
@@ -0,0 +1,464 @@
+#include <iostream>  // clog
+#include <sstream>   // ostringstream
+#include <cstring>   // strerror, strncpy
+#include <cerrno>    // errno
+#include <cstdlib>   // strtoll
+#include <stdexcept> // runtime_error
+#include <algorithm> // replace
+#include <memory>    // unique_ptr
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+#endif
+
+#include "server.hh"
+#include "workbook.hh"
+#include "output.hh"
+
+/**
+ * @brief Load the workbooks
+ *
+ * Every workbook is parsed into memory before the socket is
+ * opened, so the first requests are already answered from memory.
+ *
+ * @param socket_path Location of the unix socket to create
+ * @param files Workbooks to keep loaded
+ */
+Server::Server(const std::string& socket_path, const std::vector<std::string>& files) : generation(0), socket_path(socket_path), stopping(false)
+{
+	for (auto const& file : files) {
+		workbook_t workbook;
+		workbook.path = file;
+		workbook.mtime = 0;
+		workbook.size = -1;
+		workbooks.push_back(workbook);
+	}
+
+	refresh();
+}
+
+/**
+ * @brief Reload workbooks whose file changed
+ *
+ * Compares modification time and size with the ones of the last
+ * load, this is cheap enough to be done before every request.
+ */
+void Server::refresh()
+{
+	for (auto& workbook : workbooks) {
+		struct stat info;
+
+		if (stat(workbook.path.c_str(), &info) == 0 && (info.st_mtime != workbook.mtime || info.st_size != workbook.size)) {
+			workbook.mtime = info.st_mtime;
+			workbook.size = info.st_size;
+			load(workbook);
+		}
+	}
+}
+
+/**
+ * @brief Load a workbook
+ *
+ * Parses the workbook into memory and compares the result with
+ * the previous load to record the dats that changed. If parsing
+ * fails the previous dats are kept.
+ *
+ * @param workbook Workbook to be loaded
+ */
+void Server::load(workbook_t& workbook)
+{
+	std::map<std::string, std::string> dats;
+
+	try {
+		DatOutput output;
+		output.capture(dats);
+
+		std::unique_ptr<Workbook> reader = Workbook::open(workbook.path);
+		reader->setOutput(output);
+		reader->parse();
+	}
+	catch (const std::runtime_error& e) {
+		std::clog << "datSheet : error " << e.what() << std::endl;
+		return;
+	}
+
+	generation++;
+
+	// new or modified dats
+	for (auto const& dat : dats) {
+		auto old = workbook.dats.find(dat.first);
+		if (old == workbook.dats.end() || old->second != dat.second) {
+			changes[dat.first] = generation;
+		}
+	}
+	// removed dats
+	for (auto const& dat : workbook.dats) {
+		if (dats.find(dat.first) == dats.end()) {
+			changes[dat.first] = -generation;
+		}
+	}
+
+	workbook.dats.swap(dats);
+	std::clog << workbook.path << " : loaded at generation " << generation << "\n";
+}
+
+/**
+ * @brief Answer a request
+ *
+ * Requests are a single line, a command followed by its argument:
+ * - `EXPORT <sheet>` writes the dats of matching sheets on disk
+ * - `GET <object>` returns the content of a dat
+ * - `CHANGES <token>` lists dats changed since token
+ * - `STOP` stops the server
+ *
+ * @param request Request line without the line break
+ *
+ * @return `OK <size>\n` followed by size bytes of answer, or
+ * `ERR <message>\n`
+ */
+std::string Server::handle(const std::string& request)
+{
+	const std::string::size_type space = request.find(' ');
+	const std::string command = request.substr(0, space);
+	const std::string argument = (space == std::string::npos ? "" : request.substr(space + 1));
+
+	// make sure answers reflect the files on disk
+	refresh();
+
+	std::string answer;
+	try {
+		if (command == "EXPORT") {
+			answer = exportSheets(argument);
+		}
+		else if (command == "GET") {
+			answer = getObject(argument);
+		}
+		else if (command == "CHANGES") {
+			answer = listChanges(argument);
+		}
+		else if (command == "STOP") {
+			stopping = true;
+		}
+		else {
+			return "ERR Unknown request " + command + "\n";
+		}
+	}
+	catch (const std::runtime_error& e) {
+		return std::string("ERR ") + e.what() + "\n";
+	}
+
+	return "OK " + std::to_string(answer.size()) + "\n" + answer;
+}
+
+/**
+ * @brief Write matching sheets on disk
+ *
+ * Dats are written from memory, the workbook is not parsed again.
+ *
+ * @param pattern Glob pattern matched against the sheet name,
+ * with either `;` or `/` as separator
+ *
+ * @return number of dats written, throws if any could not be
+ */
+std::string Server::exportSheets(const std::string& pattern)
+{
+	DatOutput output;
+	unsigned int written = 0;
+	std::vector<std::string> patterns(1, pattern.empty() ? "*" : pattern);
+
+	for (auto const& workbook : workbooks) {
+		for (auto const& dat : workbook.dats) {
+			// the sheet is the directory of the dat
+			const std::string::size_type slash = dat.first.rfind('/');
+			std::string dir = (slash == std::string::npos ? "" : dat.first.substr(0, slash));
+			std::string sheet_name = dir;
+			std::replace(sheet_name.begin(), sheet_name.end(), '/', ';');
+			if (sheet_name.empty()) {
+				sheet_name = ";";
+			}
+
+			if (!Workbook::matchesAny(patterns, sheet_name) && !Workbook::matchesAny(patterns, dir)) {
+				continue;
+			}
+
+			// dats in memory already include appended objects
+			if (output.write(dat.first.substr(0, dat.first.size() - 4), dat.second, false)) {
+				throw std::runtime_error("Could not write " + dat.first);
+			}
+			written++;
+		}
+	}
+
+	// dats are written by the writer thread, failures come from flush
+	const std::vector<DatOutput::failure_t> failures = output.flush();
+	if (!failures.empty()) {
+		std::ostringstream error;
+		error << failures.size() << " of " << written << " dats could not be written:";
+		for (auto const& failure : failures) {
+			error << " FDATOUT" << failure.code << ":" << failure.filename << ".dat";
+		}
+		throw std::runtime_error(error.str());
+	}
+
+	return std::to_string(written) + "\n";
+}
+
+/**
+ * @brief Get the content of a dat
+ *
+ * @param name Name of the dat without extension, if it contains
+ * a `/` it's matched against the whole path. Globs are accepted,
+ * the first match in path order is returned.
+ *
+ * @return content of the dat
+ */
+std::string Server::getObject(const std::string& name)
+{
+	std::vector<std::string> patterns(1, name);
+	const bool whole_path = name.find('/') != std::string::npos;
+
+	for (auto const& workbook : workbooks) {
+		for (auto const& dat : workbook.dats) {
+			std::string object = dat.first.substr(0, dat.first.size() - 4);
+			if (!whole_path) {
+				object = object.substr(object.rfind('/') + 1);
+			}
+
+			if (Workbook::matchesAny(patterns, object)) {
+				return dat.second;
+			}
+		}
+	}
+
+	throw std::runtime_error("No object " + name);
+}
+
+/**
+ * @brief List dats changed since a generation
+ *
+ * @param token Generation returned by a previous request, 0 or
+ * empty lists every dat
+ *
+ * @return the current generation as the new token in the first
+ * line, followed by one line per dat, `M path` if it was added or
+ * modified, `D path` if it was removed
+ */
+std::string Server::listChanges(const std::string& token)
+{
+	const long long since = std::strtoll(token.c_str(), nullptr, 10);
+	std::ostringstream answer;
+
+	answer << generation << "\n";
+	for (auto const& change : changes) {
+		if (change.second > since) {
+			answer << "M " << change.first << "\n";
+		}
+		else if (-change.second > since) {
+			answer << "D " << change.first << "\n";
+		}
+	}
+
+	return answer.str();
+}
+
+/**
+ * @brief Answer the next request received from a client
+ *
+ * Only one answer is queued at a time, so a client that doesn't
+ * read its answers stops being read instead of filling memory.
+ *
+ * @param client Client with data received
+ */
+void Server::answerNext(client_t& client)
+{
+	const std::string::size_type end = client.received.find('\n');
+	if (!client.answer.empty() || end == std::string::npos) {
+		return;
+	}
+
+	std::string request = client.received.substr(0, end);
+	client.received.erase(0, end + 1);
+	if (!request.empty() && request.back() == '\r') {
+		request.pop_back();
+	}
+
+	client.answer = handle(request);
+}
+
+#ifndef _WIN32
+/**
+ * @brief Read what a client sent
+ *
+ * @param fd Socket of the client, non-blocking
+ * @param client The client
+ *
+ * @return false if the client is gone or must be dropped
+ */
+bool Server::receive(const int fd, client_t& client)
+{
+	char buffer[4096];
+	ssize_t size;
+
+	do {
+		size = recv(fd, buffer, sizeof(buffer), 0);
+	} while (size < 0 && errno == EINTR);
+
+	if (size < 0) {
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+	}
+	if (size == 0) {
+		return false;
+	}
+
+	client.received.append(buffer, size);
+
+	// a request can't be longer than that, the client is not talking to us
+	if (client.received.size() > MAX_REQUEST && client.received.find('\n') == std::string::npos) {
+		std::clog << socket_path << " : Request warning SRV2:Client dropped, request longer than " << MAX_REQUEST << " bytes\n";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Send as much of the answer as the client takes
+ *
+ * @param fd Socket of the client, non-blocking
+ * @param client The client
+ *
+ * @return false if the client is gone
+ */
+bool Server::sendAnswer(const int fd, client_t& client)
+{
+	while (!client.answer.empty()) {
+		const ssize_t sent = send(fd, client.answer.data(), client.answer.size(), 0);
+
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// the rest waits until the client reads
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		client.answer.erase(0, sent);
+	}
+
+	return true;
+}
+#endif
+
+/**
+ * @brief Answer requests until stopped
+ *
+ * Listens on the unix socket and answers each request line of
+ * every connected client. Clients are non-blocking and answers are
+ * sent when the client is ready for them, so a slow client never
+ * holds up the others. Workbooks are checked for changes every
+ * second even without requests so they're ready when asked.
+ */
+void Server::run()
+{
+#ifdef _WIN32
+	throw std::runtime_error("SRV0:Server mode is not supported on Windows");
+#else
+	struct sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (socket_path.size() >= sizeof(address.sun_path)) {
+		throw std::runtime_error("SRV1:Socket path is too long: " + socket_path);
+	}
+	std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+	// remove a socket left by a previous run, but nothing else
+	struct stat info;
+	if (lstat(socket_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+		unlink(socket_path.c_str());
+	}
+
+	const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 16) < 0) {
+		std::ostringstream err_msg;
+		err_msg << "SRV" << errno << ":" << std::strerror(errno) << ": " << socket_path;
+		if (listener >= 0) {
+			close(listener);
+		}
+		throw std::runtime_error(err_msg.str());
+	}
+
+	// a client leaving before its answer is sent is not an error
+	signal(SIGPIPE, SIG_IGN);
+
+	std::clog << "Serving on " << socket_path << "\n";
+
+	// first is the listener, then one per client
+	std::vector<struct pollfd> fds(1, pollfd{listener, POLLIN, 0});
+	std::vector<client_t> clients(1);
+
+	while (!stopping) {
+		// clients with an answer waiting are not read until it's sent
+		for (unsigned int i = 1; i < fds.size(); ++i) {
+			fds[i].events = (clients[i].answer.empty() ? POLLIN : POLLOUT);
+		}
+
+		if (poll(fds.data(), fds.size(), 1000) <= 0) {
+			refresh();
+			continue;
+		}
+
+		// new client
+		if (fds[0].revents & POLLIN) {
+			const int client = accept(listener, nullptr, nullptr);
+			if (client >= 0) {
+				fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+				fds.push_back(pollfd{client, POLLIN, 0});
+				clients.push_back(client_t());
+			}
+		}
+
+		for (unsigned int i = 1; i < fds.size() && !stopping; ++i) {
+			if (!fds[i].revents) {
+				continue;
+			}
+
+			bool connected;
+			if (fds[i].events & POLLOUT) {
+				connected = !(fds[i].revents & (POLLERR | POLLHUP)) && sendAnswer(fds[i].fd, clients[i]);
+			}
+			else {
+				connected = receive(fds[i].fd, clients[i]);
+			}
+
+			// answer what was received while nothing waits to be sent
+			while (connected && clients[i].answer.empty() && clients[i].received.find('\n') != std::string::npos && !stopping) {
+				answerNext(clients[i]);
+				connected = sendAnswer(fds[i].fd, clients[i]);
+			}
+
+			if (!connected) {
+				close(fds[i].fd);
+				fds.erase(fds.begin() + i);
+				clients.erase(clients.begin() + i);
+				--i;
+			}
+		}
+	}
+
+	// last answers, like the one to STOP, if the clients take them
+	for (unsigned int i = 1; i < fds.size(); ++i) {
+		sendAnswer(fds[i].fd, clients[i]);
+	}
+	for (auto const& fd : fds) {
+		close(fd.fd);
+	}
+	unlink(socket_path.c_str());
+#endif
+}
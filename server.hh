@@ -0,0 +1,69 @@
+#pragma once
+#include <string>      // string
+#include <vector>      // vector
+#include <map>         // map
+#include <ctime>       // time_t
+
+/**
+ * Resident daemon answering requests over a local socket
+ *
+ * Keeps the dats of the workbooks in memory, reloading a workbook
+ * whenever its file changes, so clients get answers without
+ * opening and parsing the xlsx again.
+ */
+class Server
+{
+	/** a workbook kept in memory */
+	struct workbook_t {
+		std::string path;
+		/** modification time and size when it was last loaded */
+		std::time_t mtime;
+		long long size;
+		/** every dat generated from the workbook, indexed by path */
+		std::map<std::string, std::string> dats;
+	};
+	/** loaded workbooks */
+	std::vector<workbook_t> workbooks;
+	/** generation when each dat was last changed, negative if removed */
+	std::map<std::string, long long> changes;
+	/** incremented every time a workbook is reloaded */
+	long long generation;
+	/** location of the unix socket */
+	std::string socket_path;
+	/** set by the STOP request */
+	bool stopping;
+	/** a connected client */
+	struct client_t {
+		/** data received and not answered yet */
+		std::string received;
+		/** answer not sent yet, requests wait until it's sent */
+		std::string answer;
+	};
+	/** longest request accepted, clients sending longer lines are dropped */
+	static const std::string::size_type MAX_REQUEST = 65536;
+
+	// Reload workbooks whose file changed
+	void refresh();
+	// Load a workbook and record which dats changed
+	void load(workbook_t& workbook);
+	// Answer a request
+	std::string handle(const std::string& request);
+	// Write matching sheets on disk
+	std::string exportSheets(const std::string& pattern);
+	// Get the content of a dat
+	std::string getObject(const std::string& name);
+	// List dats changed since a generation
+	std::string listChanges(const std::string& token);
+	// Answer the next request received from a client
+	void answerNext(client_t& client);
+	// Read what a client sent
+	bool receive(const int fd, client_t& client);
+	// Send as much of the answer as the client takes
+	bool sendAnswer(const int fd, client_t& client);
+
+public:
+	// Load the workbooks
+	Server(const std::string& socket_path, const std::vector<std::string>& files);
+	// Answer requests until stopped
+	void run();
+};
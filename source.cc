@@ -0,0 +1,532 @@
+#include <sstream>   // ostringstream
+#include <fstream>   // ifstream
+#include <string>    // string
+#include <utility>   // move
+#include <cstring>   // strcmp, strlen, strrchr, strerror, memchr, memcmp
+#include <cstdio>    // snprintf
+#include <cctype>    // tolower
+#include <cerrno>    // errno
+#include <algorithm> // stable_sort, replace, lower_bound
+#include <stdexcept> // runtime_error
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <dirent.h>
+#endif
+#include <sys/stat.h>
+
+#include "source.hh"
+
+/**
+ * @brief Destroy object
+ */
+DatSource::~DatSource()
+{
+}
+
+/**
+ * @brief Open a pakset choosing the source by its type
+ *
+ * Files ending in `.tar` and `.zip` are read as archives, anything
+ * else is taken as a directory.
+ *
+ * @param root Path of the pakset
+ *
+ * @return source of the dats
+ */
+std::unique_ptr<DatSource> DatSource::open(const std::string& root)
+{
+	struct stat info;
+
+	if (stat(root.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFREG) {
+		std::string extension = root.substr(root.size() < 4 ? 0 : root.size() - 4);
+		for (char& c : extension) {
+			c = std::tolower((unsigned char)c);
+		}
+
+		if (extension == ".tar") {
+			return std::unique_ptr<DatSource>(new TarSource(root));
+		}
+		if (extension == ".zip") {
+			return std::unique_ptr<DatSource>(new ZipSource(root));
+		}
+	}
+
+	return std::unique_ptr<DatSource>(new DirSource(root));
+}
+
+/**
+ * @brief Read a directory tree
+ *
+ * Nothing is read until the directories are listed.
+ *
+ * @param dirname Root directory of the pakset
+ */
+DirSource::DirSource(const std::string& dirname) : root(dirname)
+{
+	if (!root.empty() && root.back() != '/' && root.back() != '\\') {
+		root += "/";
+	}
+}
+
+/**
+ * @brief List the subdirectories and dat files of a directory
+ *
+ * Only files with extension .dat are listed, both lists are
+ * sorted so the pakset is always visited in the same order.
+ *
+ * @param dir Directory relative to the root
+ * @param dirs Receives the names of the subdirectories
+ * @param dats Receives the dat files
+ */
+void DirSource::list(const std::string& dir, std::vector<std::string>& dirs, std::vector<entry_t>& dats)
+{
+	const std::string dir_name = root + dir + (dir.empty() ? "" : "/");
+	std::vector<std::string> names;
+
+#ifdef _WIN32
+	// Windows only
+	HANDLE handle;
+	WIN32_FIND_DATAA ent;
+	const std::string find_term = dir_name + "*";
+
+	// try starting it up and fail if no handle found
+	if ((handle = FindFirstFileA(find_term.c_str(), &ent)) == INVALID_HANDLE_VALUE) {
+		std::ostringstream err_msg;
+		err_msg << "WRD" << errno << ":" << strerror(errno);
+		throw std::runtime_error(err_msg.str());
+	}
+
+	// do first to include result from FindFirstFile
+	do {
+		// skip those two
+		if (std::strcmp(ent.cFileName, ".") && std::strcmp(ent.cFileName, "..")) {
+			const char* extension = std::strrchr(ent.cFileName, '.');
+
+			// directories are added to dirs list
+			if (ent.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+				dirs.push_back(ent.cFileName);
+			}
+			// files that have extension .dat are added to dats list
+			else if (extension != NULL && !std::strcmp(extension, ".dat")) {
+				names.push_back(ent.cFileName);
+			}
+		}
+	} while (FindNextFileA(handle, &ent));
+
+	FindClose(handle);
+#else
+	// Other platforms (Linux/OpenBSD)
+	DIR *handle;
+	struct dirent *ent;
+
+	// failed opening directory
+	if ((handle = opendir(dir_name.c_str())) == NULL) {
+		std::ostringstream err_msg;
+		err_msg << "URD" << errno << ":" << strerror(errno);
+		throw std::runtime_error(err_msg.str());
+	}
+
+	// read directory
+	while ((ent = readdir(handle)) != NULL) {
+		// skip those two
+		if (std::strcmp(ent->d_name, ".") && std::strcmp(ent->d_name, "..")) {
+			const char* extension = std::strrchr(ent->d_name, '.');
+
+			// directories are added to dirs list
+			if (ent->d_type == DT_DIR) {
+				dirs.push_back(ent->d_name);
+			}
+			// regular files that have extension .dat are added to dats list
+			else if (ent->d_type == DT_REG && extension != NULL && !std::strcmp(extension, ".dat")) {
+				names.push_back(ent->d_name);
+			}
+		}
+	}
+	closedir(handle);
+#endif
+
+	// always visit in the same order, readdir order depends on the file system
+	std::sort(dirs.begin(), dirs.end());
+	std::sort(names.begin(), names.end());
+
+	for (auto const& name : names) {
+		struct stat info;
+		entry_t entry{name, 0, 0};
+
+		if (stat((dir_name + name).c_str(), &info) == 0) {
+			entry.size = (unsigned long long)info.st_size;
+			entry.mtime = (long long)info.st_mtime;
+		}
+		dats.push_back(entry);
+	}
+}
+
+/**
+ * @brief Read a dat file
+ *
+ * @param path Path of the dat relative to the root
+ * @param data Receives the content of the file
+ *
+ * @return false if the file could not be opened
+ */
+bool DirSource::read(const std::string& path, std::string& data)
+{
+	std::ifstream file(root + path);
+	data.clear();
+
+	if (!file.is_open()) {
+		return false;
+	}
+
+	std::getline(file, data, '\0');
+	return true;
+}
+
+/**
+ * @brief Add a file found in the archive
+ *
+ * Only dat files are kept, their directory and every parent
+ * are added to the index.
+ *
+ * @param path Path of the file inside the archive
+ * @param size Size of the file
+ * @param mtime Modification time of the file
+ * @param location Where the content is, meaning depends on the archive
+ */
+void ArchiveSource::addEntry(std::string path, const unsigned long long size, const long long mtime, const unsigned long long location)
+{
+	std::replace(path.begin(), path.end(), '\\', '/');
+
+	// paths like ./dir/file.dat or /dir/file.dat
+	while (!path.compare(0, 2, "./") || !path.compare(0, 1, "/")) {
+		path.erase(0, path[0] == '/' ? 1 : 2);
+	}
+
+	const std::string::size_type slash = path.rfind('/');
+	const std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+	const std::string::size_type dot = name.rfind('.');
+	if (dot == std::string::npos || name.compare(dot, std::string::npos, ".dat")) {
+		return;
+	}
+
+	std::string dir = (slash == std::string::npos ? "" : path.substr(0, slash));
+	// duplicates are only removed once everything is added, checking each would be quadratic
+	index[dir].files.push_back(file_t{entry_t{name, size, mtime}, location});
+
+	// make every parent know its subdirectory
+	while (!dir.empty()) {
+		const std::string::size_type parent_slash = dir.rfind('/');
+		const std::string parent = (parent_slash == std::string::npos ? "" : dir.substr(0, parent_slash));
+		index[parent].dirs.insert(dir.substr(parent_slash == std::string::npos ? 0 : parent_slash + 1));
+		dir = parent;
+	}
+}
+
+/**
+ * @brief Sort the dats and choose the root once every entry is added
+ *
+ * A path found twice keeps the last entry, like when extracting.
+ */
+void ArchiveSource::finishIndex()
+{
+	for (auto& dir : index) {
+		std::vector<file_t>& files = dir.second.files;
+
+		// stable so entries with the same name stay in archive order
+		std::stable_sort(files.begin(), files.end(), [](const file_t& a, const file_t& b) {
+			return a.entry.name < b.entry.name;
+		});
+
+		std::vector<file_t>::size_type kept = 0;
+		for (std::vector<file_t>::size_type i = 0; i < files.size(); ++i) {
+			if (i + 1 == files.size() || files[i + 1].entry.name != files[i].entry.name) {
+				if (kept != i) {
+					files[kept] = std::move(files[i]);
+				}
+				kept++;
+			}
+		}
+		files.erase(files.begin() + kept, files.end());
+	}
+
+	// a compressed pakset folder has it as the only thing at the top
+	auto top = index.find("");
+	if (top != index.end() && top->second.files.empty() && top->second.dirs.size() == 1) {
+		root = *top->second.dirs.begin();
+	}
+}
+
+/**
+ * @brief Find where a dat is in the archive
+ *
+ * @param path Path of the dat relative to the root
+ * @param location Receives where the content is
+ * @param size Receives the size of the content
+ *
+ * @return false if the archive has no such dat
+ */
+bool ArchiveSource::locate(const std::string& path, unsigned long long& location, unsigned long long& size) const
+{
+	const std::string full = (root.empty() ? path : root + "/" + path);
+	const std::string::size_type slash = full.rfind('/');
+	const std::string name = full.substr(slash == std::string::npos ? 0 : slash + 1);
+
+	auto dir = index.find(slash == std::string::npos ? "" : full.substr(0, slash));
+	if (dir == index.end()) {
+		return false;
+	}
+
+	const std::vector<file_t>& files = dir->second.files;
+	auto file = std::lower_bound(files.begin(), files.end(), name, [](const file_t& a, const std::string& b) {
+		return a.entry.name < b;
+	});
+	if (file == files.end() || file->entry.name != name) {
+		return false;
+	}
+
+	location = file->location;
+	size = file->entry.size;
+	return true;
+}
+
+/**
+ * @brief List the subdirectories and dat files of a directory
+ *
+ * @param dir Directory relative to the root
+ * @param dirs Receives the names of the subdirectories, sorted
+ * @param dats Receives the dat files, sorted
+ */
+void ArchiveSource::list(const std::string& dir, std::vector<std::string>& dirs, std::vector<entry_t>& dats)
+{
+	auto found = index.find(root.empty() ? dir : dir.empty() ? root : root + "/" + dir);
+	if (found == index.end()) {
+		return;
+	}
+
+	dirs.insert(dirs.end(), found->second.dirs.begin(), found->second.dirs.end());
+	for (auto const& file : found->second.files) {
+		dats.push_back(file.entry);
+	}
+}
+
+/**
+ * @brief Index a tar archive
+ *
+ * Reads every header, skipping over the content. Long names of
+ * GNU and pax archives are supported, entries other than regular
+ * files are ignored.
+ *
+ * @param filename Path of the archive
+ */
+TarSource::TarSource(const std::string& filename) : file(filename)
+{
+	if (!file.isOpen()) {
+		std::ostringstream err_msg;
+		err_msg << "TAR" << errno << ":Could not read archive: " << filename;
+		// send to main
+		throw std::runtime_error(err_msg.str());
+	}
+
+	const char* data = file.data();
+	const unsigned long long size = file.size();
+	unsigned long long pos = 0;
+	std::string long_name;
+
+	// an archive ends with blocks of zeros, or just ends
+	while (pos + 512 <= size && data[pos] != '\0') {
+		const char* header = data + pos;
+		unsigned long long checksum;
+		unsigned long long entry_size;
+		unsigned long long mtime;
+
+		// the checksum is computed with its own field as spaces
+		unsigned long long sum = 8 * ' ';
+		for (unsigned int i = 0; i < 512; ++i) {
+			sum += (i >= 148 && i < 156) ? 0 : (unsigned char)header[i];
+		}
+
+		if (!headerNumber(header + 148, 8, checksum) || checksum != sum || !headerNumber(header + 124, 12, entry_size) || !headerNumber(header + 136, 12, mtime) || entry_size > size - pos - 512) {
+			std::ostringstream err_msg;
+			err_msg << "TAR0:Not a valid tar archive at byte " << pos << ": " << filename;
+			// send to main
+			throw std::runtime_error(err_msg.str());
+		}
+
+		const char type = header[156];
+		const char* content = header + 512;
+
+		// GNU long name, the content is the name of the next entry
+		if (type == 'L') {
+			const char* end = (const char*)std::memchr(content, '\0', entry_size);
+			long_name.assign(content, end != nullptr ? end : content + entry_size);
+		}
+		// pax extended header, made of "length key=value\n" records
+		else if (type == 'x') {
+			const char* record = content;
+			const char* end = content + entry_size;
+
+			while (record < end) {
+				unsigned long long length = 0;
+				const char* c = record;
+				// stops once too long, before the length can overflow
+				while (c < end && *c >= '0' && *c <= '9' && length <= (unsigned long long)(end - record)) {
+					length = length * 10 + (*c++ - '0');
+				}
+				if (c == end || *c != ' ' || length == 0 || length > (unsigned long long)(end - record)) {
+					break;
+				}
+				if (end - c > 5 && !std::memcmp(c + 1, "path=", 5)) {
+					// the value ends before the line break closing the record
+					if ((unsigned long long)(c + 6 - record) > length - 1) {
+						std::ostringstream err_msg;
+						err_msg << "TAR0:Not a valid tar archive at byte " << pos << ": " << filename;
+						// send to main
+						throw std::runtime_error(err_msg.str());
+					}
+					long_name.assign(c + 6, record + length - 1);
+				}
+				record += length;
+			}
+		}
+		// global pax headers and long link names don't name the next entry
+		else if (type != 'g' && type != 'K') {
+			// regular files, including the old and contiguous types
+			if (type == '0' || type == '\0' || type == '7') {
+				std::string path = long_name;
+
+				if (path.empty()) {
+					const char* name_end = (const char*)std::memchr(header, '\0', 100);
+					path.assign(header, name_end != nullptr ? name_end : header + 100);
+
+					// ustar splits long names in prefix and name
+					if (!std::memcmp(header + 257, "ustar", 5) && header[345] != '\0') {
+						const char* prefix_end = (const char*)std::memchr(header + 345, '\0', 155);
+						path = std::string(header + 345, prefix_end != nullptr ? prefix_end : header + 500) + "/" + path;
+					}
+				}
+
+				addEntry(path, entry_size, (long long)mtime, pos + 512);
+			}
+			long_name.clear();
+		}
+
+		pos += 512 + (entry_size + 511) / 512 * 512;
+	}
+
+	finishIndex();
+}
+
+/**
+ * @brief Read a number of a tar header
+ *
+ * Numbers are octal text, big ones may be in base 256 with the
+ * highest bit of the first byte set.
+ *
+ * @param field Start of the field
+ * @param size Size of the field
+ * @param number Receives the number
+ *
+ * @return false if the field is not a number
+ */
+bool TarSource::headerNumber(const char* field, const unsigned int size, unsigned long long& number)
+{
+	unsigned int i = 0;
+	number = 0;
+
+	if ((unsigned char)field[0] & 0x80) {
+		number = (unsigned char)field[0] & 0x7F;
+		for (i = 1; i < size; ++i) {
+			if (number >> 56) {
+				return false;
+			}
+			number = (number << 8) | (unsigned char)field[i];
+		}
+		return true;
+	}
+
+	while (i < size && field[i] == ' ') {
+		i++;
+	}
+	for (; i < size && field[i] >= '0' && field[i] <= '7'; ++i) {
+		number = (number << 3) | (field[i] - '0');
+	}
+	// the number ends with spaces or zeros
+	for (; i < size; ++i) {
+		if (field[i] != ' ' && field[i] != '\0') {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Read a dat file
+ *
+ * @param path Path of the dat relative to the root
+ * @param data Receives the content of the file
+ *
+ * @return false if the archive has no such dat
+ */
+bool TarSource::read(const std::string& path, std::string& data)
+{
+	unsigned long long location;
+	unsigned long long size;
+
+	if (!locate(path, location, size)) {
+		data.clear();
+		return false;
+	}
+
+	data.assign(file.data() + location, size);
+	return true;
+}
+
+/**
+ * @brief Index a zip archive
+ *
+ * @param filename Path of the archive
+ */
+ZipSource::ZipSource(const std::string& filename) : archive(filename)
+{
+	if (!archive.open(libzippp::ZipArchive::ReadOnly)) {
+		std::ostringstream err_msg;
+		err_msg << "ZIP" << errno << ":Could not open archive: " << filename;
+		// send to main
+		throw std::runtime_error(err_msg.str());
+	}
+
+	for (auto const& entry : archive.getEntries()) {
+		if (entry.isFile()) {
+			addEntry(entry.getName(), entry.getSize(), (long long)entry.getDate(), names.size());
+			names.push_back(entry.getName());
+		}
+	}
+
+	finishIndex();
+}
+
+/**
+ * @brief Read a dat file
+ *
+ * @param path Path of the dat relative to the root
+ * @param data Receives the content of the file
+ *
+ * @return false if the archive has no such dat
+ */
+bool ZipSource::read(const std::string& path, std::string& data)
+{
+	unsigned long long location;
+	unsigned long long size;
+
+	if (!locate(path, location, size)) {
+		data.clear();
+		return false;
+	}
+
+	data = archive.getEntry(names[location]).readAsText();
+	return true;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <string>      // string
+#include <vector>      // vector
+#include <map>         // map
+#include <set>         // set
+#include <memory>      // unique_ptr
+#include <libzippp\libzippp.h>     // libzip++
+#include "mapped.hh"   // MappedFile
+
+/**
+ * Pakset read by the importer
+ *
+ * Gives the dat files and subdirectories of each directory of a
+ * pakset and the content of the dats, wherever they are stored.
+ * Paths are relative to the root of the pakset, with `/` as
+ * separator and no leading or trailing slash, the root is "".
+ */
+class DatSource
+{
+public:
+	/** a dat file */
+	struct entry_t {
+		/** name of the file, without directory */
+		std::string name;
+		unsigned long long size;
+		/** modification time, 0 if not known */
+		long long mtime;
+	};
+
+	// Destructor
+	virtual ~DatSource();
+	// List the subdirectories and dat files of a directory
+	virtual void list(const std::string& dir, std::vector<std::string>& dirs, std::vector<entry_t>& dats) = 0;
+	// Read a dat file
+	virtual bool read(const std::string& path, std::string& data) = 0;
+	// Open a pakset choosing the source by its type
+	static std::unique_ptr<DatSource> open(const std::string& root);
+};
+
+/**
+ * Pakset in a directory tree on disk
+ */
+class DirSource : public DatSource
+{
+	/** root directory with ending slash */
+	std::string root;
+
+public:
+	// Read a directory tree
+	DirSource(const std::string& dirname);
+	// List the subdirectories and dat files of a directory
+	void list(const std::string& dir, std::vector<std::string>& dirs, std::vector<entry_t>& dats) override;
+	// Read a dat file
+	bool read(const std::string& path, std::string& data) override;
+};
+
+/**
+ * Pakset inside an archive
+ *
+ * Every entry is indexed when opening, directories only exist
+ * as part of the paths so archives without directory entries
+ * work too. When the archive holds a single directory with
+ * everything inside, like when a pakset folder is compressed,
+ * that directory is the root.
+ */
+class ArchiveSource : public DatSource
+{
+protected:
+	/** a dat and where it is in the archive */
+	struct file_t {
+		entry_t entry;
+		unsigned long long location;
+	};
+	/** a directory of the archive */
+	struct dir_t {
+		std::set<std::string> dirs;
+		/** sorted by name once every entry is added */
+		std::vector<file_t> files;
+	};
+	/** every directory by path */
+	std::map<std::string, dir_t> index;
+	/** path of the directory used as root */
+	std::string root;
+
+	// Add a file found in the archive
+	void addEntry(std::string path, const unsigned long long size, const long long mtime, const unsigned long long location);
+	// Sort the dats and choose the root once every entry is added
+	void finishIndex();
+	// Find where a dat is in the archive
+	bool locate(const std::string& path, unsigned long long& location, unsigned long long& size) const;
+
+public:
+	// List the subdirectories and dat files of a directory
+	void list(const std::string& dir, std::vector<std::string>& dirs, std::vector<entry_t>& dats) override;
+};
+
+/**
+ * Pakset in an uncompressed tar archive
+ *
+ * The archive is memory mapped and dats are read from the mapping
+ * in place, in the order of the sorted index like any other source.
+ */
+class TarSource : public ArchiveSource
+{
+	MappedFile file;
+
+	// Read a number of a tar header
+	static bool headerNumber(const char* field, const unsigned int size, unsigned long long& number);
+
+public:
+	// Index a tar archive
+	TarSource(const std::string& filename);
+	// Read a dat file
+	bool read(const std::string& path, std::string& data) override;
+};
+
+/**
+ * Pakset in a zip archive
+ */
+class ZipSource : public ArchiveSource
+{
+	libzippp::ZipArchive archive;
+	/** name of each entry in the zip, indexed by location */
+	std::vector<std::string> names;
+
+public:
+	// Index a zip archive
+	ZipSource(const std::string& filename);
+	// Read a dat file
+	bool read(const std::string& path, std::string& data) override;
+};
@@ -0,0 +1,174 @@
+#include <iostream>       // cout, cerr, endl
+#include <fstream>        // ifstream
+#include <iterator>       // istreambuf_iterator
+#include <vector>         // vector
+#include <string>         // string
+#include <algorithm>      // sort
+#include <chrono>         // steady_clock
+#include <cstdlib>        // strtoul
+#include <new>            // set_new_handler
+#include <cstring>        // strcmp, strsignal
+#include <cerrno>         // errno
+#include <csignal>        // SIGALRM
+#include <sys/types.h>
+#include <sys/stat.h>     // stat
+#include <sys/resource.h> // setrlimit
+#include <sys/wait.h>     // waitpid
+#include <unistd.h>       // fork, alarm
+#include <dirent.h>       // opendir
+#include "harness.hh"     // LLVMFuzzerTestOneInput
+
+/** exit code of an input stopped at the memory limit */
+static const int OUT_OF_MEMORY = 99;
+
+/**
+ * @brief Add an input, or every file of a directory
+ *
+ * @param path File or directory
+ * @param inputs Files to run
+ */
+static void addInputs(const std::string& path, std::vector<std::string>& inputs)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+		inputs.push_back(path);
+		return;
+	}
+
+	DIR* dir = opendir(path.c_str());
+	if (dir == nullptr) {
+		inputs.push_back(path);
+		return;
+	}
+
+	std::vector<std::string> files;
+	while (const struct dirent* entry = readdir(dir)) {
+		const std::string file = path + "/" + entry->d_name;
+		if (entry->d_name[0] != '.' && stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+			files.push_back(file);
+		}
+	}
+	closedir(dir);
+
+	std::sort(files.begin(), files.end());
+	inputs.insert(inputs.end(), files.begin(), files.end());
+}
+
+/**
+ * @brief Run one input in a child process within the limits
+ *
+ * @param data Content of the input
+ * @param seconds Wall time the input may take
+ * @param megabytes Address space the input may use, 0 for no limit
+ *
+ * @return empty if the input passed, what went wrong otherwise
+ */
+static std::string runInput(const std::string& data, const unsigned int seconds, const unsigned long megabytes)
+{
+	const pid_t child = fork();
+
+	if (child < 0) {
+		return "could not fork";
+	}
+
+	if (child == 0) {
+		if (megabytes != 0) {
+			const struct rlimit memory{(rlim_t)megabytes << 20, (rlim_t)megabytes << 20};
+			setrlimit(RLIMIT_AS, &memory);
+			std::set_new_handler([] { _exit(OUT_OF_MEMORY); });
+		}
+		alarm(seconds);
+		LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+		_exit(0);
+	}
+
+	int status = 0;
+	while (waitpid(child, &status, 0) < 0) {
+		if (errno != EINTR) {
+			return "lost the child process";
+		}
+	}
+
+	if (WIFSIGNALED(status)) {
+		if (WTERMSIG(status) == SIGALRM) {
+			return "timeout after " + std::to_string(seconds) + " s";
+		}
+		return std::string("crash, ") + strsignal(WTERMSIG(status));
+	}
+	if (WEXITSTATUS(status) == OUT_OF_MEMORY) {
+		return "out of memory after " + std::to_string(megabytes) + " MB";
+	}
+	if (WEXITSTATUS(status) != 0) {
+		// sanitizers exit with an error
+		return "failed with exit code " + std::to_string(WEXITSTATUS(status));
+	}
+
+	return std::string();
+}
+
+/**
+ * @brief Run a fuzz target over files without libFuzzer
+ *
+ * Usage: `target [-t SECONDS] [-m MB] FILE|DIR...`
+ *
+ * Each input runs in a process of its own, stopped after the given
+ * time and limited to the given memory, so an input that hangs or
+ * keeps allocating is reported like one that crashes. The memory
+ * limit is on address space, builds with AddressSanitizer reserve
+ * much more than they use and should be run by libFuzzer with
+ * -rss_limit_mb instead.
+ *
+ * @return 0 if every input passed
+ */
+int main(int argc, char const *argv[])
+{
+	unsigned int seconds = 10;
+	unsigned long megabytes = 2048;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-t") && i + 1 < argc) {
+			seconds = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (!std::strcmp(argv[i], "-m") && i + 1 < argc) {
+			megabytes = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else {
+			addInputs(argv[i], inputs);
+		}
+	}
+
+#if defined(__SANITIZE_ADDRESS__)
+	megabytes = 0;
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+	megabytes = 0;
+#endif
+#endif
+
+	unsigned int failures = 0;
+	for (auto const& input : inputs) {
+		std::ifstream file(input, std::ios::binary);
+		if (!file.is_open()) {
+			std::cerr << input << " : could not be read" << std::endl;
+			failures++;
+			continue;
+		}
+		const std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		const auto start = std::chrono::steady_clock::now();
+		const std::string problem = runInput(data, seconds, megabytes);
+		const std::chrono::duration<double> taken = std::chrono::steady_clock::now() - start;
+
+		if (!problem.empty()) {
+			std::cerr << input << " : " << problem << std::endl;
+			failures++;
+		}
+		else {
+			std::cout << input << " : ok in " << taken.count() << " s" << std::endl;
+		}
+	}
+
+	std::cout << inputs.size() - failures << " of " << inputs.size() << " inputs passed." << std::endl;
+	return failures != 0;
+}
@@ -0,0 +1,39 @@
+#include <string>      // string
+#include <stdexcept>   // runtime_error
+#include <cstring>     // memcmp
+#include "harness.hh"  // TempDir, writeFile, silenceLogs
+#include "importer.hh" // Importer
+
+/**
+ * @brief Import a pakset made of the input
+ *
+ * An input with the ustar magic of a tar header is imported as a
+ * tar archive, anything else as the only dat of a directory.
+ *
+ * @param data Content of the archive or dat
+ * @param size Size of the content
+ *
+ * @return 0, anything wrong is caught by the sanitizers or the limits
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	static const bool silenced = (silenceLogs(), true);
+	(void)silenced;
+
+	const bool tar = size >= 512 && !std::memcmp(data + 257, "ustar", 5);
+
+	TempDir dir;
+	const std::string pakset = dir.name() + (tar ? "/pak.tar" : "/pak");
+	writeFile(tar ? pakset : pakset + "/sheet/object.dat", reinterpret_cast<const char*>(data), size);
+
+	try {
+		Importer xlsx(dir.name() + "/pak.xlsx");
+		xlsx.setReproducible(true);
+		xlsx.import(pakset);
+	}
+	catch (const std::runtime_error&) {
+		// broken paksets are refused, that's not a failure
+	}
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+#include <map>         // map
+#include <string>      // string
+#include <sstream>     // ostringstream
+#include <memory>      // unique_ptr
+#include <stdexcept>   // runtime_error
+#include <algorithm>   // search
+#include <cstring>     // strlen
+#include "harness.hh"  // TempDir, writeFile, silenceLogs
+#include "workbook.hh" // Workbook
+#include "output.hh"   // DatOutput
+
+/**
+ * @brief Export a workbook made of the input
+ *
+ * The input is saved as an ODS file when it names the OpenDocument
+ * type near its start, like the mimetype entry of real ones does,
+ * and as an XLSX file otherwise. Dats are kept in memory.
+ *
+ * @param data Content of the workbook
+ * @param size Size of the content
+ *
+ * @return 0, anything wrong is caught by the sanitizers or the limits
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	static const char ods_type[] = "opendocument";
+	static const bool silenced = (silenceLogs(), true);
+	(void)silenced;
+
+	const uint8_t* start_end = data + std::min<size_t>(size, 128);
+	const bool ods = std::search(data, start_end, ods_type, ods_type + std::strlen(ods_type)) != start_end;
+
+	TempDir dir;
+	const std::string path = dir.name() + (ods ? "/book.ods" : "/book.xlsx");
+	writeFile(path, reinterpret_cast<const char*>(data), size);
+
+	std::map<std::string, std::string> dats;
+	DatOutput output;
+	output.capture(dats);
+	std::ostringstream warnings;
+
+	try {
+		std::unique_ptr<Workbook> workbook = Workbook::open(path);
+		workbook->setOutput(output);
+		workbook->setLog(warnings);
+		workbook->parse();
+	}
+	catch (const std::runtime_error&) {
+		// broken workbooks are refused, that's not a failure
+	}
+
+	return 0;
+}
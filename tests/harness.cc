@@ -0,0 +1,96 @@
+#include <iostream>   // cout, clog, streambuf
+#include <fstream>    // ofstream
+#include <stdexcept>  // runtime_error
+#include <cstdlib>    // getenv
+#include <sys/stat.h> // mkdir
+#include <unistd.h>   // mkdtemp
+#include <ftw.h>      // nftw
+#include <cstdio>     // remove
+#include "harness.hh"
+
+/**
+ * @brief Create an empty directory
+ */
+TempDir::TempDir()
+{
+	const char* tmp = std::getenv("TMPDIR");
+	std::string pattern = std::string(tmp != nullptr && *tmp != '\0' ? tmp : "/tmp") + "/datSheet.XXXXXX";
+
+	if (mkdtemp(&pattern[0]) == nullptr) {
+		throw std::runtime_error("Could not create a temporary directory");
+	}
+	path = pattern;
+}
+
+/**
+ * @brief Remove a file or an emptied directory
+ */
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	std::remove(path);
+	return 0;
+}
+
+/**
+ * @brief Remove the directory and its content
+ */
+TempDir::~TempDir()
+{
+	// children first
+	nftw(path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * @brief Path of the directory
+ *
+ * @return the path, without trailing slash
+ */
+const std::string& TempDir::name() const
+{
+	return path;
+}
+
+/**
+ * @brief Write a file, creating its directories
+ *
+ * @param path Path of the file
+ * @param data Content of the file
+ * @param size Size of the content
+ */
+void writeFile(const std::string& path, const char* data, const size_t size)
+{
+	for (std::string::size_type slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+		mkdir(path.substr(0, slash).c_str(), 0755);
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(data, size);
+	if (!file) {
+		throw std::runtime_error("Could not write " + path);
+	}
+}
+
+/**
+ * Stream buffer throwing everything away
+ */
+class NullBuffer : public std::streambuf
+{
+protected:
+	int overflow(int c) override
+	{
+		return c;
+	}
+};
+
+/**
+ * @brief Send what the readers print nowhere
+ *
+ * Warnings for broken input are expected, printing them would
+ * only slow the run down.
+ */
+void silenceLogs()
+{
+	static NullBuffer nowhere;
+	std::cout.rdbuf(&nowhere);
+	std::clog.rdbuf(&nowhere);
+}
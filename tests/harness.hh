@@ -0,0 +1,34 @@
+#pragma once
+#include <string>  // string
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+
+/**
+ * Directory for the files of one run
+ *
+ * Created empty in the temporary directory and removed with all
+ * its content when destroyed.
+ */
+class TempDir
+{
+	/** path of the directory */
+	std::string path;
+
+public:
+	// Create an empty directory
+	TempDir();
+	// Remove the directory and its content
+	~TempDir();
+	TempDir(const TempDir&) = delete;
+	TempDir& operator=(const TempDir&) = delete;
+	// Path of the directory
+	const std::string& name() const;
+};
+
+// Write a file, creating its directories
+void writeFile(const std::string& path, const char* data, const size_t size);
+// Send what the readers print nowhere
+void silenceLogs();
+
+// Run one input through a fuzz target
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
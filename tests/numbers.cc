@@ -0,0 +1,43 @@
+#include <iostream>    // cerr, endl
+#include "importer.hh" // Importer
+
+/**
+ * @brief Check which values the importer writes as numbers
+ *
+ * @return 0 if every value is typed as expected
+ */
+int main()
+{
+	static const struct {
+		const char* value;
+		bool number;
+	} cases[] = {
+		{"0", true},
+		{"42", true},
+		{"-7", true},
+		{"1.5", true},
+		{"0.001", true},
+		{"100000", true},
+		{"1000000", true},
+		{"250000000", true},
+		{"123456789012345", true},
+		{"1e6", false},
+		{"1e3", false},
+		{"1.50", false},
+		{"007", false},
+		{"-0", false},
+		{"1234567890123456", false},
+		{"1,2", false},
+		{"", false}
+	};
+	int failures = 0;
+
+	for (auto const& test : cases) {
+		if (Importer::isNumber(test.value) != test.number) {
+			std::cerr << "\"" << test.value << "\" should be a " << (test.number ? "number" : "string") << std::endl;
+			failures++;
+		}
+	}
+
+	return failures != 0;
+}
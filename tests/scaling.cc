@@ -0,0 +1,307 @@
+#include <iostream>    // cerr, endl
+#include <iomanip>     // setw, setprecision
+#include <string>      // string, to_string
+#include <vector>      // vector
+#include <map>         // map
+#include <sstream>     // ostringstream
+#include <memory>      // unique_ptr
+#include <chrono>      // steady_clock
+#include <cstdio>      // snprintf
+#include <cstring>     // memcpy
+#include <algorithm>   // min
+#include "harness.hh"  // TempDir, writeFile, silenceLogs
+#include "source.hh"   // DatSource
+#include "importer.hh" // Importer
+#include "workbook.hh" // Workbook
+#include "output.hh"   // DatOutput
+
+/** most a run on ten times the input may take compared to the base,
+ * linear readers take about 10 times more, quadratic ones 100 */
+static const double MAX_RATIO = 30;
+/** runs on ten times the input faster than this always pass, too
+ * short to be measured reliably */
+static const double MIN_SECONDS = 0.02;
+
+/**
+ * A reader run on generated inputs of two sizes
+ */
+struct check_t {
+	const char* name;
+	/** base size, the other input is ten times it */
+	unsigned int size;
+	/** make the input in a directory, returns the path to read */
+	std::string (*make)(const std::string& dir, const unsigned int size);
+	/** read the input, dir is free for what the reader writes */
+	void (*run)(const std::string& input, const std::string& dir);
+};
+
+/**
+ * @brief Add a file to a tar archive
+ *
+ * @param tar Archive being built
+ * @param name Name of the file
+ * @param content Content of the file
+ */
+static void addTarFile(std::string& tar, const std::string& name, const std::string& content)
+{
+	char header[512] = {};
+	std::memcpy(header, name.data(), std::min<size_t>(name.size(), 99));
+	std::snprintf(header + 100, 8, "%07o", 0644);
+	std::snprintf(header + 124, 12, "%011o", (unsigned int)content.size());
+	std::snprintf(header + 136, 12, "%011o", 0);
+	header[156] = '0';
+	std::memcpy(header + 257, "ustar", 6);
+
+	unsigned int sum = 8 * ' ';
+	for (int i = 0; i < 512; ++i) {
+		sum += (i >= 148 && i < 156) ? 0 : (unsigned char)header[i];
+	}
+	std::snprintf(header + 148, 8, "%06o", sum);
+	header[155] = ' ';
+
+	tar.append(header, 512);
+	tar.append(content);
+	tar.append((512 - content.size() % 512) % 512, '\0');
+}
+
+/**
+ * @brief Tar archive with a directory of many dats
+ */
+static std::string makeTar(const std::string& dir, const unsigned int size)
+{
+	std::string tar;
+	for (unsigned int i = 0; i < size; ++i) {
+		const std::string name = "o" + std::to_string(i);
+		addTarFile(tar, "pak/sheet/" + name + ".dat", "obj=building\nname=" + name + "\n");
+	}
+	tar.append(1024, '\0');
+
+	writeFile(dir + "/pak.tar", tar.data(), tar.size());
+	return dir + "/pak.tar";
+}
+
+/**
+ * @brief List and read every dat of a source
+ */
+static void readSource(DatSource& source, const std::string& dir)
+{
+	std::vector<std::string> dirs;
+	std::vector<DatSource::entry_t> dats;
+	source.list(dir, dirs, dats);
+
+	std::string data;
+	for (auto const& dat : dats) {
+		source.read(dir.empty() ? dat.name : dir + "/" + dat.name, data);
+	}
+	for (auto const& sub_dir : dirs) {
+		readSource(source, dir.empty() ? sub_dir : dir + "/" + sub_dir);
+	}
+}
+
+/**
+ * @brief Index and read an archive
+ */
+static void runSource(const std::string& input, const std::string&)
+{
+	std::unique_ptr<DatSource> source = DatSource::open(input);
+	readSource(*source, "");
+}
+
+/** objects in the inputs made of wide rows */
+static const unsigned int WIDE_ROWS = 100;
+
+/**
+ * @brief Dat of a few objects with many keys, each key a column
+ */
+static std::string makeWide(const std::string& dir, const unsigned int size)
+{
+	std::ostringstream dat;
+	for (unsigned int i = 0; i < WIDE_ROWS; ++i) {
+		dat << "obj=building\nname=o" << i << "\n";
+		for (unsigned int key = 0; key < size; ++key) {
+			dat << "key" << key << "=" << (i + key) % 100 << "\n";
+		}
+		dat << "---\n";
+	}
+
+	writeFile(dir + "/pak/sheet/wide.dat", dat.str().data(), dat.str().size());
+	return dir + "/pak";
+}
+
+/**
+ * @brief Dat of a single line, without line breaks
+ */
+static std::string makeLine(const std::string& dir, const unsigned int size)
+{
+	const std::string dat = "obj=building" + std::string(size, 'x');
+
+	writeFile(dir + "/pak/sheet/line.dat", dat.data(), dat.size());
+	return dir + "/pak";
+}
+
+/**
+ * @brief Directory of many dats
+ */
+static std::string makeDats(const std::string& dir, const unsigned int size)
+{
+	for (unsigned int i = 0; i < size; ++i) {
+		const std::string dat = "obj=building\nname=o" + std::to_string(i) + "\nlevel=" + std::to_string(i % 7) + "\n";
+		writeFile(dir + "/pak/sheet/o" + std::to_string(i) + ".dat", dat.data(), dat.size());
+	}
+	return dir + "/pak";
+}
+
+/**
+ * @brief Dats whose values are all different
+ */
+static std::string makeStrings(const std::string& dir, const unsigned int size)
+{
+	std::ostringstream dat;
+	for (unsigned int i = 0; i < size; ++i) {
+		dat << "obj=building\nname=o" << i << "\ncopyright=author " << i << "\nintro_month=m" << i << "\n---\n";
+	}
+
+	writeFile(dir + "/pak/sheet/strings.dat", dat.str().data(), dat.str().size());
+	return dir + "/pak";
+}
+
+/**
+ * @brief Import a pakset
+ */
+static void runImport(const std::string& input, const std::string& dir)
+{
+	Importer xlsx(dir + "/out.xlsx");
+	xlsx.import(input);
+}
+
+/**
+ * @brief Workbook imported from a pakset
+ */
+static std::string importWorkbook(const std::string& pakset, const std::string& dir)
+{
+	Importer xlsx(dir + "/book.xlsx");
+	xlsx.import(pakset);
+	return dir + "/book.xlsx";
+}
+
+/**
+ * @brief Workbook of a few objects with many columns
+ */
+static std::string makeWideBook(const std::string& dir, const unsigned int size)
+{
+	return importWorkbook(makeWide(dir, size), dir);
+}
+
+/**
+ * @brief Workbook with a shared string for each cell
+ */
+static std::string makeStringBook(const std::string& dir, const unsigned int size)
+{
+	return importWorkbook(makeStrings(dir, size), dir);
+}
+
+/**
+ * @brief CSV sheet of a few objects with many columns
+ */
+static std::string makeCSV(const std::string& dir, const unsigned int size)
+{
+	std::ostringstream csv;
+	csv << "obj,name";
+	for (unsigned int col = 0; col < size; ++col) {
+		csv << ",key" << col;
+	}
+	for (unsigned int row = 0; row < WIDE_ROWS; ++row) {
+		csv << "\nbuilding,o" << row;
+		for (unsigned int col = 0; col < size; ++col) {
+			csv << "," << (row + col) % 100;
+		}
+	}
+	csv << "\n";
+
+	writeFile(dir + "/book/sheet.csv", csv.str().data(), csv.str().size());
+	return dir + "/book";
+}
+
+/**
+ * @brief Export a workbook, keeping the dats in memory
+ */
+static void runExport(const std::string& input, const std::string&)
+{
+	std::map<std::string, std::string> dats;
+	DatOutput output;
+	output.capture(dats);
+	std::ostringstream warnings;
+
+	std::unique_ptr<Workbook> workbook = Workbook::open(input);
+	workbook->setOutput(output);
+	workbook->setLog(warnings);
+	workbook->parse();
+}
+
+/**
+ * @brief Fastest of a few runs
+ *
+ * @return time taken, in seconds
+ */
+static double bestTime(const check_t& check, const std::string& input, const std::string& dir)
+{
+	double best = 0;
+
+	for (int i = 0; i < 3; ++i) {
+		const auto start = std::chrono::steady_clock::now();
+		check.run(input, dir);
+		const std::chrono::duration<double> taken = std::chrono::steady_clock::now() - start;
+		if (i == 0 || taken.count() < best) {
+			best = taken.count();
+		}
+	}
+
+	return best;
+}
+
+/**
+ * @brief Check that readers take time in proportion to their input
+ *
+ * Each reader runs on an input and on one ten times larger, it
+ * fails if the larger one takes much more than ten times longer.
+ *
+ * @return 0 if every reader scales linearly
+ */
+int main()
+{
+	static const check_t checks[] = {
+		{"tar archive, dats in one directory", 5000, makeTar, runSource},
+		{"import, many keys", 1000, makeWide, runImport},
+		{"import, dat without line breaks", 100000, makeLine, runImport},
+		{"import, dats in one directory", 500, makeDats, runImport},
+		{"import, values all different", 2000, makeStrings, runImport},
+		{"xlsx export, wide rows", 1000, makeWideBook, runExport},
+		{"xlsx export, shared strings", 2000, makeStringBook, runExport},
+		{"csv export, wide rows", 1500, makeCSV, runExport}
+	};
+	unsigned int failures = 0;
+
+	silenceLogs();
+
+	try {
+		for (auto const& check : checks) {
+			TempDir small_dir;
+			TempDir large_dir;
+			const std::string small = check.make(small_dir.name(), check.size);
+			const std::string large = check.make(large_dir.name(), check.size * 10);
+
+			const double small_time = bestTime(check, small, small_dir.name());
+			const double large_time = bestTime(check, large, large_dir.name());
+			const bool failed = large_time > MIN_SECONDS && large_time > MAX_RATIO * small_time;
+
+			std::cerr << std::left << std::setw(40) << check.name << std::fixed << std::setprecision(4) << small_time << " s, x10 " << large_time << " s" << (failed ? "  super-linear" : "") << std::endl;
+			failures += failed;
+		}
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << "scaling : error " << e.what() << std::endl;
+		return 1;
+	}
+
+	return failures != 0;
+}
@@ -0,0 +1,160 @@
+#include <iostream>    // cerr, endl
+#include <fstream>     // ifstream
+#include <string>      // string
+#include <map>         // map
+#include <sstream>     // ostringstream
+#include <memory>      // unique_ptr
+#include <chrono>      // steady_clock
+#include <stdexcept>   // runtime_error
+#include <sys/types.h>
+#include <sys/wait.h>  // waitpid
+#include <unistd.h>    // fork, execl, chdir
+#include <fcntl.h>     // open
+#include <climits>     // PATH_MAX
+#include <cstdlib>     // realpath
+#include "harness.hh"  // TempDir, writeFile, silenceLogs
+#include "importer.hh" // Importer
+#include "workbook.hh" // Workbook
+#include "output.hh"   // DatOutput
+
+/** exports timed for the average */
+static const unsigned int RUNS = 50;
+
+/**
+ * @brief Check if ICU is loaded in this process
+ *
+ * @return 1 if loaded, 0 if not, -1 if it can't be told
+ */
+static int icuLoaded()
+{
+	std::ifstream maps("/proc/self/maps");
+	if (!maps.is_open()) {
+		return -1;
+	}
+
+	std::string line;
+	while (std::getline(maps, line)) {
+		if (line.find("libicu") != std::string::npos) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Average time of an export by the datSheet program
+ *
+ * Each run is a new process, so the time includes loading the
+ * program and its libraries.
+ *
+ * @param program Path of the datSheet program
+ * @param workbook Workbook exported
+ * @param dir Directory the dats are written to
+ *
+ * @return average time of a run, in seconds, negative if one failed
+ */
+static double exportTime(const std::string& program, const std::string& workbook, const std::string& dir)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (unsigned int i = 0; i < RUNS; ++i) {
+		const pid_t child = fork();
+		if (child == 0) {
+			const int null = open("/dev/null", O_WRONLY);
+			dup2(null, 1);
+			dup2(null, 2);
+			if (chdir(dir.c_str()) == 0) {
+				execl(program.c_str(), program.c_str(), workbook.c_str(), (char*)nullptr);
+			}
+			_exit(127);
+		}
+
+		int status = 0;
+		if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			return -1;
+		}
+	}
+
+	const std::chrono::duration<double> taken = std::chrono::steady_clock::now() - start;
+	return taken.count() / RUNS;
+}
+
+/**
+ * @brief Check that only dats in another encoding load ICU
+ *
+ * Exporting and importing UTF-8 dats must not load ICU, importing
+ * a Latin-1 dat must load it. When given the datSheet program, the
+ * average time of exporting a small workbook is printed too.
+ *
+ * @return 0 if ICU was loaded when needed and only then
+ */
+int main(int argc, char const *argv[])
+{
+	unsigned int failures = 0;
+
+	silenceLogs();
+
+	try {
+		TempDir dir;
+		const std::string csv = "obj,name,intro_year\nbuilding,station,1930\nbuilding,depot,1950\n";
+		writeFile(dir.name() + "/book/sheet.csv", csv.data(), csv.size());
+
+		const int at_start = icuLoaded();
+		if (at_start < 0) {
+			std::cerr << "startup : can't tell which libraries are loaded, skipped" << std::endl;
+			return 0;
+		}
+
+		std::map<std::string, std::string> dats;
+		DatOutput output;
+		output.capture(dats);
+		std::unique_ptr<Workbook> workbook = Workbook::open(dir.name() + "/book");
+		workbook->setOutput(output);
+		workbook->parse();
+		const int after_export = icuLoaded();
+
+		const std::string utf8 = "obj=building\nname=Bahnhofstra\xc3\x9f" "e\n";
+		writeFile(dir.name() + "/utf8/sheet/station.dat", utf8.data(), utf8.size());
+		{
+			Importer xlsx(dir.name() + "/utf8.xlsx");
+			xlsx.import(dir.name() + "/utf8");
+		}
+		const int after_utf8 = icuLoaded();
+
+		const std::string latin1 = "obj=building\nname=Bahnhofstra\xdf" "e\ncopyright=caf\xe9 \xe0 la gare\n";
+		writeFile(dir.name() + "/latin1/sheet/station.dat", latin1.data(), latin1.size());
+		{
+			Importer xlsx(dir.name() + "/latin1.xlsx");
+			xlsx.import(dir.name() + "/latin1");
+		}
+		const int after_latin1 = icuLoaded();
+
+		std::cerr << "ICU loaded at start " << at_start << ", after export " << after_export << ", after UTF-8 import " << after_utf8 << ", after Latin-1 import " << after_latin1 << std::endl;
+		failures += at_start + after_export + after_utf8;
+		// the build found ICU, so it is installed and must load
+		if (after_latin1 == 0) {
+			std::cerr << "startup : Latin-1 import did not load ICU" << std::endl;
+			failures++;
+		}
+
+		if (argc > 1) {
+			// the export runs in the temporary directory
+			char program[PATH_MAX];
+			const double average = realpath(argv[1], program) ? exportTime(program, dir.name() + "/book", dir.name()) : -1;
+			if (average < 0) {
+				std::cerr << "startup : " << argv[1] << " failed to export" << std::endl;
+				failures++;
+			}
+			else {
+				std::cerr << "export of a small workbook by a new process: " << average * 1000 << " ms on average of " << RUNS << std::endl;
+			}
+		}
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << "startup : error " << e.what() << std::endl;
+		return 1;
+	}
+
+	return failures != 0;
+}
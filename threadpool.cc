@@ -0,0 +1,144 @@
+#include "threadpool.hh"
+
+/**
+ * @brief Start the worker threads
+ *
+ * @param threads Number of worker threads, at least one is created
+ */
+ThreadPool::ThreadPool(unsigned int threads) : running(0), stopping(false)
+{
+	if (threads == 0) {
+		threads = 1;
+	}
+
+	for (unsigned int i = 0; i < threads; ++i) {
+		workers.emplace_back(&ThreadPool::work, this);
+	}
+}
+
+/**
+ * @brief Destroy the pool
+ *
+ * Every task already queued is still executed before the
+ * workers are joined.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	task_cv.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+/**
+ * @brief Worker thread loop
+ *
+ * Takes tasks from the queue until the pool is stopped and
+ * there's nothing left to do.
+ *
+ * @warn Tasks must handle their own exceptions.
+ */
+void ThreadPool::work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;) {
+		task_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+		if (tasks.empty()) {
+			return;
+		}
+
+		std::function<void()> task = std::move(tasks.front());
+		tasks.pop();
+		running++;
+
+		lock.unlock();
+		task();
+		lock.lock();
+
+		running--;
+		done_cv.notify_all();
+	}
+}
+
+/**
+ * @brief Queue a task
+ *
+ * @param task Function to be executed by one of the workers
+ */
+void ThreadPool::run(std::function<void()> task)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		tasks.push(std::move(task));
+	}
+	task_cv.notify_one();
+}
+
+/**
+ * @brief Wait for the queue to drain
+ *
+ * Blocks until every queued task is finished, tasks may still
+ * be queued while waiting.
+ */
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	done_cv.wait(lock, [this] { return tasks.empty() && running == 0; });
+}
+
+/**
+ * @brief Number of threads to use when none is specified
+ *
+ * @return number of hardware threads, 1 if unknown
+ */
+unsigned int ThreadPool::defaultThreads()
+{
+	const unsigned int threads = std::thread::hardware_concurrency();
+	return threads > 0 ? threads : 1;
+}
+
+/**
+ * @brief Create a budget
+ *
+ * @param limit Maximum amount that can be acquired at the same
+ * time, 0 means no limit
+ */
+MemoryBudget::MemoryBudget(const unsigned long long limit) : limit(limit), used(0)
+{
+}
+
+/**
+ * @brief Block until amount fits in the budget
+ *
+ * A request bigger than the whole budget is allowed once nothing
+ * else is using it, so it's serialised instead of blocking forever.
+ *
+ * @param amount Amount to be acquired
+ */
+void MemoryBudget::acquire(const unsigned long long amount)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	cv.wait(lock, [this, amount] { return limit == 0 || used == 0 || used + amount <= limit; });
+	used += amount;
+}
+
+/**
+ * @brief Give back what was acquired
+ *
+ * @param amount Same amount passed to acquire
+ */
+void MemoryBudget::release(const unsigned long long amount)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		used -= amount;
+	}
+	cv.notify_all();
+}
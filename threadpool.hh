@@ -0,0 +1,128 @@
+#pragma once
+#include <vector>             // vector
+#include <queue>              // queue
+#include <functional>         // function, hash
+#include <utility>            // declval
+#include <thread>             // thread
+#include <mutex>              // mutex, unique_lock
+#include <condition_variable> // condition_variable
+#include <string>             // string
+#include <unordered_map>      // unordered_map
+
+/**
+ * Fixed size pool of worker threads consuming a task queue
+ */
+class ThreadPool
+{
+	/** worker threads */
+	std::vector<std::thread> workers;
+	/** tasks waiting for a free worker */
+	std::queue<std::function<void()>> tasks;
+	/** protects everything below */
+	std::mutex mutex;
+	/** signalled when a task is queued or the pool is stopping */
+	std::condition_variable task_cv;
+	/** signalled when a task finishes */
+	std::condition_variable done_cv;
+	/** number of tasks being executed right now */
+	unsigned int running;
+	/** set when the pool is being destroyed */
+	bool stopping;
+
+	// Worker thread loop
+	void work();
+
+public:
+	// Start the worker threads
+	ThreadPool(unsigned int threads);
+	// Finish queued tasks and join the workers
+	~ThreadPool();
+	// Queue a task
+	void run(std::function<void()> task);
+	// Wait until every queued task is finished
+	void wait();
+	// Number of threads to use when none is specified
+	static unsigned int defaultThreads();
+};
+
+/**
+ * Global memory limit shared by concurrent tasks
+ */
+class MemoryBudget
+{
+	/** maximum amount that can be in use, 0 means no limit */
+	const unsigned long long limit;
+	/** amount currently in use */
+	unsigned long long used;
+	std::mutex mutex;
+	std::condition_variable cv;
+
+public:
+	// Create a budget
+	MemoryBudget(const unsigned long long limit);
+	// Block until amount fits in the budget
+	void acquire(const unsigned long long amount);
+	// Give back what was acquired
+	void release(const unsigned long long amount);
+};
+
+/**
+ * Map shared by threads, split in shards with a lock each
+ *
+ * Keys are spread over the shards by hash, so threads using
+ * different keys rarely wait for each other.
+ */
+template<typename Value>
+class ShardedMap
+{
+	/** part of the map, with its own lock */
+	struct shard_t {
+		std::mutex mutex;
+		std::unordered_map<std::string, Value> values;
+	};
+	static const unsigned int SHARDS = 16;
+	shard_t shards[SHARDS];
+
+public:
+	// Use the value of a key, created if missing, while holding its shard
+	template<typename Function>
+	auto update(const std::string& key, Function function) -> decltype(function(std::declval<Value&>()));
+	// Visit every key and value, once no thread uses the map anymore
+	template<typename Function>
+	void forEach(Function function);
+};
+
+/**
+ * @brief Use the value of a key, created if missing, while holding its shard
+ *
+ * @param key Key of the value
+ * @param function Called with the value, other keys of the shard
+ * wait until it returns
+ *
+ * @return what the function returns
+ */
+template<typename Value>
+template<typename Function>
+auto ShardedMap<Value>::update(const std::string& key, Function function) -> decltype(function(std::declval<Value&>()))
+{
+	shard_t& shard = shards[std::hash<std::string>()(key) % SHARDS];
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	return function(shard.values[key]);
+}
+
+/**
+ * @brief Visit every key and value, once no thread uses the map anymore
+ *
+ * @param function Called with each key and its value, in no order
+ */
+template<typename Value>
+template<typename Function>
+void ShardedMap<Value>::forEach(Function function)
+{
+	for (auto& shard : shards) {
+		for (auto& entry : shard.values) {
+			function(entry.first, entry.second);
+		}
+	}
+}
@@ -0,0 +1,401 @@
+#include <iostream>    // cout
+#include <string>      // stoul, to_string
+#include <algorithm>   // sort, transform
+#include <cctype>      // tolower
+#include "validate.hh"
+#include "keys.hh"     // DatKeys
+#include "schema.hh"   // CellRef
+#include "images.hh"   // ImageCache
+
+/** keys whose value must be an integer */
+static const char* const integer_keys[] = {
+	"intro_year", "intro_month", "retire_year", "retire_month",
+	"payload", "overcrowded_capacity", "capacity", "comfort", "loading_time", "min_loading_time", "max_loading_time",
+	"speed", "power", "tractive_effort", "axle_load", "length", "cost", "runningcost", "fixed_cost", "maintenance",
+	"brake_force", "minimum_runway_length", "range",
+	"topspeed", "max_weight", "pillar_distance", "max_height",
+	"level", "chance", "build_time",
+	"value", "catg", "speed_bonus", "weight_per_unit", "mapcolor",
+	"productivity", "distributionweight", "electricity_boost", "pax_boost", "mail_boost", "pax_demand", "mail_demand",
+	"smokespeed", "smokeuplift", "smokelifetime", "offset_left"
+};
+
+/** keys whose value is a list of integers separated by commas */
+static const char* const integer_list_keys[] = {
+	"dims"
+};
+
+/** keys whose value is a reference to an image, file.row.column */
+static const char* const image_key_names[] = {
+	"icon", "cursor", "image", "emptyimage", "freightimage", "frontimage", "backimage", "frontdiagonal", "backdiagonal",
+	"frontslope", "backslope", "frontimageup", "backimageup", "frontpillar", "backpillar", "frontstart", "backstart", "frontramp", "backramp", "diagonal", "imageup", "imageup2"
+};
+
+/** every obj type makeobj knows and the keys it can't do without */
+static const struct {
+	const char* obj;
+	const char* required[3];
+} obj_rules[] = {
+	{"bridge", {"waytype", "topspeed"}},
+	{"building", {"type"}},
+	{"citycar", {"speed"}},
+	{"crossing", {}},
+	{"cursor", {}},
+	{"factory", {"productivity"}},
+	{"field", {}},
+	{"good", {}},
+	{"ground", {}},
+	{"groundobj", {}},
+	{"menu", {}},
+	{"misc", {}},
+	{"pedestrian", {}},
+	{"roadsign", {"waytype"}},
+	{"smoke", {}},
+	{"sound", {}},
+	{"symbol", {}},
+	{"tree", {}},
+	{"tunnel", {"waytype", "topspeed"}},
+	{"vehicle", {"waytype", "speed"}},
+	{"way", {"waytype", "topspeed"}},
+	{"way-object", {"waytype"}}
+};
+
+/**
+ * @brief Start the checking threads
+ *
+ * The rule tables are turned into DatKeys ids once so checks
+ * never compare key names.
+ *
+ * @param threads Number of threads checking objects
+ * @param rules Whether objects are checked against the rules of makeobj
+ */
+Validator::Validator(const unsigned int threads, const bool rules) : value_types(DatKeys::COUNT, TEXT), rules(rules), tile_size(0), pool(threads)
+{
+	unsigned int id;
+
+	for (auto const key : integer_keys) {
+		if (DatKeys::find(key, id)) {
+			value_types[id] = INTEGER;
+		}
+	}
+	for (auto const key : integer_list_keys) {
+		if (DatKeys::find(key, id)) {
+			value_types[id] = INTEGER_LIST;
+		}
+	}
+	for (auto const& rule : obj_rules) {
+		std::vector<unsigned int>& keys = required[rule.obj];
+		for (auto const key : rule.required) {
+			if (key != nullptr && DatKeys::find(key, id)) {
+				keys.push_back(id);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Also check the images referenced by the objects
+ *
+ * Must be called before the first object is submitted.
+ *
+ * @param size Size of a tile of the images, 0 to only check they exist
+ */
+void Validator::enableImages(const unsigned int size)
+{
+	unsigned int id;
+
+	tile_size = size;
+	image_keys.assign(DatKeys::COUNT, false);
+	for (auto const key : image_key_names) {
+		if (DatKeys::find(key, id)) {
+			image_keys[id] = true;
+		}
+	}
+}
+
+/**
+ * @brief Queue an object to be checked
+ *
+ * Returns at once, the object is checked by one of the threads.
+ *
+ * @param object Object with the values of its known keys
+ */
+void Validator::submit(object_t object)
+{
+	pool.run([this, object] {
+		check(object);
+	});
+}
+
+/**
+ * @brief Format a location
+ *
+ * @param location Location in a workbook
+ *
+ * @return location like `file:sheet(C12)`
+ */
+std::string Validator::position(const location_t& location)
+{
+	return location.workbook + ":" + location.sheet + "(" + CellRef::ref(location.column, location.row) + ")";
+}
+
+/**
+ * @brief Record a problem
+ *
+ * @param location Row of the object
+ * @param column Column of the value with the problem
+ * @param code Error code
+ * @param message Description of the problem
+ */
+void Validator::report(const location_t& location, const unsigned int column, const std::string& code, const std::string& message)
+{
+	problem_t problem{location, std::string()};
+	problem.location.column = column;
+	problem.text = position(problem.location) + " : Validation error " + code + ":" + message + "\n";
+
+	std::lock_guard<std::mutex> lock(problems_mutex);
+	problems.push_back(problem);
+}
+
+/**
+ * @brief Record where a name is used
+ *
+ * @param obj Obj type, names only clash inside the same type
+ * @param name Name of the object
+ * @param location Where the name is set
+ */
+void Validator::addName(const std::string& obj, const std::string& name, const location_t& location)
+{
+	names.update(obj + "\n" + name, [&location](std::vector<location_t>& locations) {
+		locations.push_back(location);
+	});
+}
+
+/**
+ * @brief Check one object
+ *
+ * - VAL1: there is no obj
+ * - VAL2: obj is not a type makeobj knows
+ * - VAL3: a key required by the obj type is missing
+ * - VAL4: a value that must be a number is not
+ *
+ * Images are checked by checkImages.
+ *
+ * @param object Object to check
+ */
+void Validator::check(const object_t& object)
+{
+	if (!image_keys.empty()) {
+		checkImages(object);
+	}
+	if (!rules) {
+		return;
+	}
+
+	const value_t* obj = nullptr;
+	const value_t* name = nullptr;
+	std::vector<bool> present(DatKeys::COUNT, false);
+
+	for (auto const& value : object.values) {
+		present[value.param] = true;
+
+		if (value.param == DatKeys::OBJ) {
+			obj = &value;
+		}
+		else if (value.param == DatKeys::NAME) {
+			name = &value;
+		}
+
+		const value_type_t type = value_types[value.param];
+		if (type == TEXT) {
+			continue;
+		}
+
+		// optional sign and digits, lists separated by commas
+		bool valid = true;
+		bool digits = false;
+		for (std::string::size_type i = 0; i < value.value.size() && valid; ++i) {
+			const char c = value.value[i];
+			if (c >= '0' && c <= '9') {
+				digits = true;
+			}
+			else if (c == '-' && (i == 0 || value.value[i - 1] == ',')) {
+				digits = false;
+			}
+			else if (c == ',' && type == INTEGER_LIST && digits) {
+				digits = false;
+			}
+			else {
+				valid = false;
+			}
+		}
+
+		if (!valid || !digits) {
+			report(object.location, value.column, "VAL4", "'" + std::string(DatKeys::name(value.param)) + "' must be " + (type == INTEGER ? "an integer" : "a list of integers") + " but is '" + value.value + "'.");
+		}
+	}
+
+	if (obj == nullptr) {
+		report(object.location, 0, "VAL1", "Object has no 'obj' parameter.");
+		return;
+	}
+
+	// obj types are case insensitive like keys
+	std::string type = obj->value;
+	std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+	auto rule = required.find(type);
+	if (rule == required.end()) {
+		report(object.location, obj->column, "VAL2", "Unknown obj type '" + obj->value + "'.");
+		return;
+	}
+
+	for (auto const key : rule->second) {
+		if (!present[key]) {
+			report(object.location, 0, "VAL3", "Object of type '" + type + "' has no '" + std::string(DatKeys::name(key)) + "' parameter.");
+		}
+	}
+
+	if (name != nullptr) {
+		location_t location = object.location;
+		location.column = name->column;
+		addName(type, name->value, location);
+	}
+}
+
+/**
+ * @brief Split an image reference
+ *
+ * References are `file.row.column` with optional `,x,y` offsets
+ * after them, the file is without the png extension. A missing
+ * column or row is 0 like in makeobj. `> ` before the reference
+ * only tells makeobj not to zoom the image.
+ *
+ * @param value Value of an image key
+ * @param file Receives the file without extension
+ * @param row Receives the row of the tile
+ * @param column Receives the column of the tile
+ *
+ * @return false if the value references no image
+ */
+bool Validator::imageReference(const std::string& value, std::string& file, unsigned int& row, unsigned int& column)
+{
+	std::string::size_type start = value.find_first_not_of(" \t>");
+	if (start == std::string::npos) {
+		return false;
+	}
+
+	// offsets are not part of the reference
+	const std::string::size_type end = value.find(',', start);
+	file = value.substr(start, end == std::string::npos ? end : end - start);
+	file.erase(file.find_last_not_of(" \t") + 1);
+
+	// numbers at the end, the last one is the column
+	unsigned int numbers[2] = {0, 0};
+	unsigned int count = 0;
+	while (count < 2) {
+		const std::string::size_type dot = file.rfind('.');
+		if (dot == std::string::npos || dot + 1 == file.size() || file.find_first_not_of("0123456789", dot + 1) != std::string::npos || file.size() - dot > 10) {
+			break;
+		}
+		numbers[count++] = std::stoul(file.substr(dot + 1));
+		file.erase(dot);
+	}
+
+	row = (count == 2 ? numbers[1] : numbers[0]);
+	column = (count == 2 ? numbers[0] : 0);
+
+	// a dash is how an empty image is written
+	return !file.empty() && file != "-";
+}
+
+/**
+ * @brief Check the images referenced by an object
+ *
+ * Files are relative to the directory of the dat. Each file is
+ * only read once whatever the number of objects using it.
+ *
+ * - VAL6: the image file does not exist
+ * - VAL7: the image file is not a PNG
+ * - VAL8: the tile is outside the image
+ *
+ * @param object Object to check
+ */
+void Validator::checkImages(const object_t& object)
+{
+	const std::string::size_type slash = object.path.rfind('/');
+	const std::string dir = (slash == std::string::npos ? std::string() : object.path.substr(0, slash + 1));
+
+	for (auto const& value : object.values) {
+		std::string file;
+		unsigned int row, column;
+
+		if (!image_keys[value.param] || !imageReference(value.value, file, row, column)) {
+			continue;
+		}
+
+		const std::string path = ImageCache::normalize(dir + file + ".png");
+		const ImageCache::image_t& image = images.get(path);
+
+		if (image.status == ImageCache::image_t::MISSING) {
+			report(object.location, value.column, "VAL6", "Image '" + path + "' does not exist.");
+		}
+		else if (image.status == ImageCache::image_t::NOT_PNG) {
+			report(object.location, value.column, "VAL7", "Image '" + path + "' is not a PNG file.");
+		}
+		else if (tile_size > 0 && ((unsigned long long)column + 1 > image.width / tile_size || (unsigned long long)row + 1 > image.height / tile_size)) {
+			report(object.location, value.column, "VAL8", "Tile " + std::to_string(row) + "." + std::to_string(column) + " is outside of '" + path + "', which is " + std::to_string(image.width) + "x" + std::to_string(image.height) + ".");
+		}
+	}
+}
+
+/**
+ * @brief Wait for every check and print the problems
+ *
+ * Names used more than once are only known here, each use after
+ * the first one is reported as VAL5. Problems are printed sorted
+ * by workbook, sheet and cell so the output is always the same.
+ *
+ * @return number of problems
+ */
+unsigned int Validator::finish()
+{
+	pool.wait();
+
+	names.forEach([this](const std::string& key, std::vector<location_t>& locations) {
+		if (locations.size() < 2) {
+			return;
+		}
+
+		std::sort(locations.begin(), locations.end(), [](const location_t& a, const location_t& b) {
+			if (a.workbook != b.workbook) {
+				return a.workbook < b.workbook;
+			}
+			return a.sheet_nr != b.sheet_nr ? a.sheet_nr < b.sheet_nr : a.row < b.row;
+		});
+
+		const std::string name = key.substr(key.find('\n') + 1);
+		for (unsigned int i = 1; i < locations.size(); ++i) {
+			report(locations[i], locations[i].column, "VAL5", "Name '" + name + "' is already used at " + position(locations[0]) + ".");
+		}
+	});
+
+	std::sort(problems.begin(), problems.end(), [](const problem_t& a, const problem_t& b) {
+		if (a.location.workbook != b.location.workbook) {
+			return a.location.workbook < b.location.workbook;
+		}
+		if (a.location.sheet_nr != b.location.sheet_nr) {
+			return a.location.sheet_nr < b.location.sheet_nr;
+		}
+		if (a.location.row != b.location.row) {
+			return a.location.row < b.location.row;
+		}
+		return a.location.column != b.location.column ? a.location.column < b.location.column : a.text < b.text;
+	});
+
+	for (auto const& problem : problems) {
+		std::cout << problem.text;
+	}
+
+	return problems.size();
+}
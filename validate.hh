@@ -0,0 +1,101 @@
+#pragma once
+#include <string>        // string
+#include <vector>        // vector
+#include <map>           // map
+#include <mutex>         // mutex
+#include "threadpool.hh" // ThreadPool, ShardedMap
+#include "images.hh"     // ImageCache
+
+/**
+ * Checks exported objects for errors makeobj would only find later
+ *
+ * Objects are checked by worker threads while the workbooks are
+ * still being parsed. Problems are collected and printed sorted
+ * once everything is finished. Checking the rules of makeobj and
+ * the images referenced by the objects can be enabled on their own.
+ */
+class Validator
+{
+public:
+	/** where an object or value is in a workbook */
+	struct location_t {
+		std::string workbook;
+		unsigned int sheet_nr;
+		std::string sheet;
+		unsigned int row;
+		/** zero based column */
+		unsigned int column;
+	};
+	/** value of a known key */
+	struct value_t {
+		/** DatKeys id */
+		unsigned int param;
+		unsigned int column;
+		std::string value;
+	};
+	/** one exported object */
+	struct object_t {
+		/** location of the row, column is always 0 */
+		location_t location;
+		/** path of the dat relative to the output root, images are relative to it */
+		std::string path;
+		std::vector<value_t> values;
+	};
+
+private:
+	/** type of the value of a known key */
+	enum value_type_t {
+		TEXT,
+		INTEGER,
+		INTEGER_LIST
+	};
+	/** type of the value of each known key, indexed by DatKeys id */
+	std::vector<value_type_t> value_types;
+	/** DatKeys ids required by each obj type */
+	std::map<std::string, std::vector<unsigned int>> required;
+	/** whether objects are checked against the rules of makeobj */
+	const bool rules;
+	/** whether each DatKeys id is an image reference, empty if images are not checked */
+	std::vector<bool> image_keys;
+	/** size of a tile of the images, 0 to only check they exist */
+	unsigned int tile_size;
+	/** every image file read so far */
+	ImageCache images;
+
+	/** every location of each obj type and name */
+	ShardedMap<std::vector<location_t>> names;
+
+	/** problem found and where, to sort them */
+	struct problem_t {
+		location_t location;
+		std::string text;
+	};
+	std::vector<problem_t> problems;
+	std::mutex problems_mutex;
+
+	/** checks objects, declared last to stop before anything else is destroyed */
+	ThreadPool pool;
+
+	// Check one object
+	void check(const object_t& object);
+	// Record a problem
+	void report(const location_t& location, const unsigned int column, const std::string& code, const std::string& message);
+	// Record where a name is used
+	void addName(const std::string& obj, const std::string& name, const location_t& location);
+	// Check the images referenced by an object
+	void checkImages(const object_t& object);
+	// Split an image reference
+	static bool imageReference(const std::string& value, std::string& file, unsigned int& row, unsigned int& column);
+
+public:
+	// Start the checking threads
+	Validator(const unsigned int threads, const bool rules = true);
+	// Also check the images referenced by the objects
+	void enableImages(const unsigned int size);
+	// Queue an object to be checked
+	void submit(object_t object);
+	// Wait for every check and print the problems
+	unsigned int finish();
+	// Format a location
+	static std::string position(const location_t& location);
+};
@@ -0,0 +1,205 @@
+#include <iostream>  // cout
+#include <cstring>   // memcmp, strcmp, strrchr, strlen
+#include <algorithm> // sort
+#include <mutex>     // mutex, lock_guard
+#include <set>       // set
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <dirent.h>
+#endif
+
+#include "verify.hh"
+#include "threadpool.hh"
+#include "mapped.hh"
+
+/**
+ * @brief Set the dat tree to compare with
+ *
+ * @param root Directory that would receive the dats
+ */
+Verifier::Verifier(const std::string& root) : root(root), check_extra(true)
+{
+	if (!this->root.empty() && this->root.back() != '/' && this->root.back() != '\\') {
+		this->root += "/";
+	}
+}
+
+/**
+ * @brief Generated dats
+ *
+ * @return map to be passed to DatOutput::capture
+ */
+std::map<std::string, std::string>& Verifier::generated()
+{
+	return dats;
+}
+
+/**
+ * @brief Set the directories of the exported sheets
+ *
+ * Dat files in these directories that were not generated are
+ * reported as extra.
+ *
+ * @param sheet_dirs Directory of each exported sheet
+ * @param extra Whether to look for extra files, must be false
+ * when not every object of the sheets was generated
+ */
+void Verifier::setDirs(const std::vector<std::string>& sheet_dirs, const bool extra)
+{
+	dirs = sheet_dirs;
+	check_extra = extra;
+}
+
+/**
+ * @brief Compare a dat with the file on disk
+ *
+ * The file is memory mapped and compared in place, files of a
+ * different size are not even read.
+ *
+ * @param path Path of the dat relative to root
+ * @param dat Expected content
+ *
+ * @return SAME, MISSING or DIFFERENT
+ */
+Verifier::result_t Verifier::compare(const std::string& path, const std::string& dat) const
+{
+	const MappedFile file(root + path);
+
+	if (!file.isOpen()) {
+		return MISSING;
+	}
+	if (file.size() != dat.size() || (!dat.empty() && std::memcmp(file.data(), dat.data(), dat.size()))) {
+		return DIFFERENT;
+	}
+
+	return SAME;
+}
+
+/**
+ * @brief List dat files in a directory
+ *
+ * Sub-directories are not entered, they are other sheets.
+ *
+ * @param dir Directory relative to root
+ * @param files Receives the path of each dat relative to root
+ */
+void Verifier::listDats(const std::string& dir, std::vector<std::string>& files) const
+{
+	const std::string prefix = (dir.empty() ? "" : dir + "/");
+
+#ifdef _WIN32
+	HANDLE find;
+	WIN32_FIND_DATAA ent;
+	const std::string find_term = root + prefix + "*.dat";
+
+	if ((find = FindFirstFileA(find_term.c_str(), &ent)) == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	do {
+		if (!(ent.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+			files.push_back(prefix + ent.cFileName);
+		}
+	} while (FindNextFileA(find, &ent));
+
+	FindClose(find);
+#else
+	DIR *dir_handle;
+	struct dirent *ent;
+
+	if ((dir_handle = opendir((root + prefix).c_str())) == NULL) {
+		return;
+	}
+
+	while ((ent = readdir(dir_handle)) != NULL) {
+		const char* extension = std::strrchr(ent->d_name, '.');
+
+		if (ent->d_type != DT_DIR && extension != NULL && !std::strcmp(extension, ".dat")) {
+			files.push_back(prefix + ent->d_name);
+		}
+	}
+	closedir(dir_handle);
+#endif
+}
+
+/**
+ * @brief Compare everything and report differences
+ *
+ * Dats are split among the threads, each one comparing its share
+ * with the files on disk. Problems are printed sorted by path:
+ * - missing: generated but not on disk
+ * - different: on disk with another content
+ * - extra: on disk in a sheet directory but not generated
+ *
+ * @param threads Number of threads comparing files
+ *
+ * @return number of problems found
+ */
+unsigned int Verifier::verify(const unsigned int threads)
+{
+	std::vector<std::pair<std::string, const std::string*>> work;
+	for (auto const& dat : dats) {
+		work.push_back(std::make_pair(dat.first, &dat.second));
+	}
+
+	std::vector<std::pair<std::string, result_t>> problems;
+	std::mutex problems_mutex;
+
+	{
+		ThreadPool pool(threads);
+		const unsigned int chunks = (threads > 0 ? threads : 1) * 4;
+		const size_t chunk_size = work.size() / chunks + 1;
+
+		for (size_t start = 0; start < work.size(); start += chunk_size) {
+			pool.run([&, start] {
+				std::vector<std::pair<std::string, result_t>> found;
+				const size_t end = std::min(start + chunk_size, work.size());
+
+				for (size_t i = start; i < end; ++i) {
+					const result_t result = compare(work[i].first, *work[i].second);
+					if (result != SAME) {
+						found.push_back(std::make_pair(work[i].first, result));
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(problems_mutex);
+				problems.insert(problems.end(), found.begin(), found.end());
+			});
+		}
+	}
+
+	if (check_extra) {
+		std::set<std::string> unique_dirs(dirs.begin(), dirs.end());
+		for (auto const& dir : unique_dirs) {
+			std::vector<std::string> files;
+			listDats(dir, files);
+
+			for (auto const& file : files) {
+				if (dats.find(file) == dats.end()) {
+					problems.push_back(std::make_pair(file, EXTRA));
+				}
+			}
+		}
+	}
+
+	std::sort(problems.begin(), problems.end());
+
+	for (auto const& problem : problems) {
+		switch (problem.second) {
+			case MISSING:
+				std::cout << root << problem.first << " : Missing dat VER1:Dat is generated by the workbook but does not exist.\n";
+				break;
+			case DIFFERENT:
+				std::cout << root << problem.first << " : Different dat VER2:Dat content differs from the workbook.\n";
+				break;
+			default:
+				std::cout << root << problem.first << " : Extra dat VER3:Dat is not generated by the workbook.\n";
+				break;
+		}
+	}
+
+	return problems.size();
+}
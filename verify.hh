@@ -0,0 +1,45 @@
+#pragma once
+#include <string>      // string
+#include <vector>      // vector
+#include <map>         // map
+
+/**
+ * Compares the dats of a workbook with a directory tree
+ *
+ * Dats are generated in memory and compared with the files on
+ * disk, nothing is ever written.
+ */
+class Verifier
+{
+	/** root of the dat tree */
+	std::string root;
+	/** dats generated from the workbook, indexed by path */
+	std::map<std::string, std::string> dats;
+	/** directories of the exported sheets, relative to root */
+	std::vector<std::string> dirs;
+	/** whether files not generated must be reported */
+	bool check_extra;
+
+	/** result of comparing one dat */
+	enum result_t {
+		SAME,
+		MISSING,
+		DIFFERENT,
+		EXTRA
+	};
+
+	// Compare a dat with the file on disk
+	result_t compare(const std::string& path, const std::string& dat) const;
+	// List dat files in a directory
+	void listDats(const std::string& dir, std::vector<std::string>& files) const;
+
+public:
+	// Set the dat tree to compare with
+	Verifier(const std::string& root);
+	// Map receiving the generated dats
+	std::map<std::string, std::string>& generated();
+	// Set the directories of the exported sheets
+	void setDirs(const std::vector<std::string>& sheet_dirs, const bool extra);
+	// Compare everything and report differences
+	unsigned int verify(const unsigned int threads);
+};
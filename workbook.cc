@@ -0,0 +1,563 @@
+#include <iostream>  // clog
+#include <fstream>   // ifstream
+#include <sstream>   // ostringstream
+#include <string>    // string, to_string, getline
+#include <cstring>   // strerror
+#include <cerrno>    // errno
+#include <stdexcept> // runtime_error
+#include <algorithm> // replace, find
+#include <cctype>    // tolower
+#include <sys/types.h>
+#include <sys/stat.h>  // stat
+#include "workbook.hh"
+#include "keys.hh"   // DatKeys
+#include "xlsx.hh"   // XLSX reader
+#include "csv.hh"    // CSV reader
+#include "ods.hh"    // ODS reader
+
+/**
+ * @brief Prepare the common state
+ *
+ * Dats are written on disk and warnings go to std::clog until
+ * something else is set.
+ *
+ * @param filename Name of the workbook
+ */
+Workbook::Workbook(const std::string& filename) : validator(nullptr), table(nullptr), source(filename), output(&disk_output), log(&std::clog)
+{
+}
+
+/**
+ * @brief Destroy object
+ */
+Workbook::~Workbook()
+{
+}
+
+/**
+ * @brief Open a workbook choosing the reader by its type
+ *
+ * Directories are read as one CSV/TSV file per sheet, files ending
+ * in `.ods` as OpenDocument and anything else as an xlsx file.
+ *
+ * @param filename Path of the workbook
+ *
+ * @return reader of the workbook, ready to be parsed
+ */
+std::unique_ptr<Workbook> Workbook::open(const std::string& filename)
+{
+	struct stat info;
+
+	if (stat(filename.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR) {
+		return std::unique_ptr<Workbook>(new CSV(filename));
+	}
+
+	std::string extension = filename.substr(filename.size() < 4 ? 0 : filename.size() - 4);
+	for (char& c : extension) {
+		c = std::tolower((unsigned char)c);
+	}
+
+	if (extension == ".ods") {
+		return std::unique_ptr<Workbook>(new ODS(filename));
+	}
+
+	return std::unique_ptr<Workbook>(new XLSX(filename));
+}
+
+/**
+ * @brief Workbooks given by a file name
+ *
+ * Shard sets made by the importer, files ending in `.shards`, stand
+ * for every workbook they list, one per line and relative to the
+ * directory of the set. Anything else is a workbook itself.
+ *
+ * @param filename Name of a workbook or shard set
+ *
+ * @return workbooks in the order they are listed
+ */
+std::vector<std::string> Workbook::expand(const std::string& filename)
+{
+	if (filename.size() < 7 || filename.compare(filename.size() - 7, 7, ".shards")) {
+		return std::vector<std::string>(1, filename);
+	}
+
+	std::ifstream set(filename);
+	if (!set.is_open()) {
+		std::ostringstream err_msg;
+		err_msg << "SHD" << errno << ":" << std::strerror(errno) << ": " << filename;
+		// send to main
+		throw std::runtime_error(err_msg.str());
+	}
+
+	const std::string::size_type slash = filename.find_last_of("\\/");
+	const std::string dir = (slash == std::string::npos ? std::string() : filename.substr(0, slash + 1));
+	std::vector<std::string> workbooks;
+	std::string line;
+
+	while (std::getline(set, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (!line.empty()) {
+			workbooks.push_back(dir + line);
+		}
+	}
+
+	return workbooks;
+}
+
+/**
+ * @brief Add a sheet
+ *
+ * @param name Name of the sheet, with `;` as directory separator
+ * @param path Location of the sheet inside the workbook
+ */
+void Workbook::addSheet(const std::string& name, const std::string& path)
+{
+	sheet_t sheet_info;
+	sheet_info.name = name;
+	sheet_info.path = path;
+	// sheet names use ; as directory separator
+	sheet_info.dir = name;
+	std::replace(sheet_info.dir.begin(), sheet_info.dir.end(), ';', '/');
+	sheets_v.push_back(sheet_info);
+}
+
+/**
+ * @brief Only export sheets matching the pattern
+ *
+ * Sheets not matching any of the added patterns are neither
+ * decompressed nor parsed. If no pattern is added every sheet
+ * is exported.
+ *
+ * @param pattern Glob pattern (`*` and `?`) matched against the
+ * sheet name, either with `;` or `/` as directory separator
+ */
+void Workbook::filterSheet(const std::string& pattern)
+{
+	sheet_filters.push_back(pattern);
+}
+
+/**
+ * @brief Only export dat files matching the pattern
+ *
+ * Objects are matched by the name of the dat file they are
+ * written to, so objects sharing a file are always exported
+ * together. If no pattern is added every object is exported.
+ *
+ * @param pattern Glob pattern (`*` and `?`) matched against the
+ * dat file name without extension
+ */
+void Workbook::filterObject(const std::string& pattern)
+{
+	object_filters.push_back(pattern);
+}
+
+/**
+ * @brief Also export a variant
+ *
+ * Once any variant is added, every variant is exported in a
+ * directory with its name and nothing is written outside them.
+ * Columns named like `speed@easy` give the value of the parameter
+ * for that variant only, replacing the value of the column without
+ * variant. The workbook is parsed once for all variants.
+ * Without variants, and for variants not added, those columns are
+ * skipped.
+ *
+ * @param name Name of the variant, also its directory
+ */
+void Workbook::addVariant(const std::string& name)
+{
+	if (std::find(variants.begin(), variants.end(), name) == variants.end()) {
+		variants.push_back(name);
+	}
+}
+
+/**
+ * @brief Send dats to another output
+ *
+ * Dats are written on disk by default.
+ *
+ * @param dat_output Output that will receive the dats
+ */
+void Workbook::setOutput(DatOutput& dat_output)
+{
+	output = &dat_output;
+}
+
+/**
+ * @brief Write warnings to another stream
+ *
+ * Warnings go to std::clog by default, when exporting multiple
+ * files at once they are collected to be printed together.
+ *
+ * @param stream Stream where warnings will be written to
+ */
+void Workbook::setLog(std::ostream& stream)
+{
+	log = &stream;
+}
+
+/**
+ * @brief Check the objects while exporting
+ *
+ * Each object written is also queued in the validator, which
+ * checks it in its own threads.
+ *
+ * @param object_validator Validator receiving the objects
+ */
+void Workbook::setValidator(Validator& object_validator)
+{
+	validator = &object_validator;
+}
+
+/**
+ * @brief Collect the objects in a table instead of writing dats
+ *
+ * Used to query the workbook, the values of every object are
+ * added to the table and nothing is written.
+ *
+ * @param objects Table receiving the objects
+ */
+void Workbook::setTable(Table& objects)
+{
+	table = &objects;
+}
+
+/**
+ * @brief Directories of the exported sheets
+ *
+ * Only valid after parsing.
+ *
+ * @return directory of each sheet matching the filters, relative
+ * to the output root and without leading or trailing slashes
+ */
+std::vector<std::string> Workbook::exportedDirs() const
+{
+	std::vector<std::string> dirs;
+
+	for (unsigned int i = 0; i < sheets_v.size(); ++i) {
+		if (sheetSelected(i)) {
+			const std::string& dir = sheets_v[i].dir;
+			const std::string::size_type start = dir.find_first_not_of('/');
+			const std::string::size_type end = dir.find_last_not_of('/');
+			dirs.push_back(start == std::string::npos ? "" : dir.substr(start, end + 1 - start));
+		}
+	}
+
+	return dirs;
+}
+
+/**
+ * @brief Check if a sheet must be exported
+ *
+ * @param sheet_nr Internal number of the sheet
+ *
+ * @return true if there are no sheet filters or the sheet matches one
+ */
+bool Workbook::sheetSelected(const unsigned int sheet_nr) const
+{
+	return sheet_filters.empty() || matchesAny(sheet_filters, sheets_v[sheet_nr].name) || matchesAny(sheet_filters, sheets_v[sheet_nr].dir);
+}
+
+/**
+ * @brief Read the parameter name of a column
+ *
+ * Called for each cell of the first row, columns with an empty
+ * name are skipped when creating dats. Names like `speed@easy`
+ * are the parameter for one variant, skipped if it's not exported.
+ *
+ * @param schema Receives the parameter of the column
+ * @param column Number of the column, starting at 0
+ * @param value Text of the cell
+ */
+void Workbook::headerCell(Schema& schema, const unsigned int column, const std::string_view value)
+{
+	if (!value.empty()) {
+		std::string name(value);
+		unsigned int variant = 0;
+		unsigned int param;
+
+		// value of a parameter for one variant, like speed@easy
+		const std::string::size_type at = name.find('@');
+		if (at != std::string::npos && name.front() != '#') {
+			auto found = std::find(variants.begin(), variants.end(), name.substr(at + 1));
+			if (found == variants.end()) {
+				return;
+			}
+			variant = found - variants.begin() + 1;
+			name.erase(at);
+			if (name.empty()) {
+				return;
+			}
+		}
+
+		// known keys keep their own id, others are numbered after them
+		if (!DatKeys::find(name, param)) {
+			param = DatKeys::COUNT + parameters.intern(name);
+		}
+
+		// the file is the same for every variant
+		if (variant == 0 || param != DatKeys::FILENAME) {
+			schema.set(column, param, name, variant);
+		}
+	}
+}
+
+/**
+ * @brief Start the dat of a row
+ *
+ * Must be called before the first value of each row.
+ */
+void Workbook::startDat()
+{
+	dat_buffer.clear();
+	dat_filename.clear();
+	dat_values.clear();
+	base_lines.clear();
+	override_lines.clear();
+	variant_text.clear();
+
+	if (table != nullptr) {
+		table->startRow();
+	}
+}
+
+/**
+ * @brief Add the value of a column to the dat
+ *
+ * Each line is the prefix compiled in the schema followed by the
+ * value. Readers should not even decode cells of columns whose
+ * action is SKIP.
+ *
+ * @note The file name can be set anywhere in the row so the dat
+ * can only be written once the whole row was read.
+ *
+ * When exporting variants the lines are kept apart and each
+ * variant only picks its own overrides once the row is read.
+ *
+ * @param schema Parameter and action of each column
+ * @param column Number of the column, starting at 0
+ * @param value Text of the cell
+ */
+void Workbook::addValue(const Schema& schema, const unsigned int column, const std::string_view value)
+{
+	const Schema::action_t action = schema.action(column);
+	const unsigned int variant = schema.variant(column);
+
+	if (variant != 0) {
+		// an empty override keeps the value of every variant
+		if (!value.empty()) {
+			const std::string::size_type start = variant_text.size();
+			schema.append(variant_text, column, value);
+			override_lines.push_back(line_t{schema.get(column), variant, start, variant_text.size() - start});
+		}
+		return;
+	}
+
+	if (action == Schema::FILENAME) {
+		dat_filename = value;
+	}
+	else if (action != Schema::SKIP) {
+		if (action == Schema::NAME && dat_filename.empty()) {
+			dat_filename = value;
+		}
+		if (variants.empty()) {
+			schema.append(dat_buffer, column, value);
+		}
+		else {
+			const std::string::size_type start = variant_text.size();
+			schema.append(variant_text, column, value);
+			base_lines.push_back(line_t{schema.get(column), 0, start, variant_text.size() - start});
+		}
+	}
+
+	// comments are not parameters
+	if (table != nullptr && action != Schema::SKIP && action != Schema::COMMENT) {
+		const unsigned int param = schema.get(column);
+		table->addValue(param, param < DatKeys::COUNT ? DatKeys::name(param) : std::string_view(parameters.name(param - DatKeys::COUNT)), value);
+	}
+
+	if (validator != nullptr && action != Schema::SKIP && schema.get(column) < DatKeys::COUNT) {
+		dat_values.push_back(Validator::value_t{schema.get(column), column, std::string(value)});
+	}
+}
+
+/**
+ * @brief Write the dat of a row
+ *
+ * @param sheet_nr Internal number of the sheet where the
+ * data belongs to
+ * @param row Number of the row, used in warnings
+ * @param last_filename Pointer to a string that holds the
+ * filename of the previously created file to check if user
+ * wants to append to the same dat
+ */
+void Workbook::finishDat(const unsigned int sheet_nr, const unsigned int row, std::string& last_filename)
+{
+	const std::string row_number = std::to_string(row);
+
+	// objects not selected are not written but still end the previous file
+	if (!object_filters.empty() && !matchesAny(object_filters, dat_filename)) {
+		last_filename = dat_filename;
+		return;
+	}
+
+	if (table != nullptr) {
+		table->addRow(sheets_v[sheet_nr].name, dat_filename);
+		last_filename = dat_filename;
+		return;
+	}
+
+	if (validator != nullptr) {
+		validator->submit(Validator::object_t{Validator::location_t{source, sheet_nr, sheets_v[sheet_nr].name, row, 0}, sheets_v[sheet_nr].dir + "/" + dat_filename, dat_values});
+	}
+
+	// errors writing on disk are only known once the writer gets to the dat
+	if (variants.empty()) {
+		if (output->write(sheets_v[sheet_nr].dir + "/" + dat_filename, dat_buffer, dat_filename == last_filename, sheet_nr, row) == 1) {
+			*log << sheets_v[sheet_nr].name << "(" << row_number << ") : No name warning FDATOUT1:Object at row " << row_number << " does not contain a 'name'! No dat file was generated.\n";
+		}
+	}
+	else {
+		writeVariants(sheet_nr, row, dat_filename == last_filename);
+	}
+
+	// time to set this filename as the one to be checked next
+	last_filename = dat_filename;
+}
+
+/**
+ * @brief Write the dat of a row for every variant
+ *
+ * Each variant gets the lines of the row with its overrides in
+ * place of the value for every variant. Overrides of parameters
+ * the row has no value for go at the end.
+ *
+ * @param sheet_nr Internal number of the sheet where the
+ * data belongs to
+ * @param row Number of the row, used in warnings
+ * @param append Whether the dat is added to the previous one
+ */
+void Workbook::writeVariants(const unsigned int sheet_nr, const unsigned int row, const bool append)
+{
+	// overrides used by the variant being written
+	std::vector<bool> used(override_lines.size());
+
+	for (unsigned int variant = 1; variant <= variants.size(); ++variant) {
+		dat_buffer.clear();
+		used.assign(override_lines.size(), false);
+
+		for (auto const& line : base_lines) {
+			const line_t* chosen = &line;
+			// rows only have a few overrides, the last one wins like a repeated parameter
+			for (unsigned int i = 0; i < override_lines.size(); ++i) {
+				if (override_lines[i].variant == variant && override_lines[i].param == line.param) {
+					chosen = &override_lines[i];
+					used[i] = true;
+				}
+			}
+			dat_buffer.append(variant_text, chosen->start, chosen->length);
+		}
+
+		for (unsigned int i = 0; i < override_lines.size(); ++i) {
+			if (override_lines[i].variant == variant && !used[i]) {
+				dat_buffer.append(variant_text, override_lines[i].start, override_lines[i].length);
+			}
+		}
+
+		if (output->write(variants[variant - 1] + "/" + sheets_v[sheet_nr].dir + "/" + dat_filename, dat_buffer, append, sheet_nr, row) == 1) {
+			// the file name is the same for every variant, so is the warning
+			const std::string row_number = std::to_string(row);
+			*log << sheets_v[sheet_nr].name << "(" << row_number << ") : No name warning FDATOUT1:Object at row " << row_number << " does not contain a 'name'! No dat file was generated.\n";
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Parse the workbook
+ *
+ * Reads the sheets and waits for the dats to be written, so
+ * when this returns every dat is on disk and every warning is in
+ * the log.
+ */
+void Workbook::parse()
+{
+	readSheets();
+
+	for (auto const& failure : output->flush()) {
+		const std::string row_number = std::to_string(failure.row);
+		const std::string object = failure.filename.substr(failure.filename.rfind('/') + 1);
+
+		if (failure.code == 2) {
+			*log << sheets_v[failure.sheet].name << "(" << row_number << ")  : File saving warning FDATOUT2:Could not create file for writing for object " << object << "!\n";
+		}
+		else {
+			*log << sheets_v[failure.sheet].name << "(" << row_number << ") : File writing warning FDATOUT3:An error happened when writting on file for object " << object << "! File may be corrupt.\n";
+		}
+	}
+}
+
+/**
+ * @brief Check if text matches any of the glob patterns
+ *
+ * @param patterns List of glob patterns
+ * @param text Text to be matched
+ *
+ * @return true if at least one pattern matches
+ */
+bool Workbook::matchesAny(const std::vector<std::string>& patterns, const std::string& text)
+{
+	for (auto const& pattern : patterns) {
+		if (globMatch(pattern.c_str(), text.c_str())) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Match text against a glob pattern
+ *
+ * Supports `*` for any sequence of characters and `?` for any
+ * single character. Only the last `*` is backtracked so the
+ * match never goes quadratic on long names.
+ *
+ * @param pattern Glob pattern
+ * @param text Text to be matched
+ *
+ * @return true if the whole text matches the pattern
+ */
+bool Workbook::globMatch(const char* pattern, const char* text)
+{
+	const char* star = nullptr;
+	const char* star_text = nullptr;
+
+	while (*text) {
+		if (*pattern == '*') {
+			// remember where to restart if what follows does not match
+			star = ++pattern;
+			star_text = text;
+		}
+		else if (*pattern == '?' || *pattern == *text) {
+			++pattern;
+			++text;
+		}
+		else if (star) {
+			// let the star consume one more character
+			pattern = star;
+			text = ++star_text;
+		}
+		else {
+			return false;
+		}
+	}
+
+	// only stars may be left in the pattern
+	while (*pattern == '*') {
+		++pattern;
+	}
+
+	return !*pattern;
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <string>      // string
+#include <string_view> // string_view
+#include <vector>      // vector
+#include <memory>      // unique_ptr
+#include <ostream>     // ostream
+#include "schema.hh"   // Interner, Schema
+#include "output.hh"   // DatOutput
+#include "validate.hh" // Validator
+#include "query.hh"    // Table
+
+/**
+ * Common part of every workbook format
+ *
+ * Readers only decode sheets, rows and cells, turning them into
+ * dats is done here so every format gives the same result.
+ */
+class Workbook
+{
+protected:
+	/** glob patterns of the sheets to export, empty exports all */
+	std::vector<std::string> sheet_filters;
+	/** glob patterns of the dat files to export, empty exports all */
+	std::vector<std::string> object_filters;
+	/** parameter names found in the header rows that are not known keys */
+	Interner parameters;
+	/** dat being built, reused by every row to keep its memory */
+	std::string dat_buffer;
+	/** name of the dat file of the row being built */
+	std::string dat_filename;
+	/** known keys of the row being built, only kept when validating */
+	std::vector<Validator::value_t> dat_values;
+	/** variants exported, each one in its own directory, empty exports only one tree */
+	std::vector<std::string> variants;
+	/** a dat line of the row being built when exporting variants */
+	struct line_t {
+		unsigned int param;
+		/** variant it is for, 0 for every variant */
+		unsigned int variant;
+		/** position in variant_text */
+		std::string::size_type start;
+		std::string::size_type length;
+	};
+	/** lines of the row for every variant, in column order */
+	std::vector<line_t> base_lines;
+	/** lines of the row that override a parameter for one variant */
+	std::vector<line_t> override_lines;
+	/** text of every line of the row, kept in one buffer */
+	std::string variant_text;
+	/** checks the objects, if set */
+	Validator *validator;
+	/** receives the objects instead of writing dats, if set */
+	Table *table;
+	/** name of the workbook, used by validation */
+	std::string source;
+	/** dats are written on disk unless another output is set */
+	DatOutput disk_output;
+	/** where dats are sent to */
+	DatOutput *output;
+	/** stream where warnings are written to */
+	std::ostream *log;
+	/** structure that holds important sheet data */
+	struct sheet_t {
+		std::string name;
+		/** location of the sheet inside the workbook */
+		std::string path;
+		/** name with ; replaced by / */
+		std::string dir;
+	};
+	/** vector that holds info about each sheet */
+	std::vector<sheet_t> sheets_v;
+
+	// Add a sheet
+	void addSheet(const std::string& name, const std::string& path);
+	// Check if a sheet must be exported
+	bool sheetSelected(const unsigned int sheet_nr) const;
+	// Read the parameter name of a column
+	void headerCell(Schema& schema, const unsigned int column, const std::string_view value);
+	// Start the dat of a row
+	void startDat();
+	// Add the value of a column to the dat
+	void addValue(const Schema& schema, const unsigned int column, const std::string_view value);
+	// Write the dat of a row
+	void finishDat(const unsigned int sheet_nr, const unsigned int row, std::string& last_filename);
+	// Write the dat of a row for every variant
+	void writeVariants(const unsigned int sheet_nr, const unsigned int row, const bool append);
+	// Read every selected sheet
+	virtual void readSheets() = 0;
+
+public:
+	// Prepare the common state
+	Workbook(const std::string& filename);
+	// Destructor
+	virtual ~Workbook();
+	// Open a workbook choosing the reader by its type
+	static std::unique_ptr<Workbook> open(const std::string& filename);
+	// Workbooks given by a file name
+	static std::vector<std::string> expand(const std::string& filename);
+	// Only export sheets matching the pattern
+	void filterSheet(const std::string& pattern);
+	// Only export dat files matching the pattern
+	void filterObject(const std::string& pattern);
+	// Also export a variant
+	void addVariant(const std::string& name);
+	// Send dats to another output
+	void setOutput(DatOutput& dat_output);
+	// Write warnings to another stream
+	void setLog(std::ostream& stream);
+	// Check the objects while exporting
+	void setValidator(Validator& object_validator);
+	// Collect the objects in a table instead of writing dats
+	void setTable(Table& objects);
+	// Approximate memory needed to parse the workbook
+	virtual const unsigned long long memoryEstimate() const = 0;
+	// Parse the workbook
+	void parse();
+	// Directories of the exported sheets
+	std::vector<std::string> exportedDirs() const;
+	// Check if text matches any of the glob patterns
+	static bool matchesAny(const std::vector<std::string>& patterns, const std::string& text);
+	// Match text against a glob pattern
+	static bool globMatch(const char* pattern, const char* text);
+};
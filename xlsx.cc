@@ -1,7 +1,10 @@
-#include <iostream> // cout, cerr, clog, endl, ios
-#include <sstream>  // ostringstream
-#include <fstream>  // ofstream
-#include <string>   // string
+#include <iostream>  // cout, cerr, clog, endl, ios
+#include <sstream>   // ostringstream
+#include <string>    // string
+#include <cstring>   // strcmp
+#include <cstdlib>   // strtoul, strtol
+#include <charconv>  // from_chars
+#include <map>       // map
 #include "xlsx.hh"
 
 /**
@@ -12,7 +15,7 @@
  *
  * @param filename Name of the spreadsheet file
  */
-XLSX::XLSX(const std::string& filename)
+XLSX::XLSX(const std::string& filename) : Workbook(filename), strings_loaded(false), strings_scan(0), recalc_all(false), current_sheet(0)
 {
 	try {
 		// open as read-only
@@ -39,11 +42,31 @@ XLSX::~XLSX()
 }
 
 /**
- * @brief Parse an xlsx file
+ * @brief Approximate memory needed to parse the file
+ *
+ * Sums the uncompressed size of every entry in the zip. Sheets are
+ * parsed one at a time so even with the overhead of the DOM this is
+ * only exceeded by workbooks made of a single huge sheet.
+ *
+ * @return approximate amount of bytes
+ */
+const unsigned long long XLSX::memoryEstimate() const
+{
+	unsigned long long size = 0;
+
+	for (auto const& entry : sheet->getEntries()) {
+		size += entry.getSize();
+	}
+
+	return size;
+}
+
+/**
+ * @brief Parse the sheets of an xlsx file
  *
  * This function makes the heavy work of parsing the file.
  */
-void XLSX::parse()
+void XLSX::readSheets()
 {
 	// read root .rels file, contains information about file structure
 	pugi::xml_document doc;
@@ -54,12 +77,16 @@ void XLSX::parse()
 
 	xml_open(workbook_path, doc);
 
-	// get sheets id and name and put in vector
+	// saved without recalculating, cached values of formulas can't be trusted
+	recalc_all = doc.child("workbook").child("calcPr").attribute("fullCalcOnLoad").as_bool();
+	calculator.reset();
+
+	// get sheets id and name, the path is only known after reading the relations
+	std::vector<std::string> sheet_ids;
+	std::vector<std::string> sheet_names;
 	for (const pugi::xml_node sheet: doc.child("workbook").child("sheets").children()) {
-		sheet_t sheet_info;
-		sheet_info.id = sheet.attribute("r:id").value();
-		sheet_info.name = sheet.attribute("name").value();
-		sheets_v.push_back(sheet_info);
+		sheet_ids.push_back(sheet.attribute("r:id").value());
+		sheet_names.push_back(sheet.attribute("name").value());
 	}
 
 	// open relations file inside the workbook dir to get where are the sheets and where are the strings stored
@@ -70,33 +97,45 @@ void XLSX::parse()
 	xml_open(workbook_rels, doc);
 
 	// get the relative location of each sheet
-	for (unsigned int i = 0; i < sheets_v.size(); ++i) {
-		sheets_v[i].path = spreadsheet_path + "/" + doc.child("Relationships").find_child_by_attribute("Id", sheets_v[i].id.c_str()).attribute("Target").value();
+	for (unsigned int i = 0; i < sheet_ids.size(); ++i) {
+		addSheet(sheet_names[i], spreadsheet_path + "/" + doc.child("Relationships").find_child_by_attribute("Id", sheet_ids[i].c_str()).attribute("Target").value());
 	}
 
-	// get where are the strings stored
-	const std::string strings_file = spreadsheet_path + "/" + doc.child("Relationships").find_child_by_attribute("Type", "http://schemas.openxmlformats.org/officeDocument/2006/relationships/sharedStrings").attribute("Target").value();
-
-	xml_open(strings_file, doc);
-	strings_xml = doc.child("sst");
+	// get where are the strings stored, they are only read once a string cell is found
+	strings_file = spreadsheet_path + "/" + doc.child("Relationships").find_child_by_attribute("Type", "http://schemas.openxmlformats.org/officeDocument/2006/relationships/sharedStrings").attribute("Target").value();
 
 	// open the sheets and work on them
 	for (unsigned int i = 0; i < sheets_v.size(); ++i) {
+		// sheets not selected are never decompressed
+		if (!sheetSelected(i)) {
+			continue;
+		}
+
 		pugi::xml_document sheet_doc;
 		xml_open(sheets_v[i].path, sheet_doc);
 		const pugi::xml_node sheetData = sheet_doc.child("worksheet").child("sheetData");
+		current_sheet = i;
+		current_data = sheetData;
 
-		// array that will contain the dat parameters names
-		std::string dat_parameters[255];
+		// parameter of each column
+		Schema schema;
 		std::string last_filename;
+		unsigned int row = 0;
+		pugi::xml_node row_node = sheetData.child("row");
 
 		// paramater names are in the first row, let's cache them
-		createDat(sheetData.find_child_by_attribute("r", "1"), i, dat_parameters, last_filename);
+		if (row_node && (row = rowNumber(row_node, row)) == 1) {
+			readHeader(row_node, i, schema);
+			row_node = row_node.next_sibling("row");
+		}
 
 		// generate the dats
-		for (const pugi::xml_node row: sheetData.children()) {
-			createDat(row, i, dat_parameters, last_filename);
+		for (; row_node; row_node = row_node.next_sibling("row")) {
+			row = rowNumber(row_node, row);
+			createDat(row_node, row, i, schema, last_filename);
 		}
+
+		current_data = pugi::xml_node();
 	}
 }
 
@@ -134,159 +173,376 @@ void XLSX::xml_open(const std::string& filename, pugi::xml_document& doc)
 }
 
 /**
- * @brief Create the dat files
+ * @brief Get a string from the shared strings table
  *
- * Reads the passed row data checking if cells are valid and
- * builds the dat file in a stream to later write it at once.
+ * The shared strings xml is only read from the zip when the first
+ * string cell is found. It is not parsed as a whole, the <si>
+ * elements are only located up to the requested index and each
+ * string is decoded the first time it's requested, so strings not
+ * used by the exported sheets are never touched.
  *
- * @note The file name can be set anywhere in the row so we
- * can only write the dat once we have the name of the file.
+ * @param index Zero based index of the string
  *
- * @param row_node XML node of a single XLSX row
- * @param sheet_nr Internal number of the sheet where the
- * data belongs to
- * @param dat_parameters Pointer to the array that contains
- * the paramaters' names
- * @param last_filename Pointer to a string that holds the
- * filename of the previously created file to check if user
- * wants to append to the same dat
+ * @return the string, empty if there's no string at index
  */
-void XLSX::createDat(const pugi::xml_node& row_node, const unsigned char sheet_nr, std::string *const dat_parameters, std::string& last_filename)
+const std::string& XLSX::sharedString(const unsigned int index)
 {
-	const std::string row_number = row_node.attribute("r").value();
+	static const std::string empty;
 
-	if (row_number != "1" && !row_node.find_child_by_attribute("r", ("A" + row_number).c_str())) {
-		return;
+	if (!strings_loaded) {
+		strings_loaded = true;
+		try {
+			strings_data = sheet->getEntry(strings_file).readAsText();
+		}
+		catch (const std::runtime_error& e) {
+			std::ostringstream err_msg;
+			err_msg << "ZIP" << errno << ":" << e.what() << ": " << strings_file;
+			// send to main
+			throw std::runtime_error(err_msg.str());
+		}
 	}
 
-	std::string filename;
-	std::ostringstream dat_stream;
-
-	for (const pugi::xml_node cell: row_node.children()) {
-		const std::string cell_pos = cell.attribute("r").value();
-		const std::string type = cell.attribute("t").value();
-		std::string value = cell.child_value("v");
+	// locate every string up to the requested one
+	while (strings_offsets.size() <= index && strings_scan != std::string::npos) {
+		strings_scan = strings_data.find("<si", strings_scan);
 
-		// not a number
-		if (type != "" && type != "n") {
-			// string
-			if (type == "s") {
-				value = std::to_string(stoi(value) + 1);
-				value = strings_xml.select_node(("si[" + value + "]").c_str()).node().child_value("t");
-			}
-			// boolean
-			else if (type == "b") {
-				value = stoi(value) ? "true" : "false";
-			}
-			else if (type == "inlineStr") {
-				value = cell.child_value("is");
-			}
-			else {
-				std::clog << sheets_v[sheet_nr].name << "(" << cell_pos << ") : Wrong type warning DATAT" << type << ":Data type at " << cell_pos << " is not of expected type!\n\tExpected types: Number, Boolean, String, InlineString\n";
+		if (strings_scan != std::string::npos) {
+			const char next = strings_data[strings_scan + 3];
+			// skip elements that only start with "si"
+			if (next == '>' || next == '/' || next == ' ') {
+				strings_offsets.push_back(strings_scan);
 			}
+			strings_scan += 3;
 		}
+	}
 
-		// get column letter code and transform in a number
-		const std::string column_str = cell_pos.substr(0, cell_pos.rfind(row_number));
-		const unsigned int column_size = column_str.size() - 1;
-		unsigned int column = 0;
-		for (unsigned int i = 0; i <= column_size; ++i) {
-			column += column_str[i] - 'A' + (column_size - i) * 26;
-		}
+	if (index >= strings_offsets.size()) {
+		return empty;
+	}
 
-		// if we are dealing with the first row we save the parameters for later use
-		if (row_number == "1") {
-			*(dat_parameters + column) = value;
-		}
-		// if not build the dat
-		else if ((dat_parameters + column)->size() > 0) {
-			bool is_filename = (*(dat_parameters + column) == "filename");
+	if (strings_values.size() < strings_offsets.size()) {
+		strings_values.resize(strings_offsets.size());
+		strings_resolved.resize(strings_offsets.size(), false);
+	}
 
-			if (!is_filename) {
-				dat_stream << *(dat_parameters + column) << ((dat_parameters + column)->front() == '#' ? " " : "=") << value << std::endl;
-			}
+	if (!strings_resolved[index]) {
+		strings_resolved[index] = true;
+		const std::string::size_type start = strings_offsets[index];
+
+		// <si/> is an empty string
+		if (strings_data.compare(start, 5, "<si/>")) {
+			const std::string::size_type end = strings_data.find("</si>", start);
 
-			if (is_filename || (filename.empty() && *(dat_parameters + column) == "name")) {
-				filename = value;
+			if (end != std::string::npos) {
+				// parse only this element to have entities decoded
+				pugi::xml_document si_doc;
+				si_doc.load_buffer(strings_data.data() + start, end + 5 - start);
+				strings_values[index] = si_doc.child("si").child_value("t");
 			}
 		}
+	}
+
+	return strings_values[index];
+}
+
+/**
+ * @brief Get the number of a row
+ *
+ * @param row_node XML node of a single XLSX row
+ * @param previous Number of the previous row, the `r` attribute
+ * is optional and when missing the row follows the previous one
+ *
+ * @return row number
+ */
+unsigned int XLSX::rowNumber(const pugi::xml_node& row_node, const unsigned int previous)
+{
+	const pugi::xml_attribute r = row_node.attribute("r");
+	return r ? r.as_uint() : previous + 1;
+}
+
+/**
+ * @brief Get the column of a cell
+ *
+ * @param cell XML node of a single XLSX cell
+ * @param sheet_nr Internal number of the sheet, for warnings
+ * @param column Column of the previous cell plus one, receives
+ * the column of this cell. The `r` attribute is optional and when
+ * missing the cell is in the column after the previous one.
+ *
+ * @return false if the reference is invalid or past the last column
+ * and the cell must be ignored
+ */
+bool XLSX::cellColumn(const pugi::xml_node& cell, const unsigned int sheet_nr, unsigned int& column)
+{
+	const pugi::xml_attribute r = cell.attribute("r");
+
+	if (!r) {
+		// without references a row can go on forever, warn once per row
+		if (column == CellRef::MAX_COLUMNS) {
+			*log << sheets_v[sheet_nr].name << " : Too many columns warning DATAC:A row has more than " << CellRef::MAX_COLUMNS << " cells, the cells past the last column were ignored.\n";
+		}
+		return column < CellRef::MAX_COLUMNS;
+	}
 
-		// std::cout << cell_pos << " | " << type << " | " << value << std::endl;
+	unsigned int cell_column, cell_row;
+	if (!CellRef::parse(r.value(), cell_column, cell_row)) {
+		*log << sheets_v[sheet_nr].name << "(" << r.value() << ") : Wrong reference warning DATAR:Cell reference " << r.value() << " is not valid! Cell was ignored.\n";
+		return false;
 	}
 
-	// std::cout << row_number << std::endl;
+	column = cell_column;
+	return true;
+}
+
+/**
+ * @brief Get the value of a cell
+ *
+ * Resolves shared strings and booleans into the text that must
+ * be written in the dat. Nothing is copied, the value points into
+ * the xml or the shared strings table.
+ *
+ * @param cell XML node of a single XLSX cell
+ * @param sheet_nr Internal number of the sheet, for warnings
+ *
+ * @return the value as text, only valid until the next call
+ */
+std::string_view XLSX::cellValue(const pugi::xml_node& cell, const unsigned int sheet_nr)
+{
+	const char* type = cell.attribute("t").value();
+	const char* value = cell.child_value("v");
 
-	// don't generate dat for the first row which is reserved for the dat parameters
-	if (row_number != "1") {
-		// std::cout << dat_stream.str() << std::endl;
-		// std::cout << (filename == last_filename) << " : " << filename << " > " << last_filename << std::endl;
+	// number
+	if (!*type || !std::strcmp(type, "n")) {
+		return value;
+	}
+	// string
+	if (!std::strcmp(type, "s")) {
+		return sharedString(std::strtoul(value, nullptr, 10));
+	}
+	// boolean
+	if (!std::strcmp(type, "b")) {
+		return std::strtol(value, nullptr, 10) ? "true" : "false";
+	}
+	if (!std::strcmp(type, "inlineStr")) {
+		return cell.child("is").child_value("t");
+	}
+	// text given by a formula
+	if (!std::strcmp(type, "str")) {
+		return value;
+	}
 
-		std::string sheet_name = sheets_v[sheet_nr].name;
+	const char* cell_pos = cell.attribute("r").value();
+	*log << sheets_v[sheet_nr].name << "(" << cell_pos << ") : Wrong type warning DATAT" << type << ":Data type at " << cell_pos << " is not of expected type!\n\tExpected types: Number, Boolean, String, InlineString\n";
+	return value;
+}
 
-		std::string::size_type pos = sheet_name.find(";");
-		while (pos != std::string::npos) {
-			sheet_name = sheet_name.replace(pos, 1, "/");
-			pos = sheet_name.find(";");
+/**
+ * @brief Get the value of a formula cell, recomputing it if stale
+ *
+ * The cached value is used unless the calculator finds it stale,
+ * the calculator is only created for the first formula.
+ *
+ * @param cell XML node of a single XLSX cell with a formula
+ * @param sheet_nr Internal number of the sheet
+ * @param column Zero based column of the cell
+ * @param row Row of the cell
+ *
+ * @return the value as text, only valid until the next call
+ */
+std::string_view XLSX::formulaValue(const pugi::xml_node& cell, const unsigned int sheet_nr, const unsigned int column, const unsigned int row)
+{
+	if (!calculator) {
+		std::vector<std::string> names;
+		for (auto const& sheet_info : sheets_v) {
+			names.push_back(sheet_info.name);
 		}
+		calculator.reset(new Calculator(names, recalc_all, *log, [this](const unsigned int sheet_nr) { readFormulas(sheet_nr); }));
+	}
 
-		switch (writeDat(sheet_name + "/" + filename, dat_stream.str(), filename == last_filename)) {
-			default:
-				break;
-			case 1:
-				std::clog << sheets_v[sheet_nr].name << "(" << row_number << ") : No name warning FDATOUT1:Object at row " << row_number << " does not contain a 'name'! No dat file was generated.\n";
-				break;
-			case 2:
-				std::clog << sheets_v[sheet_nr].name << "(" << row_number << ")  : File saving warning FDATOUT2:Could not create file for writing for object " << filename << "!\n";
-				break;
-			case 3:
-				std::clog << sheets_v[sheet_nr].name << "(" << row_number << ") : File writing warning FDATOUT3:An error happened when writting on file for object " << filename << "! File may be corrupt.\n";
+	if (calculator->evaluate(sheet_nr, column, row, formula_value)) {
+		return formula_value;
+	}
+
+	return cellValue(cell, sheet_nr);
+}
+
+/**
+ * @brief Give the cells of a sheet to the calculator
+ *
+ * The sheet being exported is taken from its loaded document,
+ * others are read from the zip. Shared formulas are given with
+ * the cell they were written for so references can be moved.
+ *
+ * @param sheet_nr Internal number of the sheet
+ */
+void XLSX::readFormulas(const unsigned int sheet_nr)
+{
+	pugi::xml_document sheet_doc;
+	pugi::xml_node sheet_data = current_data;
+
+	if (sheet_nr != current_sheet || !current_data) {
+		xml_open(sheets_v[sheet_nr].path, sheet_doc);
+		sheet_data = sheet_doc.child("worksheet").child("sheetData");
+	}
+
+	// text of each shared formula and the cell it was written for
+	struct shared_t {
+		std::string text;
+		unsigned int column;
+		unsigned int row;
+	};
+	std::map<unsigned int, shared_t> shared;
+
+	unsigned int row = 0;
+	for (const pugi::xml_node row_node : sheet_data.children("row")) {
+		row = rowNumber(row_node, row);
+		unsigned int column = 0;
+
+		for (const pugi::xml_node cell : row_node.children("c")) {
+			// invalid references are reported when exporting
+			const pugi::xml_attribute r = cell.attribute("r");
+			unsigned int cell_row;
+			if (r && !CellRef::parse(r.value(), column, cell_row)) {
+				column++;
+				continue;
+			}
+			// cells past the last column would be mistaken for others
+			if (column >= CellRef::MAX_COLUMNS) {
 				break;
+			}
+
+			const char* type = cell.attribute("t").value();
+			const pugi::xml_node v = cell.child("v");
+			Calculator::value_t value{Calculator::value_t::EMPTY, 0, std::string()};
+
+			if (!std::strcmp(type, "inlineStr")) {
+				value = Calculator::value_t{Calculator::value_t::TEXT, 0, cell.child("is").child_value("t")};
+			}
+			else if (v) {
+				const char* text = v.child_value();
+				if (!*type || !std::strcmp(type, "n")) {
+					value.type = Calculator::value_t::NUMBER;
+					std::from_chars(text, text + std::strlen(text), value.number);
+				}
+				else if (!std::strcmp(type, "s")) {
+					value = Calculator::value_t{Calculator::value_t::TEXT, 0, sharedString(std::strtoul(text, nullptr, 10))};
+				}
+				else if (!std::strcmp(type, "b")) {
+					value = Calculator::value_t{Calculator::value_t::BOOLEAN, std::strtol(text, nullptr, 10) ? 1.0 : 0.0, std::string()};
+				}
+				else if (!std::strcmp(type, "e")) {
+					value = Calculator::value_t{Calculator::value_t::ERROR_VALUE, 0, text};
+				}
+				else {
+					value = Calculator::value_t{Calculator::value_t::TEXT, 0, text};
+				}
+			}
+
+			if (value.type != Calculator::value_t::EMPTY) {
+				calculator->setCell(sheet_nr, column, row, value);
+			}
+
+			const pugi::xml_node f = cell.child("f");
+			if (f) {
+				if (!std::strcmp(f.attribute("t").value(), "shared")) {
+					const unsigned int index = f.attribute("si").as_uint();
+					// the first cell holds the text, the others only the index
+					if (*f.child_value()) {
+						shared[index] = shared_t{f.child_value(), column, row};
+					}
+					auto master = shared.find(index);
+					if (master != shared.end()) {
+						calculator->setFormula(sheet_nr, column, row, master->second.text, master->second.column, master->second.row, !v.empty());
+					}
+				}
+				else if (*f.child_value()) {
+					calculator->setFormula(sheet_nr, column, row, f.child_value(), column, row, !v.empty());
+				}
+			}
+
+			column++;
 		}
+	}
+}
+
+/**
+ * @brief Read the parameter names
+ *
+ * Reads the first row of the sheet, which holds the parameter of
+ * each column, and decides once what must be done with each column.
+ *
+ * @param row_node XML node of the first row
+ * @param sheet_nr Internal number of the sheet where the
+ * data belongs to
+ * @param schema Receives the parameter of each column
+ */
+void XLSX::readHeader(const pugi::xml_node& row_node, const unsigned int sheet_nr, Schema& schema)
+{
+	unsigned int column = 0;
 
-		// time to set this filename as the one to be checked next
-		last_filename = filename;
+	for (const pugi::xml_node cell : row_node.children("c")) {
+		if (cellColumn(cell, sheet_nr, column)) {
+			headerCell(schema, column, cellValue(cell, sheet_nr));
+		}
+		column++;
 	}
 }
 
 /**
- * @brief Write the dat file on disk
+ * @brief Create the dat files
  *
- * Simply dumps all data in dat_stream inside a file replacing it
- * if it already exists.
+ * Reads the passed row data checking if cells are valid and
+ * builds the dat file in a buffer to later write it at once.
+ * The row is read in a single pass, references are parsed as
+ * numbers and rows without a cell in column A are skipped as
+ * soon as their first cell is seen. Each line is the prefix
+ * compiled in the schema followed by the value.
  *
- * @param filename Name of the file without extension
- * @param dat_stream String containing the whole dat file
- * @param append Whether it should append to existing file, if not it overwrites
+ * @note The file name can be set anywhere in the row so we
+ * can only write the dat once we have the name of the file.
  *
- * @return 0 if no errors
- * @return 1 if no filename was provided
- * @return 2 if file could not be opened
- * @return 3 if writing failed
+ * @param row_node XML node of a single XLSX row
+ * @param row Number of the row
+ * @param sheet_nr Internal number of the sheet where the
+ * data belongs to
+ * @param schema Parameter and action of each column
+ * @param last_filename Pointer to a string that holds the
+ * filename of the previously created file to check if user
+ * wants to append to the same dat
  */
-const unsigned int XLSX::writeDat(const std::string& filenames, const std::string& dat_stream, const bool append)
+void XLSX::createDat(const pugi::xml_node& row_node, const unsigned int row, const unsigned int sheet_nr, const Schema& schema, std::string& last_filename)
 {
-	// std::cout << filename << ", append: " << append << std::endl;
-	int i = 0;
-	while (filenames[i] == '/') i++;
-	std::string filename = filenames.c_str() + i;
+	unsigned int column = 0;
+	bool first_cell = true;
 
-	if (filename.length() == 0) {
-		return 1;
-	}
+	startDat();
 
-	// open file replacing if it already exists
-	std::ofstream dat_file(filename + ".dat", (append ? std::ios::app : std::ios::trunc));
+	for (const pugi::xml_node cell : row_node.children("c")) {
+		if (!cellColumn(cell, sheet_nr, column)) {
+			column++;
+			continue;
+		}
 
-	if (!dat_file.is_open()) {
-		return 2;
-	}
+		// rows without column A are not objects
+		if (first_cell) {
+			if (column != 0) {
+				return;
+			}
+			first_cell = false;
+		}
 
-	dat_file << (append ? "---\n" : "") << dat_stream;
+		// value of columns without parameter is never read
+		if (schema.action(column) != Schema::SKIP) {
+			addValue(schema, column, cell.child("f") ? formulaValue(cell, sheet_nr, column, row) : cellValue(cell, sheet_nr));
+		}
 
-	dat_file.close();
+		column++;
+	}
 
-	if (dat_file.fail()) {
-		return 3;
+	// empty row
+	if (first_cell) {
+		return;
 	}
-	return 0;
+
+	finishDat(sheet_nr, row, last_filename);
 }
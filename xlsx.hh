@@ -1,42 +1,70 @@
+#pragma once
+#include <string>      // string
+#include <string_view> // string_view
 #include <vector>      // vector
+#include <memory>      // unique_ptr
 #include <libzippp\libzippp.h>     // libzip++
 #include "pugixml-1.14/src/pugixml.hpp" // pugixml
+#include "schema.hh"   // CellRef, Schema
+#include "workbook.hh" // Workbook
+#include "calc.hh"     // Calculator
 
 /**
  * Parser for Office Open XML xlsx documents
  */
-class XLSX
+class XLSX : public Workbook
 {
 	/** pointer to loaded spreadsheet xlsx file */
 	libzippp::ZipArchive *sheet;
-	/** XML DOM node that holds the strings in the xlsx */
-	pugi::xml_node strings_xml;
-	/** structure that holds important sheet data
-	 *
-	 * @note sheet id and name are stored in the workbook xml
-	 * but the path is only stored in the .rels file of the
-	 * workbook.
-	 */
-	struct sheet_t {
-		std::string id;
-		std::string name;
-		std::string path;
-	};
-	/** vector that holds info about each sheet */
-	std::vector<sheet_t> sheets_v;
+	/** location of the shared strings xml inside the zip */
+	std::string strings_file;
+	/** raw shared strings xml, only read when the first string cell is found */
+	std::string strings_data;
+	/** whether strings_data was already read from the zip */
+	bool strings_loaded;
+	/** position where the search for the next <si> element continues */
+	std::string::size_type strings_scan;
+	/** position of each <si> element found so far in strings_data */
+	std::vector<std::string::size_type> strings_offsets;
+	/** decoded shared strings, only valid where strings_resolved is set */
+	std::vector<std::string> strings_values;
+	std::vector<bool> strings_resolved;
+	/** whether the workbook asks for every formula to be recomputed */
+	bool recalc_all;
+	/** computes stale formulas, only created for the first formula found */
+	std::unique_ptr<Calculator> calculator;
+	/** sheet being exported and its cells, given to the calculator without reading it again */
+	unsigned int current_sheet;
+	pugi::xml_node current_data;
+	/** value of the last recomputed formula */
+	std::string formula_value;
 
 	// Get a DOM object of an XML inside the zip
 	void xml_open(const std::string& filename, pugi::xml_document& doc);
+	// Get a string from the shared strings table
+	const std::string& sharedString(const unsigned int index);
+	// Get the number of a row
+	static unsigned int rowNumber(const pugi::xml_node& row_node, const unsigned int previous);
+	// Get the column of a cell
+	bool cellColumn(const pugi::xml_node& cell, const unsigned int sheet_nr, unsigned int& column);
+	// Get the value of a cell
+	std::string_view cellValue(const pugi::xml_node& cell, const unsigned int sheet_nr);
+	// Get the value of a formula cell, recomputing it if stale
+	std::string_view formulaValue(const pugi::xml_node& cell, const unsigned int sheet_nr, const unsigned int column, const unsigned int row);
+	// Give the cells of a sheet to the calculator
+	void readFormulas(const unsigned int sheet_nr);
+	// Read the parameter names
+	void readHeader(const pugi::xml_node& row_node, const unsigned int sheet_nr, Schema& schema);
 	// Create the dat files
-	void createDat(const pugi::xml_node& node, const unsigned char sheet_nr, std::string*const dat_parameters, std::string& last_filename);
-	// Write the dat file on disk
-	const unsigned int writeDat(const std::string& filename, const std::string& dat_stream, const bool append);
+	void createDat(const pugi::xml_node& row_node, const unsigned int row, const unsigned int sheet_nr, const Schema& schema, std::string& last_filename);
+	// Parse the sheets of an xlsx file
+	void readSheets() override;
 
 public:
 	// Open an xlsx file
 	XLSX(const std::string& filename);
 	// Destructor
 	~XLSX();
-	// Parse an xlsx file
-	void parse();
+	// Approximate memory needed to parse the file
+	const unsigned long long memoryEstimate() const override;
 };